@@ -0,0 +1,965 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "RaySuite.h"
+#include "Scenes.h"
+#include "../intersection/Bvh.h"
+#include "../intersection/KdScene.h"
+#include "../intersection/KdTree.h"
+#include "../intersection/TriangleIntersection.h"
+#include "../util/ThreadPool.h"
+
+/// Headless benchmark for the intersection module (no window/OpenGL needed).
+
+#pragma region Allocation counting
+static std::atomic<unsigned long long> allocationCount = 0;
+
+void* operator new(std::size_t size)
+{
+	allocationCount++;
+	if (void* memory = std::malloc(size == 0 ? 1 : size))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+#pragma endregion
+
+/// <summary>
+/// Compares single raycasts and raycastBatch on the same rays.
+/// Returns false if the results differ.
+/// </summary>
+bool benchmarkBatch(KdTree& kdTree, const std::vector<KdStructs::Ray>& rays, const char* name)
+{
+	std::cout << "\n[*] Batch vs. single (" << name << " rays)" << std::endl;
+
+	std::vector<KdStructs::RayHit> singleHits(rays.size());
+	std::vector<bool> singleHasHit(rays.size());
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < rays.size(); i++)
+		singleHasHit[i] = kdTree.raycast(rays[i], singleHits[i]);
+	auto end = std::chrono::high_resolution_clock::now();
+	double singleSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	KdStructs::RayHitBuffer hits;
+	hits.resize(rays.size());
+	start = std::chrono::high_resolution_clock::now();
+	kdTree.raycastBatch(&rays[0], rays.size(), hits);
+	end = std::chrono::high_resolution_clock::now();
+	double batchSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	unsigned int differences = 0;
+	for (size_t i = 0; i < rays.size(); i++)
+		if (singleHasHit[i] != hits.isHit(i) || (hits.isHit(i) && std::fabs(singleHits[i].distance - hits.distances[i]) > 0.0001f))
+			differences++;
+
+	std::cout << "Single: " << (unsigned long long)(rays.size() / singleSeconds) << " rays per second" << std::endl;
+	std::cout << "Batch: " << (unsigned long long)(rays.size() / batchSeconds) << " rays per second | Speedup: " << singleSeconds / batchSeconds << std::endl;
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Casts the rays with raycastBatch on 1 to hardware_concurrency threads.
+/// Returns false if a parallel run differs from the serial one.
+/// </summary>
+bool benchmarkParallelBatch(const KdTree& kdTree, const std::vector<KdStructs::Ray>& rays)
+{
+	std::cout << "\n[*] Parallel raycastBatch (" << rays.size() << " rays)" << std::endl;
+
+	KdStructs::RayHitBuffer serialHits;
+	auto start = std::chrono::high_resolution_clock::now();
+	kdTree.raycastBatch(&rays[0], rays.size(), serialHits);
+	auto end = std::chrono::high_resolution_clock::now();
+	double serialSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	std::cout << "Serial: " << (unsigned long long)(rays.size() / serialSeconds) << " rays per second" << std::endl;
+
+	bool identical = true;
+	KdStructs::RayHitBuffer hits;
+	unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount++)
+	{
+		ThreadPool threadPool(threadCount);
+		start = std::chrono::high_resolution_clock::now();
+		kdTree.raycastBatch(&rays[0], rays.size(), hits, &threadPool);
+		end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+		bool sameHits = hits.triangles == serialHits.triangles && hits.distances == serialHits.distances;
+		identical = identical && sameHits;
+		std::cout << threadCount << " thread(s): " << (unsigned long long)(rays.size() / seconds) << " rays per second | Speedup: " << serialSeconds / seconds
+			<< (sameHits ? "" : " | DIFFERENT HITS") << std::endl;
+	}
+	return identical;
+}
+
+/// <summary>
+/// Shadow rays from random points towards a light, answered once with raycast and once with occluded.
+/// Returns false if the answers differ.
+/// </summary>
+bool benchmarkOcclusion(KdTree& kdTree, int count)
+{
+	std::cout << "\n[*] Occlusion vs. closest hit (" << count << " shadow rays)" << std::endl;
+
+	KdStructs::Vector lightPosition = KdStructs::Vector(80.0f, 6.0f, 30.0f);
+	std::mt19937 random(3);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(count);
+	for (int i = 0; i < count; i++)
+	{
+		// Points slightly above the ground between the cubes
+		KdStructs::Vector origin = KdStructs::Vector(distribution(random) * 48.0f, -1.9f, distribution(random) * 48.0f);
+		KdStructs::Vector toLight = lightPosition - origin;
+		float distance = std::sqrt(toLight.dot(toLight));
+		rays.push_back(KdStructs::Ray(origin, toLight * (1.0f / distance), distance));
+	}
+
+	std::vector<bool> blocked(count);
+	KdStructs::RayHit hit;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		blocked[i] = kdTree.raycast(rays[i], hit) && hit.distance < rays[i].distance;
+	auto end = std::chrono::high_resolution_clock::now();
+	double raycastSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	unsigned int differences = 0;
+	unsigned int occludedCount = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+	{
+		bool occluded = kdTree.occluded(rays[i], rays[i].distance);
+		occludedCount += occluded ? 1 : 0;
+		differences += occluded != blocked[i] ? 1 : 0;
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double occludedSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	std::cout << "Occluded: " << occludedCount << "/" << count << std::endl;
+	std::cout << "raycast: " << (unsigned long long)(count / raycastSeconds) << " rays per second" << std::endl;
+	std::cout << "occluded: " << (unsigned long long)(count / occludedSeconds) << " rays per second | Speedup: " << raycastSeconds / occludedSeconds << std::endl;
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Tests rays against a triangle soup with the single triangle function and every block kernel
+/// the CPU supports. Returns false if a kernel finds different hits.
+/// </summary>
+bool benchmarkTriangleKernels()
+{
+	const int TRIANGLE_COUNT = 4096;
+	const int RAY_COUNT = 2000;
+	std::cout << "\n[*] Triangle kernels (" << TRIANGLE_COUNT << " triangles, " << RAY_COUNT << " rays)" << std::endl;
+
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+	std::vector<KdStructs::Triangle> triangles;
+	std::vector<unsigned int> triangleIndices;
+	for (int i = 0; i < TRIANGLE_COUNT; i++)
+	{
+		KdStructs::Vector a = KdStructs::Vector(distribution(random), distribution(random), distribution(random));
+		KdStructs::Vector b = a + KdStructs::Vector(distribution(random), distribution(random), distribution(random)) * 0.2f;
+		KdStructs::Vector c = a + KdStructs::Vector(distribution(random), distribution(random), distribution(random)) * 0.2f;
+		triangles.push_back(KdStructs::Triangle(a, b, c));
+		triangleIndices.push_back(i);
+	}
+	std::vector<KdStructs::TriangleBlock> blocks;
+	KdStructs::appendTriangleBlocks(triangles, &triangleIndices[0], TRIANGLE_COUNT, blocks);
+	std::vector<KdStructs::Ray> rays = createRandomRays(RAY_COUNT, 11);
+
+	// Reference: one triangle at a time
+	std::vector<unsigned int> expected(RAY_COUNT, KdStructs::NO_TRIANGLE);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int ray = 0; ray < RAY_COUNT; ray++)
+	{
+		float closest = rays[ray].distance;
+		for (int triangle = 0; triangle < TRIANGLE_COUNT; triangle++)
+		{
+			float distance = KdStructs::rayIntersectionWithTriangle(triangles[triangle], rays[ray]);
+			if (distance < 0 || distance > closest)
+				continue;
+			closest = distance;
+			expected[ray] = triangle;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	double referenceSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	double tests = (double)TRIANGLE_COUNT * RAY_COUNT;
+	std::cout << "Single triangle: " << (unsigned long long)(tests / referenceSeconds) << " triangles per second" << std::endl;
+
+	bool identical = true;
+	KdStructs::SimdLevel supported = KdStructs::detectSimdLevel();
+	for (KdStructs::SimdLevel level : { KdStructs::SimdLevel::SCALAR, KdStructs::SimdLevel::SSE, KdStructs::SimdLevel::AVX2 })
+	{
+		if (level > supported)
+			break;
+
+		KdStructs::BlockIntersector intersectBlocks = KdStructs::getBlockIntersector(level);
+		unsigned int differences = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for (int ray = 0; ray < RAY_COUNT; ray++)
+		{
+			float closest = rays[ray].distance;
+			if (intersectBlocks(&blocks[0], blocks.size(), rays[ray], closest) != expected[ray])
+				differences++;
+		}
+		end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+		std::cout << KdStructs::getSimdLevelName(level) << " blocks: " << (unsigned long long)(tests / seconds) << " triangles per second | Speedup: "
+			<< referenceSeconds / seconds << " | Different results: " << differences << std::endl;
+		identical = identical && differences == 0;
+	}
+	return identical;
+}
+
+/// <summary>
+/// Compares the watertight triangle test with Moller-Trumbore: rays aimed exactly at shared edges and vertices
+/// of a terrain (where Moller-Trumbore can slip through between both triangles), the throughput of the block kernels
+/// and backface culling. Returns false if the watertight test misses an edge, a kernel finds different hits
+/// or the kd-tree misses different edge rays than the test against all triangles (rays along cell borders).
+/// </summary>
+bool benchmarkTriangleTests()
+{
+	const int QUADS = 64;
+	const int EDGE_RAY_COUNT = 20000;
+	std::cout << "\n[*] Triangle tests (" << EDGE_RAY_COUNT << " rays at shared edges of a " << QUADS << "x" << QUADS << " terrain)" << std::endl;
+
+	std::vector<float> terrain = createTerrain(QUADS);
+	KdTree kdTree = KdTree(&terrain[0], terrain.size() / 3, KdTree::BuildMode::SAH);
+	std::vector<KdStructs::Triangle> triangles;
+	std::vector<unsigned int> triangleIndices;
+	for (size_t vertex = 0; vertex < terrain.size(); vertex += 9)
+	{
+		const float* corners = &terrain[vertex];
+		triangles.push_back(KdStructs::Triangle(KdStructs::Vector(corners[0], corners[1], corners[2]),
+			KdStructs::Vector(corners[3], corners[4], corners[5]), KdStructs::Vector(corners[6], corners[7], corners[8])));
+		triangleIndices.push_back(triangleIndices.size());
+	}
+	std::vector<KdStructs::TriangleBlock> blocks;
+	KdStructs::appendTriangleBlocks(triangles, &triangleIndices[0], triangleIndices.size(), blocks);
+	KdStructs::SimdLevel supported = KdStructs::detectSimdLevel();
+
+	std::mt19937 random(23);
+	std::uniform_int_distribution<int> quadDistribution(QUADS / 8, QUADS - QUADS / 8 - 1);
+	std::uniform_int_distribution<int> cornerDistribution(0, 5);
+	std::uniform_real_distribution<float> offsetDistribution(-3.0f, 3.0f);
+	std::uniform_real_distribution<float> edgeDistribution(0.0f, 1.0f);
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(EDGE_RAY_COUNT);
+	for (int i = 0; i < EDGE_RAY_COUNT; i++)
+	{
+		// Interior quads only, so every edge is shared by two triangles. Every 8th ray goes through a vertex.
+		size_t quad = (size_t)quadDistribution(random) * QUADS + quadDistribution(random);
+		int corner = cornerDistribution(random);
+		int next = corner % 3 == 2 ? corner - 2 : corner + 1;
+		const float* from = &terrain[(quad * 6 + corner) * 3];
+		const float* to = &terrain[(quad * 6 + next) * 3];
+		float s = i % 8 == 0 ? 0.0f : edgeDistribution(random);
+		KdStructs::Vector target = KdStructs::Vector(from[0], from[1], from[2]) + (KdStructs::Vector(to[0], to[1], to[2]) - KdStructs::Vector(from[0], from[1], from[2])) * s;
+
+		// From below, so the rays see the front faces (the terrain is wound towards -y).
+		KdStructs::Vector origin = target + KdStructs::Vector(offsetDistribution(random), -10.0f, offsetDistribution(random));
+		KdStructs::Vector direction = target - origin;
+		rays.push_back(KdStructs::Ray(origin, direction * (1.0f / std::sqrt(direction.dot(direction))), 1000.0f, i % 2 == 1));
+	}
+
+	bool identical = true;
+	for (KdStructs::TriangleTest test : { KdStructs::TriangleTest::MOLLER_TRUMBORE, KdStructs::TriangleTest::WATERTIGHT })
+	{
+		KdStructs::BlockIntersector intersectBlocks = KdStructs::getBlockIntersector(supported, test);
+		unsigned int misses = 0;
+		for (const KdStructs::Ray& ray : rays)
+		{
+			float closest = ray.distance;
+			misses += intersectBlocks(&blocks[0], blocks.size(), ray, closest) == KdStructs::NO_TRIANGLE ? 1 : 0;
+		}
+
+		kdTree.setTriangleTest(test);
+		unsigned int treeMisses = 0;
+		KdStructs::RayHit hit;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (const KdStructs::Ray& ray : rays)
+			treeMisses += kdTree.raycast(ray, hit) ? 0 : 1;
+		auto end = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+		std::cout << KdStructs::getTriangleTestName(test) << ": " << misses << " missed edges | kd-tree: " << treeMisses << " missed, "
+			<< (unsigned long long)(rays.size() / seconds) << " rays per second" << std::endl;
+		identical = identical && treeMisses == misses;
+		if (test == KdStructs::TriangleTest::WATERTIGHT)
+			identical = identical && misses == 0;
+	}
+
+	// Kernel throughput on a triangle soup (facing both ways), every kernel has to match the single triangle function of its test.
+	const int TRIANGLE_COUNT = 4096;
+	const int RAY_COUNT = 2000;
+	std::uniform_real_distribution<float> distribution(-10.0f, 10.0f);
+	triangles.clear();
+	triangleIndices.clear();
+	for (int i = 0; i < TRIANGLE_COUNT; i++)
+	{
+		KdStructs::Vector a = KdStructs::Vector(distribution(random), distribution(random), distribution(random));
+		KdStructs::Vector b = a + KdStructs::Vector(distribution(random), distribution(random), distribution(random)) * 0.2f;
+		KdStructs::Vector c = a + KdStructs::Vector(distribution(random), distribution(random), distribution(random)) * 0.2f;
+		triangles.push_back(KdStructs::Triangle(a, b, c));
+		triangleIndices.push_back(i);
+	}
+	blocks.clear();
+	KdStructs::appendTriangleBlocks(triangles, &triangleIndices[0], TRIANGLE_COUNT, blocks);
+	std::vector<KdStructs::Ray> soupRays = createRandomRays(RAY_COUNT, 13);
+	double tests = (double)TRIANGLE_COUNT * RAY_COUNT;
+
+	std::cout << "Kernels (" << TRIANGLE_COUNT << " triangles, " << RAY_COUNT << " rays):" << std::endl;
+	for (KdStructs::TriangleTest test : { KdStructs::TriangleTest::MOLLER_TRUMBORE, KdStructs::TriangleTest::WATERTIGHT })
+		for (bool cullBackfaces : { false, true })
+		{
+			// Every second culling ray treats clockwise triangles as front faces (like rays into mirrored instances)
+			for (size_t ray = 0; ray < soupRays.size(); ray++) {
+				soupRays[ray].cullBackfaces = cullBackfaces;
+				soupRays[ray].clockwiseFrontFaces = cullBackfaces && ray % 2 == 1;
+			}
+
+			std::vector<unsigned int> expected(RAY_COUNT, KdStructs::NO_TRIANGLE);
+			unsigned int backHits = 0;
+			for (int ray = 0; ray < RAY_COUNT; ray++)
+			{
+				float closest = soupRays[ray].distance;
+				for (int triangle = 0; triangle < TRIANGLE_COUNT; triangle++)
+				{
+					float distance = test == KdStructs::TriangleTest::WATERTIGHT
+						? KdStructs::rayIntersectionWithTriangleWatertight(triangles[triangle], soupRays[ray])
+						: KdStructs::rayIntersectionWithTriangle(triangles[triangle], soupRays[ray]);
+					if (distance < 0 || distance > closest)
+						continue;
+					closest = distance;
+					expected[ray] = triangle;
+				}
+
+				// Culling rays may only hit triangles wound counter-clockwise (or clockwise if flipped) towards them.
+				if (expected[ray] != KdStructs::NO_TRIANGLE) {
+					const KdStructs::Triangle& triangle = triangles[expected[ray]];
+					float facing = (triangle.b - triangle.a).cross(triangle.c - triangle.a).dot(soupRays[ray].direction);
+					if (soupRays[ray].clockwiseFrontFaces ? facing < 0 : facing > 0)
+						backHits++;
+				}
+			}
+			if (cullBackfaces && backHits > 0) {
+				std::cout << "[!] " << backHits << " back faces hit with culling" << std::endl;
+				identical = false;
+			}
+
+			std::cout << "  " << KdStructs::getTriangleTestName(test) << (cullBackfaces ? ", culling" : ", double-sided") << ":";
+			for (KdStructs::SimdLevel level : { KdStructs::SimdLevel::SCALAR, KdStructs::SimdLevel::SSE, KdStructs::SimdLevel::AVX2 })
+			{
+				if (level > supported)
+					break;
+
+				KdStructs::BlockIntersector intersectBlocks = KdStructs::getBlockIntersector(level, test);
+				unsigned int differences = 0;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int ray = 0; ray < RAY_COUNT; ray++)
+				{
+					float closest = soupRays[ray].distance;
+					if (intersectBlocks(&blocks[0], blocks.size(), soupRays[ray], closest) != expected[ray])
+						differences++;
+				}
+				auto end = std::chrono::high_resolution_clock::now();
+				double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+				std::cout << " " << KdStructs::getSimdLevelName(level) << " " << (unsigned long long)(tests / seconds) << "/s";
+				if (differences > 0)
+					std::cout << " (" << differences << " different)";
+				identical = identical && differences == 0;
+			}
+			std::cout << std::endl;
+		}
+	return identical;
+}
+
+/// <summary>
+/// Builds a tree with the given mode and casts all rays against it.
+/// Returns the number of allocations done while raycasting.
+/// </summary>
+unsigned long long benchmarkRaycast(std::vector<float>& vertices, const std::vector<KdStructs::Ray>& rays, KdTree::BuildMode buildMode)
+{
+	std::cout << "\n[*] " << (buildMode == KdTree::BuildMode::SAH ? "SAH" : "Median") << " kd-tree" << std::endl;
+	auto start = std::chrono::high_resolution_clock::now();
+	KdTree kdTree = KdTree(&vertices[0], vertices.size() / 3, buildMode);
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Building time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds." << std::endl;
+
+	unsigned int hits = 0;
+	KdStructs::RayHit hit;
+	unsigned long long allocationsBefore = allocationCount;
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		hits += kdTree.raycast(ray, hit) ? 1 : 0;
+	end = std::chrono::high_resolution_clock::now();
+	unsigned long long allocations = allocationCount - allocationsBefore;
+
+	double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	std::cout << "Rays: " << rays.size() << " | Hits: " << hits << std::endl;
+	std::cout << "Rays per second: " << (unsigned long long)(rays.size() / seconds) << std::endl;
+	std::cout << "Allocations per raycast: " << (double)allocations / rays.size() << std::endl;
+	return allocations;
+}
+
+/// <summary>
+/// Compares the node and triangle index arrays byte by byte, including the triangle range of every node.
+/// </summary>
+bool isSameTree(const KdTree& kdTree, const KdTree& other)
+{
+	KdStructs::ArrayView<KdStructs::Node> nodes = kdTree.getNodes();
+	KdStructs::ArrayView<unsigned int> triangleIndices = kdTree.getTriangleIndices();
+	if (nodes.size() != other.getNodes().size() || triangleIndices.size() != other.getTriangleIndices().size()
+		|| std::memcmp(nodes.data(), other.getNodes().data(), nodes.size() * sizeof(KdStructs::Node)) != 0
+		|| !std::equal(triangleIndices.begin(), triangleIndices.end(), other.getTriangleIndices().begin()))
+		return false;
+
+	for (unsigned int node = 0; node < nodes.size(); node++)
+		if (kdTree.getNodeTriangles(node).data() - triangleIndices.data() != other.getNodeTriangles(node).data() - other.getTriangleIndices().data()
+			|| kdTree.getNodeTriangles(node).size() != other.getNodeTriangles(node).size())
+			return false;
+	return true;
+}
+
+/// <summary>
+/// Compares the k-nearest and radius queries against a brute force scan over all points.
+/// Returns false if any result differs.
+/// </summary>
+bool benchmarkPointQueries(const KdTree& kdTree, int queryCount)
+{
+	std::cout << "\n[*] Point queries (" << kdTree.getPointCount() << " points, " << queryCount << " queries)" << std::endl;
+	const unsigned int K = 8;
+	const float RADIUS = 1.0f;
+
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::vector<KdStructs::Vector> positions;
+	for (int i = 0; i < queryCount; i++)
+		positions.push_back(KdStructs::Vector(distribution(random) * 50.0f, distribution(random) * 3.0f, distribution(random) * 50.0f));
+
+	std::vector<KdStructs::PointHit> results;
+	results.reserve(1024);
+	unsigned long long found = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Vector& position : positions)
+		found += kdTree.nearest(position, K, results);
+	auto end = std::chrono::high_resolution_clock::now();
+	double nearestSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Vector& position : positions)
+		found += kdTree.withinRadius(position, RADIUS, results);
+	end = std::chrono::high_resolution_clock::now();
+	double radiusSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	// Brute force
+	unsigned int differences = 0;
+	std::vector<KdStructs::PointHit> expected;
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Vector& position : positions)
+	{
+		expected.clear();
+		for (unsigned int point = 0; point < kdTree.getPointCount(); point++)
+		{
+			KdStructs::Vector offset = kdTree.getPointPosition(point) - position;
+			expected.push_back(KdStructs::PointHit(point, offset.dot(offset)));
+		}
+		std::sort(expected.begin(), expected.end());
+
+		kdTree.nearest(position, K, results);
+		for (unsigned int i = 0; i < std::min<size_t>(K, expected.size()); i++)
+			if (results.size() <= i || results[i].point != expected[i].point)
+				differences++;
+
+		kdTree.withinRadius(position, RADIUS, results);
+		size_t inRadius = std::upper_bound(expected.begin(), expected.end(), KdStructs::PointHit(~0u, RADIUS * RADIUS)) - expected.begin();
+		if (results.size() != inRadius || !std::equal(results.begin(), results.end(), expected.begin(),
+			[](const KdStructs::PointHit& a, const KdStructs::PointHit& b) { return a.point == b.point; }))
+			differences++;
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double bruteForceSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	std::cout << "nearest (k = " << K << "): " << (unsigned long long)(queryCount / nearestSeconds) << " queries per second" << std::endl;
+	std::cout << "withinRadius (r = " << RADIUS << "): " << (unsigned long long)(queryCount / radiusSeconds) << " queries per second" << std::endl;
+	std::cout << "Brute force (both): " << (unsigned long long)(queryCount / bruteForceSeconds) << " queries per second | Points found: " << found << std::endl;
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Compares the box and frustum queries against testing every triangle.
+/// Box results have to match exactly. The frustum test is conservative: every triangle with a corner inside
+/// has to be found, every found triangle's bounds have to touch the frustum. Returns false if any result is wrong.
+/// </summary>
+bool benchmarkRegionQueries(const KdTree& kdTree, int queryCount)
+{
+	std::cout << "\n[*] Region queries (" << kdTree.getTriangleCount() << " triangles, " << queryCount << " queries)" << std::endl;
+
+	std::mt19937 random(11);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::vector<KdStructs::BoundingBox> boxes;
+	std::vector<KdStructs::Frustum> frustums;
+	for (int i = 0; i < queryCount; i++)
+	{
+		KdStructs::Vector center(distribution(random) * 50.0f, distribution(random) * 3.0f, distribution(random) * 50.0f);
+		KdStructs::Vector extent(2.0f + distribution(random), 2.0f + distribution(random), 2.0f + distribution(random));
+		boxes.push_back(KdStructs::BoundingBox(center - extent, center + extent));
+
+		glm::vec3 eye(distribution(random) * 50.0f, 2.0f, distribution(random) * 50.0f);
+		glm::vec3 target = eye + glm::vec3(distribution(random), distribution(random) * 0.2f, distribution(random));
+		glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 30.0f) * glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+		frustums.push_back(KdStructs::Frustum::fromMatrix(&viewProjection[0][0]));
+	}
+
+	std::vector<unsigned int> results;
+	unsigned long long found = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::BoundingBox& box : boxes)
+		found += kdTree.queryAABB(box, results);
+	auto end = std::chrono::high_resolution_clock::now();
+	double boxSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Frustum& frustum : frustums)
+		found += kdTree.queryFrustum(frustum, results);
+	end = std::chrono::high_resolution_clock::now();
+	double frustumSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	unsigned int differences = 0;
+	std::vector<unsigned int> expected;
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < queryCount; i++)
+	{
+		expected.clear();
+		for (unsigned int triangle = 0; triangle < kdTree.getTriangleCount(); triangle++)
+			if (boxes[i].overlaps(KdStructs::BoundingBox(kdTree.getTriangle(triangle))))
+				expected.push_back(triangle);
+		kdTree.queryAABB(boxes[i], results);
+		if (results != expected)
+			differences++;
+
+		kdTree.queryFrustum(frustums[i], results);
+		for (unsigned int triangle = 0; triangle < kdTree.getTriangleCount(); triangle++)
+		{
+			const KdStructs::Triangle& corners = kdTree.getTriangle(triangle);
+			bool cornerInside = false;
+			for (const KdStructs::Vector& corner : { corners.a, corners.b, corners.c })
+				cornerInside = cornerInside || frustums[i].intersects(KdStructs::BoundingBox(corner, corner));
+			bool isFound = std::binary_search(results.begin(), results.end(), triangle);
+			if ((cornerInside && !isFound) || (isFound && !frustums[i].intersects(KdStructs::BoundingBox(corners))))
+				differences++;
+		}
+	}
+	end = std::chrono::high_resolution_clock::now();
+	double bruteForceSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	std::cout << "queryAABB: " << (unsigned long long)(queryCount / boxSeconds) << " queries per second" << std::endl;
+	std::cout << "queryFrustum: " << (unsigned long long)(queryCount / frustumSeconds) << " queries per second" << std::endl;
+	std::cout << "Brute force (both): " << (unsigned long long)(queryCount / bruteForceSeconds) << " queries per second | Triangles found: " << found << std::endl;
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Builds the tree with 1 to hardware_concurrency threads and reports the speedup.
+/// Returns false if a parallel build differs from the serial one.
+/// </summary>
+bool benchmarkParallelBuild(std::vector<float>& vertices, KdTree::BuildMode buildMode)
+{
+	std::cout << "\n[*] Parallel " << (buildMode == KdTree::BuildMode::SAH ? "SAH" : "Median") << " build" << std::endl;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	KdTree serialTree = KdTree(&vertices[0], vertices.size() / 3, buildMode);
+	auto end = std::chrono::high_resolution_clock::now();
+	long long serialTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Serial: " << serialTime << " microseconds." << std::endl;
+
+	bool identical = true;
+	unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount++)
+	{
+		ThreadPool threadPool(threadCount);
+		start = std::chrono::high_resolution_clock::now();
+		KdTree kdTree = KdTree(&vertices[0], vertices.size() / 3, buildMode, &threadPool);
+		end = std::chrono::high_resolution_clock::now();
+		long long time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+		bool sameTree = isSameTree(kdTree, serialTree);
+		identical = identical && sameTree;
+
+		std::cout << threadCount << " thread(s): " << time << " microseconds | Speedup: " << (double)serialTime / std::max(1ll, time)
+			<< (sameTree ? "" : " | DIFFERENT TREE") << std::endl;
+	}
+	return identical;
+}
+
+/// <summary>
+/// Compares building the tree with loading it from a saved file.
+/// Returns false if the loaded tree differs or a file for other geometry is accepted.
+/// </summary>
+bool benchmarkSaveLoad(std::vector<float>& vertices, const std::vector<KdStructs::Ray>& rays, KdTree::BuildMode buildMode)
+{
+	std::cout << "\n[*] Save/load " << (buildMode == KdTree::BuildMode::SAH ? "SAH" : "Median") << " tree" << std::endl;
+	const std::string path = "benchmark.kdtree";
+	uint64_t sceneHash = KdTree::hashScene(&vertices[0], vertices.size() / 3, buildMode);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	KdTree builtTree = KdTree(&vertices[0], vertices.size() / 3, buildMode);
+	auto end = std::chrono::high_resolution_clock::now();
+	long long buildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	bool saved = builtTree.save(path, sceneHash);
+	end = std::chrono::high_resolution_clock::now();
+	long long saveTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	std::unique_ptr<KdTree> loadedTree(KdTree::load(path, sceneHash));
+	end = std::chrono::high_resolution_clock::now();
+	long long loadTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	std::cout << "Build: " << buildTime << " microseconds | Save: " << saveTime << " microseconds | Load: " << loadTime
+		<< " microseconds | Speedup: " << (double)buildTime / std::max(1ll, loadTime) << std::endl;
+	if (!saved || loadedTree == nullptr)
+	{
+		std::cout << "Could not save or load " << path << std::endl;
+		std::remove(path.c_str());
+		return false;
+	}
+
+	unsigned int differences = isSameTree(builtTree, *loadedTree) ? 0 : 1;
+	for (const KdStructs::Ray& ray : rays)
+	{
+		KdStructs::RayHit builtHit, loadedHit;
+		bool builtResult = builtTree.raycast(ray, builtHit);
+		bool loadedResult = loadedTree->raycast(ray, loadedHit);
+		if (builtResult != loadedResult || (builtResult && (builtHit.distance != loadedHit.distance || !(builtHit.position == loadedHit.position))))
+			differences++;
+	}
+
+	std::vector<KdStructs::PointHit> builtPoints, loadedPoints;
+	for (size_t i = 0; i < rays.size(); i += 100)
+	{
+		builtTree.nearest(rays[i].origin, 4, builtPoints);
+		loadedTree->nearest(rays[i].origin, 4, loadedPoints);
+		for (size_t j = 0; j < builtPoints.size(); j++)
+			if (loadedPoints.size() != builtPoints.size() || loadedPoints[j].point != builtPoints[j].point)
+				differences++;
+	}
+
+	// Files of other scenes have to be rejected.
+	std::unique_ptr<KdTree> outdatedTree(KdTree::load(path, sceneHash + 1));
+	if (outdatedTree != nullptr)
+		differences++;
+
+	loadedTree.reset();
+	std::remove(path.c_str());
+	std::cout << "Differences: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Median build time of terrains from 10k to 1M triangles (the median build welds all vertices first).
+/// The time per triangle should stay roughly constant (n log n for the tree itself).
+/// </summary>
+void benchmarkConstructionScaling()
+{
+	std::cout << "\n[*] Construction scaling (non-indexed terrain, median build)" << std::endl;
+	for (int quadsPerAxis : { 71, 224, 708 })
+	{
+		std::vector<float> vertices = createTerrain(quadsPerAxis);
+		unsigned int triangleCount = vertices.size() / 9;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		KdTree kdTree = KdTree(&vertices[0], vertices.size() / 3, KdTree::BuildMode::MEDIAN);
+		auto end = std::chrono::high_resolution_clock::now();
+		long long time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+		std::cout << "Triangles: " << triangleCount << " | Time: " << time << " microseconds | "
+			<< (double)time * 1000.0 / triangleCount << " ns per triangle" << std::endl;
+	}
+}
+
+/// <summary>
+/// Compares moving objects in the two-level scene with rebuilding a single tree over the world space geometry.
+/// Returns false if the scene hits differ from the rebuilt tree.
+/// </summary>
+bool benchmarkDynamicScene(const std::vector<KdStructs::Ray>& rays)
+{
+	const int OBJECTS_PER_AXIS = 8;
+	std::vector<float> objectVertices = createTerrain(16);
+	std::vector<glm::mat4> transforms;
+	for (int x = 0; x < OBJECTS_PER_AXIS; x++)
+		for (int z = 0; z < OBJECTS_PER_AXIS; z++)
+		{
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x * 10.0f - 40.0f, (x + z) % 3 - 1.0f, z * 10.0f - 40.0f));
+			transform = glm::rotate(transform, glm::radians(x * 20.0f + z * 7.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			// Every third row is mirrored, which flips the winding of its triangles
+			glm::vec3 scale = glm::vec3(1.0f + (x % 2) * 0.5f);
+			if (z % 3 == 0)
+				scale.z = -scale.z;
+			transforms.push_back(glm::scale(transform, scale));
+		}
+	std::cout << "\n[*] Dynamic scene (" << transforms.size() << " objects, " << transforms.size() * objectVertices.size() / 9 << " triangles)" << std::endl;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	KdScene scene;
+	for (const glm::mat4& transform : transforms)
+		scene.addObject(objectVertices.data(), objectVertices.size() / 3, transform);
+	scene.update();
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Scene build: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds" << std::endl;
+	// All objects are instances of the same terrain.
+	scene.printStatistics();
+
+	// Move every second object
+	for (size_t i = 0; i < transforms.size(); i += 2)
+		transforms[i] = glm::translate(transforms[i], glm::vec3(0.5f, 1.0f, -0.25f));
+
+	start = std::chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < transforms.size(); i++)
+		scene.setTransform(i, transforms[i]);
+	scene.update();
+	end = std::chrono::high_resolution_clock::now();
+	long long refitTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	std::vector<float> worldVertices;
+	for (const glm::mat4& transform : transforms)
+		addTransformed(worldVertices, objectVertices, transform);
+	KdTree rebuiltTree = KdTree(worldVertices.data(), worldVertices.size() / 3, KdTree::BuildMode::SAH);
+	end = std::chrono::high_resolution_clock::now();
+	long long rebuildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Memory: " << scene.getMemorySize() << " bytes | Single tree: " << rebuiltTree.getMemorySize() << " bytes" << std::endl;
+	std::cout << "Move objects + refit: " << refitTime << " microseconds | Full rebuild: " << rebuildTime << " microseconds | Speedup: "
+		<< (double)rebuildTime / std::max(1ll, refitTime) << std::endl;
+
+	// Same hits up to float precision (the scene transforms the rays instead of the vertices)
+	unsigned int differences = 0;
+	unsigned int hits = 0;
+	KdStructs::RayHit sceneHit, treeHit;
+	for (const KdStructs::Ray& ray : rays)
+	{
+		bool sceneResult = scene.raycast(ray, sceneHit);
+		bool treeResult = rebuiltTree.raycast(ray, treeHit);
+		hits += sceneResult ? 1 : 0;
+		if (sceneResult != treeResult || (sceneResult && std::fabs(sceneHit.distance - treeHit.distance) > 1e-3f * std::max(1.0f, treeHit.distance)))
+			differences++;
+		// Not close to the hit, where precision could decide
+		if (!treeResult || std::fabs(treeHit.distance - 20.0f) > 1e-2f)
+			differences += scene.occluded(ray, 20.0f) != rebuiltTree.occluded(ray, 20.0f) ? 1 : 0;
+
+		// The single tree sees the world space winding, so culling has to skip the same faces of mirrored objects.
+		KdStructs::Ray cullingRay = ray;
+		cullingRay.cullBackfaces = true;
+		sceneResult = scene.raycast(cullingRay, sceneHit);
+		treeResult = rebuiltTree.raycast(cullingRay, treeHit);
+		if (sceneResult != treeResult || (sceneResult && std::fabs(sceneHit.distance - treeHit.distance) > 1e-3f * std::max(1.0f, treeHit.distance)))
+			differences++;
+	}
+
+	// Culling queries return exactly the objects whose bounds pass the test.
+	std::vector<unsigned int> visible;
+	std::vector<unsigned int> expected;
+	for (int i = 0; i < 100; i++)
+	{
+		glm::vec3 eye(std::sin(i * 0.37f) * 30.0f, 3.0f, std::cos(i * 0.53f) * 30.0f);
+		glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 20.0f) * glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0, 1, 0));
+		KdStructs::Frustum frustum = KdStructs::Frustum::fromMatrix(&viewProjection[0][0]);
+		KdStructs::BoundingBox box(KdStructs::Vector(eye.x - 8.0f, -4.0f, eye.z - 8.0f), KdStructs::Vector(eye.x + 8.0f, 4.0f, eye.z + 8.0f));
+
+		expected.clear();
+		for (unsigned int object = 0; object < scene.getObjectCount(); object++)
+			if (frustum.intersects(scene.getBounds(object)))
+				expected.push_back(object);
+		scene.queryFrustum(frustum, visible);
+		differences += visible != expected ? 1 : 0;
+
+		expected.clear();
+		for (unsigned int object = 0; object < scene.getObjectCount(); object++)
+			if (box.overlaps(scene.getBounds(object)))
+				expected.push_back(object);
+		scene.queryAABB(box, visible);
+		differences += visible != expected ? 1 : 0;
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		scene.raycast(ray, sceneHit);
+	end = std::chrono::high_resolution_clock::now();
+	double sceneSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		rebuiltTree.raycast(ray, treeHit);
+	end = std::chrono::high_resolution_clock::now();
+	double treeSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	std::cout << "Scene: " << (unsigned long long)(rays.size() / sceneSeconds) << " rays per second | Single tree: "
+		<< (unsigned long long)(rays.size() / treeSeconds) << " rays per second | Hits: " << hits << std::endl;
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Compares the BVH with the SAH kd-tree: build, queries, and refit after moving the vertices vs. rebuilding.
+/// Returns false if any hit differs.
+/// </summary>
+bool benchmarkBvh(std::vector<float> vertices, const std::vector<KdStructs::Ray>& rays)
+{
+	std::cout << "\n[*] BVH vs. kd-tree (SAH)" << std::endl;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Bvh bvh = Bvh(vertices.data(), vertices.size() / 3);
+	auto end = std::chrono::high_resolution_clock::now();
+	long long bvhBuildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	KdTree kdTree = KdTree(vertices.data(), vertices.size() / 3, KdTree::BuildMode::SAH);
+	end = std::chrono::high_resolution_clock::now();
+	long long kdBuildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Build: BVH " << bvhBuildTime << " microseconds (" << bvh.getMemorySize() << " bytes) | kd-tree " << kdBuildTime
+		<< " microseconds (" << kdTree.getMemorySize() << " bytes)" << std::endl;
+
+	auto countDifferences = [&rays](const RayQueryStructure& structure, const RayQueryStructure& reference) {
+		unsigned int differences = 0;
+		KdStructs::RayHit hit, referenceHit;
+		for (const KdStructs::Ray& ray : rays)
+		{
+			bool result = structure.raycast(ray, hit);
+			bool referenceResult = reference.raycast(ray, referenceHit);
+			if (result != referenceResult || (result && std::fabs(hit.distance - referenceHit.distance) > 1e-4f))
+				differences++;
+			// Not close to the hit, where precision could decide
+			if (!referenceResult || std::fabs(referenceHit.distance - 20.0f) > 1e-2f)
+				differences += structure.occluded(ray, 20.0f) != reference.occluded(ray, 20.0f) ? 1 : 0;
+		}
+		return differences;
+	};
+	unsigned int differences = countDifferences(bvh, kdTree);
+
+	KdStructs::RayHit hit;
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		bvh.raycast(ray, hit);
+	end = std::chrono::high_resolution_clock::now();
+	double bvhSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		kdTree.raycast(ray, hit);
+	end = std::chrono::high_resolution_clock::now();
+	double kdSeconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	std::cout << "Raycast: BVH " << (unsigned long long)(rays.size() / bvhSeconds) << " rays per second | kd-tree "
+		<< (unsigned long long)(rays.size() / kdSeconds) << " rays per second" << std::endl;
+
+	// Animate: every cube (36 vertices) moves differently.
+	for (size_t i = 0; i < vertices.size(); i += 3)
+	{
+		size_t cube = i / (36 * 3);
+		vertices[i] += (cube % 5) * 0.1f;
+		vertices[i + 1] += (cube % 3) * 0.2f;
+	}
+
+	start = std::chrono::high_resolution_clock::now();
+	bvh.refit(vertices.data(), vertices.size() / 3);
+	end = std::chrono::high_resolution_clock::now();
+	long long refitTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	start = std::chrono::high_resolution_clock::now();
+	KdTree movedTree = KdTree(vertices.data(), vertices.size() / 3, KdTree::BuildMode::SAH);
+	end = std::chrono::high_resolution_clock::now();
+	long long rebuildTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Moved vertices: BVH refit " << refitTime << " microseconds | kd-tree rebuild " << rebuildTime << " microseconds" << std::endl;
+
+	differences += countDifferences(bvh, movedTree);
+	std::cout << "Different results: " << differences << std::endl;
+	return differences == 0;
+}
+
+/// <summary>
+/// Without arguments all checks and benchmarks run.
+/// --suite [--json path]: only the ray query suite (see RaySuite.h), optionally writing JSON results.
+/// </summary>
+int main(int argc, char** argv)
+{
+	bool suite = false;
+	std::string jsonPath;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if (argument == "--suite")
+			suite = true;
+		else if (argument == "--json" && i + 1 < argc) {
+			suite = true;
+			jsonPath = argv[++i];
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [--suite] [--json path]" << std::endl;
+			return 1;
+		}
+	}
+	if (suite)
+		return runRaySuite(jsonPath);
+
+	std::vector<float> vertices = createCubeScene(32);
+	std::cout << "[*] Scene: " << vertices.size() / 9 << " triangles" << std::endl;
+
+	std::vector<KdStructs::Ray> rays = createRandomRays(100000, 42);
+
+	unsigned long long allocations = 0;
+	allocations += benchmarkRaycast(vertices, rays, KdTree::BuildMode::MEDIAN);
+	allocations += benchmarkRaycast(vertices, rays, KdTree::BuildMode::SAH);
+
+	KdTree sahTree = KdTree(&vertices[0], vertices.size() / 3, KdTree::BuildMode::SAH);
+	bool identical = benchmarkBatch(sahTree, createPrimaryRays(512, 512), "primary");
+	identical = benchmarkBatch(sahTree, rays, "random") && identical;
+	sahTree.setTriangleTest(KdStructs::TriangleTest::WATERTIGHT);
+	identical = benchmarkBatch(sahTree, rays, "random, watertight") && identical;
+	sahTree.setTriangleTest(KdStructs::TriangleTest::MOLLER_TRUMBORE);
+	identical = benchmarkParallelBatch(sahTree, createPrimaryRays(1024, 1024)) && identical;
+	identical = benchmarkOcclusion(sahTree, 100000) && identical;
+	identical = benchmarkTriangleKernels() && identical;
+	identical = benchmarkTriangleTests() && identical;
+	identical = benchmarkPointQueries(sahTree, 2000) && identical;
+	identical = benchmarkPointQueries(KdTree(&vertices[0], vertices.size() / 3, KdTree::BuildMode::MEDIAN), 2000) && identical;
+	identical = benchmarkRegionQueries(sahTree, 500) && identical;
+	identical = benchmarkRegionQueries(KdTree(&vertices[0], vertices.size() / 3, KdTree::BuildMode::MEDIAN), 100) && identical;
+	identical = benchmarkSaveLoad(vertices, rays, KdTree::BuildMode::MEDIAN) && identical;
+	identical = benchmarkSaveLoad(vertices, rays, KdTree::BuildMode::SAH) && identical;
+	identical = benchmarkDynamicScene(rays) && identical;
+	identical = benchmarkBvh(vertices, rays) && identical;
+
+	// Bigger scene, so there is enough work to split up.
+	std::vector<float> buildVertices = createCubeScene(64);
+	std::cout << "\n[*] Build scene: " << buildVertices.size() / 9 << " triangles" << std::endl;
+	identical = benchmarkParallelBuild(buildVertices, KdTree::BuildMode::MEDIAN) && identical;
+	identical = benchmarkParallelBuild(buildVertices, KdTree::BuildMode::SAH) && identical;
+
+	benchmarkConstructionScaling();
+
+	return allocations == 0 && identical ? 0 : 1;
+}
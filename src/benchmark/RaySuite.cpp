@@ -0,0 +1,312 @@
+#include "RaySuite.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "Scenes.h"
+#include "../intersection/Bvh.h"
+#include "../intersection/KdTree.h"
+#include "../intersection/TriangleIntersection.h"
+
+// Rays per set are about CAMERA_RESOLUTION^2.
+constexpr int CAMERA_RESOLUTION = 256;
+// Every ray set is timed this often, the fastest run counts.
+constexpr int TIMING_RUNS = 3;
+// Median trees visit most of their nodes for every ray in big scenes, so they only trace the start of each set.
+constexpr size_t MEDIAN_RAY_LIMIT = 256;
+
+struct RaySetResult
+{
+	std::string name;
+	size_t rays = 0;
+	unsigned int hits = 0;
+	double raysPerSecond = 0;
+	double nodesPerRay = 0;
+	unsigned long long nodesPerRay95 = 0;
+	double farChildSkipsPerRay = 0;
+	double trianglesPerRay = 0;
+};
+
+struct StructureResult
+{
+	std::string name;
+	double buildMilliseconds = 0;
+	// Negative if the structure cannot be refit (has to be rebuilt)
+	double refitMilliseconds = -1;
+	size_t memoryBytes = 0;
+	size_t nodeCount = 0;
+	std::vector<RaySetResult> raySets;
+};
+
+struct SceneResult
+{
+	std::string name;
+	unsigned int triangleCount = 0;
+	std::vector<StructureResult> structures;
+};
+
+struct RaySet
+{
+	std::string name;
+	std::vector<KdStructs::Ray> rays;
+};
+
+static KdStructs::Vector normalize(const KdStructs::Vector& vector)
+{
+	return vector * (1.0f / std::sqrt(vector.dot(vector)));
+}
+
+static KdStructs::BoundingBox getBounds(const std::vector<float>& vertices)
+{
+	KdStructs::BoundingBox bounds;
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+		bounds.extend(KdStructs::Vector(vertices[i], vertices[i + 1], vertices[i + 2]));
+	return bounds;
+}
+
+/// <summary>
+/// Pinhole camera in front of and above the scene looking at its center (45 degree field of view).
+/// </summary>
+static std::vector<KdStructs::Ray> createCameraRays(const KdStructs::BoundingBox& bounds, int resolution)
+{
+	KdStructs::Vector center = (bounds.min + bounds.max) * 0.5f;
+	KdStructs::Vector size = bounds.max - bounds.min;
+	float extent = std::max(size[0], std::max(size[1], size[2]));
+
+	KdStructs::Vector origin = center + KdStructs::Vector(0.1f, 0.6f, 1.2f) * extent;
+	KdStructs::Vector forward = normalize(center - origin);
+	KdStructs::Vector right = normalize(forward.cross(KdStructs::Vector(0.0f, 1.0f, 0.0f)));
+	KdStructs::Vector up = right.cross(forward);
+	float scale = std::tan(0.5f * 45.0f * 3.14159265f / 180.0f);
+
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(resolution * resolution);
+	for (int y = 0; y < resolution; y++)
+		for (int x = 0; x < resolution; x++)
+		{
+			float u = ((x + 0.5f) / resolution * 2.0f - 1.0f) * scale;
+			float v = ((y + 0.5f) / resolution * 2.0f - 1.0f) * scale;
+			rays.push_back(KdStructs::Ray(origin, normalize(forward + right * u + up * v), extent * 10.0f));
+		}
+	return rays;
+}
+
+/// <summary>
+/// Primary rays plus secondary rays from their hit points: shadow rays towards one light (coherent)
+/// and diffuse bounces in random directions (incoherent). Random rays start anywhere in the scene.
+/// </summary>
+static std::vector<RaySet> createRaySets(const std::vector<float>& vertices, const RayQueryStructure& queryStructure)
+{
+	KdStructs::BoundingBox bounds = getBounds(vertices);
+	KdStructs::Vector center = (bounds.min + bounds.max) * 0.5f;
+	KdStructs::Vector size = bounds.max - bounds.min;
+	float extent = std::max(size[0], std::max(size[1], size[2]));
+	KdStructs::Vector light = center + KdStructs::Vector(-0.5f, 1.5f, 0.3f) * extent;
+
+	std::vector<RaySet> raySets(4);
+	raySets[0].name = "primary";
+	raySets[0].rays = createCameraRays(bounds, CAMERA_RESOLUTION);
+	raySets[1].name = "coherent";
+	raySets[2].name = "incoherent";
+	raySets[3].name = "random";
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	auto randomDirection = [&]() {
+		KdStructs::Vector direction;
+		do
+			direction = KdStructs::Vector(distribution(random), distribution(random), distribution(random));
+		while (direction.dot(direction) > 1.0f || direction.dot(direction) < 0.0001f);
+		return normalize(direction);
+	};
+
+	KdStructs::RayHit hit;
+	for (const KdStructs::Ray& ray : raySets[0].rays)
+	{
+		if (!queryStructure.raycast(ray, hit))
+			continue;
+
+		// Start slightly in front of the surface to not hit the same triangle again.
+		KdStructs::Vector normal = normalize((hit.triangle->b - hit.triangle->a).cross(hit.triangle->c - hit.triangle->a));
+		if (normal.dot(ray.direction) > 0)
+			normal = normal * -1.0f;
+		KdStructs::Vector origin = hit.position + normal * (extent * 1e-5f);
+
+		KdStructs::Vector toLight = light - origin;
+		float lightDistance = std::sqrt(toLight.dot(toLight));
+		raySets[1].rays.push_back(KdStructs::Ray(origin, toLight * (1.0f / lightDistance), lightDistance));
+
+		KdStructs::Vector bounce = randomDirection();
+		if (bounce.dot(normal) < 0)
+			bounce = bounce * -1.0f;
+		raySets[2].rays.push_back(KdStructs::Ray(origin, bounce, extent * 10.0f));
+	}
+
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int i = 0; i < CAMERA_RESOLUTION * CAMERA_RESOLUTION; i++)
+	{
+		KdStructs::Vector origin;
+		for (int axis = 0; axis < 3; axis++)
+			origin[axis] = bounds.min[axis] + unit(random) * size[axis];
+		raySets[3].rays.push_back(KdStructs::Ray(origin, randomDirection(), extent * 10.0f));
+	}
+	return raySets;
+}
+
+static RaySetResult measureRaySet(const RayQueryStructure& queryStructure, const RaySet& raySet, size_t rayLimit)
+{
+	RaySetResult result;
+	result.name = raySet.name;
+	result.rays = std::min(raySet.rays.size(), rayLimit);
+	if (result.rays == 0)
+		return result;
+	const KdStructs::Ray* rays = raySet.rays.data();
+
+	KdStructs::RayHit hit;
+	double bestSeconds = std::numeric_limits<double>::max();
+	for (int run = 0; run < TIMING_RUNS; run++)
+	{
+		unsigned int hits = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < result.rays; i++)
+			hits += queryStructure.raycast(rays[i], hit) ? 1 : 0;
+		auto end = std::chrono::high_resolution_clock::now();
+		bestSeconds = std::min(bestSeconds, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9);
+		result.hits = hits;
+	}
+	result.raysPerSecond = result.rays / std::max(bestSeconds, 1e-9);
+
+	// Counted separately, so the timing is not influenced by the counters.
+	KdStructs::TraversalStats stats;
+	for (size_t i = 0; i < result.rays; i++)
+		queryStructure.raycast(rays[i], hit, stats);
+	result.nodesPerRay = (double)stats.nodesVisited / stats.rays;
+	result.nodesPerRay95 = stats.nodesPerRay.getPercentile(0.95);
+	result.farChildSkipsPerRay = (double)stats.farChildSkips / stats.rays;
+	result.trianglesPerRay = (double)stats.trianglesTested / stats.rays;
+	return result;
+}
+
+static SceneResult measureScene(const std::string& name, std::vector<float> vertices)
+{
+	SceneResult scene;
+	scene.name = name;
+	scene.triangleCount = vertices.size() / 9;
+	std::cout << "\n[*] Scene " << name << " (" << scene.triangleCount << " triangles)" << std::endl;
+
+	const char* structureNames[] = { "kd-sah", "kd-median", "bvh" };
+	std::vector<RaySet> raySets;
+	for (const char* structureName : structureNames)
+	{
+		StructureResult structure;
+		structure.name = structureName;
+		bool isMedian = structure.name == "kd-median";
+
+		auto start = std::chrono::high_resolution_clock::now();
+		std::unique_ptr<RayQueryStructure> queryStructure;
+		if (structure.name == "bvh")
+			queryStructure = std::make_unique<Bvh>(vertices.data(), vertices.size() / 3);
+		else
+			queryStructure = std::make_unique<KdTree>(vertices.data(), vertices.size() / 3, isMedian ? KdTree::BuildMode::MEDIAN : KdTree::BuildMode::SAH);
+		auto end = std::chrono::high_resolution_clock::now();
+		structure.buildMilliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+		structure.memoryBytes = queryStructure->getMemorySize();
+		structure.nodeCount = queryStructure->getNodeCount();
+
+		// Refit to the same vertices, so the rays still hit the same triangles.
+		if (Bvh* bvh = dynamic_cast<Bvh*>(queryStructure.get())) {
+			start = std::chrono::high_resolution_clock::now();
+			bvh->refit(vertices.data(), vertices.size() / 3);
+			end = std::chrono::high_resolution_clock::now();
+			structure.refitMilliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+		}
+
+		// Secondary rays are created from the hits of the first (SAH) tree, so all structures trace the same rays.
+		if (raySets.empty())
+			raySets = createRaySets(vertices, *queryStructure);
+
+		std::cout << structure.name << " | Build: " << structure.buildMilliseconds << " ms | ";
+		if (structure.refitMilliseconds >= 0)
+			std::cout << "Refit: " << structure.refitMilliseconds << " ms | ";
+		std::cout << "Memory: " << structure.memoryBytes << " bytes | Nodes: " << structure.nodeCount << std::endl;
+		for (const RaySet& raySet : raySets)
+		{
+			RaySetResult result = measureRaySet(*queryStructure, raySet, isMedian ? MEDIAN_RAY_LIMIT : raySet.rays.size());
+			std::cout << "  " << std::left << std::setw(11) << result.name << std::right << std::setw(7) << result.rays << " rays | "
+				<< std::setw(7) << result.hits << " hits | " << std::setw(10) << (unsigned long long)result.raysPerSecond << " rays/s | "
+				<< std::fixed << std::setprecision(1) << std::setw(7) << result.nodesPerRay << " nodes/ray | "
+				<< std::setw(7) << result.trianglesPerRay << " triangles/ray" << std::defaultfloat << std::setprecision(6) << std::endl;
+			structure.raySets.push_back(result);
+		}
+		scene.structures.push_back(structure);
+	}
+	return scene;
+}
+
+static std::string toJson(const std::vector<SceneResult>& scenes)
+{
+	std::ostringstream json;
+	json << std::setprecision(10);
+	json << "{\n  \"benchmark\": \"ray_queries\",\n";
+	json << "  \"simd\": \"" << KdStructs::getSimdLevelName(KdStructs::detectSimdLevel()) << "\",\n";
+	json << "  \"scenes\": [";
+	for (size_t s = 0; s < scenes.size(); s++)
+	{
+		const SceneResult& scene = scenes[s];
+		json << (s > 0 ? "," : "") << "\n    {\n      \"name\": \"" << scene.name << "\",\n      \"triangles\": " << scene.triangleCount << ",\n      \"structures\": [";
+		for (size_t t = 0; t < scene.structures.size(); t++)
+		{
+			const StructureResult& structure = scene.structures[t];
+			json << (t > 0 ? "," : "") << "\n        {\n";
+			json << "          \"structure\": \"" << structure.name << "\",\n";
+			json << "          \"buildMs\": " << structure.buildMilliseconds << ",\n";
+			if (structure.refitMilliseconds >= 0)
+				json << "          \"refitMs\": " << structure.refitMilliseconds << ",\n";
+			json << "          \"memoryBytes\": " << structure.memoryBytes << ",\n";
+			json << "          \"nodes\": " << structure.nodeCount << ",\n";
+			json << "          \"raySets\": [";
+			for (size_t r = 0; r < structure.raySets.size(); r++)
+			{
+				const RaySetResult& result = structure.raySets[r];
+				json << (r > 0 ? "," : "") << "\n            { \"name\": \"" << result.name << "\", \"rays\": " << result.rays << ", \"hits\": " << result.hits
+					<< ", \"raysPerSecond\": " << result.raysPerSecond << ", \"nodesPerRay\": " << result.nodesPerRay
+					<< ", \"nodesPerRay95\": " << result.nodesPerRay95 << ", \"farChildSkipsPerRay\": " << result.farChildSkipsPerRay
+					<< ", \"trianglesPerRay\": " << result.trianglesPerRay << " }";
+			}
+			json << "\n          ]\n        }";
+		}
+		json << "\n      ]\n    }";
+	}
+	json << "\n  ]\n}\n";
+	return json.str();
+}
+
+int runRaySuite(const std::string& jsonPath)
+{
+	std::cout << "[*] Ray query suite (" << KdStructs::getSimdLevelName(KdStructs::detectSimdLevel()) << " kernel)" << std::endl;
+
+	std::vector<SceneResult> scenes;
+	scenes.push_back(measureScene("soup", createRandomSoup(100000, 42)));
+	scenes.push_back(measureScene("terrain", createTerrain(224)));
+	scenes.push_back(measureScene("demo", createDemoScene()));
+
+	if (jsonPath.empty())
+		return 0;
+
+	std::ofstream file(jsonPath);
+	file << toJson(scenes);
+	if (!file) {
+		std::cout << "[!] Could not write " << jsonPath << std::endl;
+		return 1;
+	}
+	std::cout << "\n[*] Results written to " << jsonPath << std::endl;
+	return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+/// <summary>
+/// Ray query benchmark suite: builds reproducible scenes (random soup, grid terrain, demo scene) with every
+/// structure (SAH and median kd-tree, BVH) and casts primary, coherent (shadow), incoherent (diffuse bounce)
+/// and random rays at them. Reports build and refit time, memory, node count, rays per second and the
+/// average nodes/triangles per ray.
+/// If a path is given, the results are also written there as JSON for regression tracking.
+/// Returns the process exit code.
+/// </summary>
+int runRaySuite(const std::string& jsonPath);
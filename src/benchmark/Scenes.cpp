@@ -0,0 +1,153 @@
+#include "Scenes.h"
+
+#include <cmath>
+#include <random>
+
+const float CUBE_VERTICES[108] = {
+	 1.0f, -1.0f, -1.0f,  -1.0f, -1.0f, -1.0f,  -1.0f,  1.0f, -1.0f,
+	-1.0f,  1.0f, -1.0f,   1.0f,  1.0f, -1.0f,   1.0f, -1.0f, -1.0f,
+	-1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,   1.0f,  1.0f,  1.0f,
+	 1.0f,  1.0f,  1.0f,  -1.0f,  1.0f,  1.0f,  -1.0f, -1.0f,  1.0f,
+	-1.0f, -1.0f, -1.0f,  -1.0f, -1.0f,  1.0f,  -1.0f,  1.0f,  1.0f,
+	-1.0f,  1.0f,  1.0f,  -1.0f,  1.0f, -1.0f,  -1.0f, -1.0f, -1.0f,
+	 1.0f, -1.0f,  1.0f,   1.0f, -1.0f, -1.0f,   1.0f,  1.0f, -1.0f,
+	 1.0f,  1.0f, -1.0f,   1.0f,  1.0f,  1.0f,   1.0f, -1.0f,  1.0f,
+	-1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   1.0f, -1.0f,  1.0f,
+	 1.0f, -1.0f,  1.0f,  -1.0f, -1.0f,  1.0f,  -1.0f, -1.0f, -1.0f,
+	-1.0f,  1.0f, -1.0f,  -1.0f,  1.0f,  1.0f,   1.0f,  1.0f,  1.0f,
+	 1.0f,  1.0f,  1.0f,   1.0f,  1.0f, -1.0f,  -1.0f,  1.0f, -1.0f,
+};
+
+void addCube(std::vector<float>& vertices, KdStructs::Vector position, float scale)
+{
+	for (int i = 0; i < 108; i++)
+		vertices.push_back(CUBE_VERTICES[i] * scale + position[i % 3]);
+}
+
+std::vector<float> createCubeScene(int cubesPerAxis)
+{
+	std::vector<float> vertices;
+	addCube(vertices, KdStructs::Vector(0.0f, -50.0f, 0.0f), 48.0f);
+	for (int x = 0; x < cubesPerAxis; x++)
+		for (int z = 0; z < cubesPerAxis; z++)
+			addCube(vertices, KdStructs::Vector(x * 3.0f - cubesPerAxis * 1.5f, 0.0f, z * 3.0f - cubesPerAxis * 1.5f), 0.5f);
+	return vertices;
+}
+
+std::vector<float> createTerrain(int quadsPerAxis)
+{
+	auto height = [](int x, int z) { return std::sin(x * 0.1f) * std::cos(z * 0.13f) * 2.0f; };
+
+	std::vector<float> vertices;
+	vertices.reserve((size_t)quadsPerAxis * quadsPerAxis * 18);
+	for (int x = 0; x < quadsPerAxis; x++)
+		for (int z = 0; z < quadsPerAxis; z++)
+		{
+			const int corners[6][2] = { { x, z }, { x + 1, z }, { x, z + 1 }, { x + 1, z }, { x + 1, z + 1 }, { x, z + 1 } };
+			for (const int* corner : corners)
+			{
+				vertices.push_back(corner[0] * 0.5f);
+				vertices.push_back(height(corner[0], corner[1]));
+				vertices.push_back(corner[1] * 0.5f);
+			}
+		}
+	return vertices;
+}
+
+std::vector<KdStructs::Ray> createRandomRays(int count, unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(count);
+	for (int i = 0; i < count; i++)
+	{
+		KdStructs::Vector origin = KdStructs::Vector(distribution(random) * 20.0f, 5.0f + distribution(random) * 5.0f, distribution(random) * 20.0f);
+		KdStructs::Vector direction = KdStructs::Vector(distribution(random), distribution(random), distribution(random));
+		direction = direction * (1.0f / std::sqrt(direction.dot(direction)));
+		rays.push_back(KdStructs::Ray(origin, direction, 1000.0f));
+	}
+	return rays;
+}
+
+std::vector<KdStructs::Ray> createPrimaryRays(int width, int height)
+{
+	KdStructs::Vector origin = KdStructs::Vector(0.0f, 30.0f, 60.0f);
+	KdStructs::Vector forward = KdStructs::Vector(0.0f, -0.5f, -1.0f);
+	forward = forward * (1.0f / std::sqrt(forward.dot(forward)));
+	KdStructs::Vector right = KdStructs::Vector(1.0f, 0.0f, 0.0f);
+	KdStructs::Vector up = right.cross(forward) * -1.0f;
+
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(width * height);
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++)
+		{
+			float u = (x + 0.5f) / width * 2.0f - 1.0f;
+			float v = (y + 0.5f) / height * 2.0f - 1.0f;
+			KdStructs::Vector direction = forward + right * u + up * v;
+			direction = direction * (1.0f / std::sqrt(direction.dot(direction)));
+			rays.push_back(KdStructs::Ray(origin, direction, 1000.0f));
+		}
+	return rays;
+}
+
+void addTransformed(std::vector<float>& worldVertices, const std::vector<float>& vertices, const glm::mat4& transform)
+{
+	for (size_t i = 0; i < vertices.size(); i += 3)
+	{
+		glm::vec4 position = transform * glm::vec4(vertices[i], vertices[i + 1], vertices[i + 2], 1.0f);
+		worldVertices.push_back(position.x);
+		worldVertices.push_back(position.y);
+		worldVertices.push_back(position.z);
+	}
+}
+
+std::vector<float> createRandomSoup(int triangleCount, unsigned int seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+
+	std::vector<float> vertices;
+	vertices.reserve((size_t)triangleCount * 9);
+	for (int i = 0; i < triangleCount; i++)
+	{
+		KdStructs::Vector center = KdStructs::Vector(position(random), position(random), position(random));
+		for (int corner = 0; corner < 3; corner++)
+			for (int axis = 0; axis < 3; axis++)
+				vertices.push_back(center[axis] + offset(random));
+	}
+	return vertices;
+}
+
+std::vector<float> createDemoScene()
+{
+	// Cube(position, euler angles, scale) as added in main.cpp
+	const float CUBES[6][7] = {
+		{ 0.0f, -3.5f, 0.0f, 0.0f, 15.0f, 0.5f, 15.0f },
+		{ -3.0f, -1.5f, -5.0f, 0.0f, 0.5f, 0.5f, 0.5f },
+		{ -11.0f, -2.5f, -5.0f, 45.0f, 0.5f, 0.5f, 0.5f },
+		{ -8.0f, -1.5f, -7.0f, 0.0f, 1.0f, 1.0f, 1.0f },
+		{ -10.0f, 5.0f, -1.0f, 0.0f, 1.0f, 1.0f, 1.0f },
+		{ 7.0f, -1.0f, -6.0f, 0.0f, 2.0f, 2.0f, 2.0f },
+	};
+	const float PLANE_VERTICES[18] = {
+		-1.0f,  1.0f, 0.0f,  -1.0f, -1.0f, 0.0f,   1.0f, -1.0f, 0.0f,
+		-1.0f,  1.0f, 0.0f,   1.0f, -1.0f, 0.0f,   1.0f,  1.0f, 0.0f,
+	};
+
+	std::vector<float> vertices;
+	std::vector<float> cube(CUBE_VERTICES, CUBE_VERTICES + 108);
+	for (const float* parameters : CUBES)
+	{
+		// Same order as Object: translate, rotate (only around y here), scale
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(parameters[0], parameters[1], parameters[2]));
+		transform = glm::rotate(transform, glm::radians(parameters[3]), glm::vec3(0.0f, 1.0f, 0.0f));
+		transform = glm::scale(transform, glm::vec3(parameters[4], parameters[5], parameters[6]));
+		addTransformed(vertices, cube, transform);
+	}
+	vertices.insert(vertices.end(), PLANE_VERTICES, PLANE_VERTICES + 18);
+	return vertices;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../intersection/Structures.h"
+
+/// Reproducible scenes (non-indexed vertices) and ray sets for the benchmarks.
+
+// Same geometry as Cube, 12 triangles non-indexed.
+extern const float CUBE_VERTICES[108];
+
+/// <summary>
+/// Adds a scaled and translated cube to the vertex list.
+/// </summary>
+void addCube(std::vector<float>& vertices, KdStructs::Vector position, float scale);
+
+/// <summary>
+/// Object-space vertices transformed into world space (like Object::GetVerticesInWorldSpace).
+/// </summary>
+void addTransformed(std::vector<float>& worldVertices, const std::vector<float>& vertices, const glm::mat4& transform);
+
+/// <summary>
+/// Grid of cubes on top of a big ground cube.
+/// </summary>
+std::vector<float> createCubeScene(int cubesPerAxis);
+
+/// <summary>
+/// Non-indexed height field with quadsPerAxis^2 * 2 triangles, every inner vertex is shared by 6 triangles.
+/// </summary>
+std::vector<float> createTerrain(int quadsPerAxis);
+
+/// <summary>
+/// Small triangles scattered randomly in a 100^3 box.
+/// </summary>
+std::vector<float> createRandomSoup(int triangleCount, unsigned int seed);
+
+/// <summary>
+/// The objects added to the world in main.cpp (cubes and plane) in world space.
+/// </summary>
+std::vector<float> createDemoScene();
+
+std::vector<KdStructs::Ray> createRandomRays(int count, unsigned int seed);
+
+/// <summary>
+/// Coherent camera rays (width x height pixels) looking down onto the cube grid.
+/// </summary>
+std::vector<KdStructs::Ray> createPrimaryRays(int width, int height);
@@ -0,0 +1,487 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <numeric>
+
+#include <xmmintrin.h>
+
+// Bins per axis of the binned surface area heuristic.
+constexpr int BVH_BINS = 16;
+// Leaves hold one triangle block.
+constexpr unsigned int MAX_LEAF_TRIANGLES = KdStructs::TriangleBlock::LANES;
+// Deeper nodes are split at the median, so degenerate scenes cannot make the hierarchy arbitrarily deep.
+constexpr int MAX_SAH_DEPTH = 32;
+// Median splits at least halve the biggest child, so there are at most 32 more levels.
+// Every visited node replaces its stack entry with up to 4 children.
+constexpr int BVH_STACK_SIZE = 3 * (MAX_SAH_DEPTH + 32) + 1;
+
+Bvh::Bvh(const float* vertices, unsigned int vertexCount)
+{
+	simdLevel = KdStructs::detectSimdLevel();
+	intersectBlocks = KdStructs::getBlockIntersector(simdLevel);
+	occludedBlocks = KdStructs::getBlockOccluder(simdLevel);
+
+	setTriangles(vertices, vertexCount);
+	if (triangles.empty())
+		return;
+
+	triangleBounds.reserve(triangles.size());
+	centers.reserve(triangles.size());
+	for (const KdStructs::Triangle& triangle : triangles)
+	{
+		triangleBounds.push_back(KdStructs::BoundingBox(triangle));
+		centers.push_back((triangleBounds.back().min + triangleBounds.back().max) * 0.5f);
+	}
+	triangleOrder.resize(triangles.size());
+	std::iota(triangleOrder.begin(), triangleOrder.end(), 0);
+
+	createNode(Range{ 0, triangles.size(), bounds }, 0);
+
+	triangleBounds.clear();
+	triangleBounds.shrink_to_fit();
+	centers.clear();
+	centers.shrink_to_fit();
+}
+
+bool Bvh::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const
+{
+	KdStructs::NoTraversalStats stats;
+	return findClosestHit(ray, hit, stats);
+}
+
+bool Bvh::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, KdStructs::TraversalStats& stats) const
+{
+	stats.beginRay();
+	bool hasHit = findClosestHit(ray, hit, stats);
+	stats.endRay();
+	return hasHit;
+}
+
+bool Bvh::occluded(const KdStructs::Ray& ray, float maxDistance) const
+{
+	KdStructs::NoTraversalStats stats;
+	return findAnyHit(ray, maxDistance, stats);
+}
+
+bool Bvh::occluded(const KdStructs::Ray& ray, float maxDistance, KdStructs::TraversalStats& stats) const
+{
+	stats.beginRay();
+	bool isOccluded = findAnyHit(ray, maxDistance, stats);
+	stats.endRay();
+	return isOccluded;
+}
+
+void Bvh::setTriangleTest(KdStructs::TriangleTest test)
+{
+	intersectBlocks = KdStructs::getBlockIntersector(simdLevel, test);
+	occludedBlocks = KdStructs::getBlockOccluder(simdLevel, test);
+}
+
+void Bvh::refit(const float* vertices, unsigned int vertexCount)
+{
+	if (vertexCount / 3 != triangles.size()) {
+		std::cout << "[!] Cannot refit BVH: " << vertexCount / 3 << " triangles instead of " << triangles.size() << std::endl;
+		return;
+	}
+
+	setTriangles(vertices, vertexCount);
+	triangleBlocks.clear();
+	for (const Leaf& leaf : leaves)
+		KdStructs::appendTriangleBlocks(triangles, &triangleOrder[leaf.firstTriangle], leaf.triangleCount, triangleBlocks);
+
+	// Children come after their parent, so they are done first.
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		for (int lane = 0; lane < WIDTH; lane++)
+		{
+			unsigned int child = node.children[lane];
+			if (child == EMPTY_CHILD)
+				continue;
+
+			KdStructs::BoundingBox childBounds;
+			if (child & LEAF_FLAG) {
+				const Leaf& leaf = leaves[child & ~LEAF_FLAG];
+				for (unsigned int j = leaf.firstTriangle; j < leaf.firstTriangle + leaf.triangleCount; j++)
+					childBounds.extend(KdStructs::BoundingBox(triangles[triangleOrder[j]]));
+			}
+			else {
+				const Node& childNode = nodes[child];
+				for (int childLane = 0; childLane < WIDTH; childLane++)
+				{
+					if (childNode.children[childLane] == EMPTY_CHILD)
+						continue;
+					childBounds.extend(KdStructs::Vector(childNode.min[0][childLane], childNode.min[1][childLane], childNode.min[2][childLane]));
+					childBounds.extend(KdStructs::Vector(childNode.max[0][childLane], childNode.max[1][childLane], childNode.max[2][childLane]));
+				}
+			}
+			setChildBounds(node, lane, childBounds);
+		}
+	}
+}
+
+const KdStructs::BoundingBox& Bvh::getBounds() const
+{
+	return bounds;
+}
+
+unsigned int Bvh::getTriangleCount() const
+{
+	return triangles.size();
+}
+
+const KdStructs::Triangle& Bvh::getTriangle(unsigned int triangle) const
+{
+	return triangles[triangle];
+}
+
+size_t Bvh::getNodeCount() const
+{
+	return nodes.size();
+}
+
+size_t Bvh::getMemorySize() const
+{
+	return nodes.size() * sizeof(Node) + leaves.size() * sizeof(Leaf) + triangleBlocks.size() * sizeof(KdStructs::TriangleBlock)
+		+ triangles.size() * sizeof(KdStructs::Triangle) + triangleOrder.size() * sizeof(unsigned int);
+}
+
+void Bvh::printStatistics() const
+{
+	std::cout << "Structure: BVH (" << WIDTH << " children per node)" << std::endl;
+	std::cout << "Number of triangles: " << triangles.size() << std::endl;
+	std::cout << "Max Depth: " << depth << std::endl;
+	std::cout << "Nodes: " << nodes.size() << std::endl;
+	std::cout << "Leaves: " << leaves.size() << std::endl;
+	if (!leaves.empty())
+		std::cout << "Triangles per leaf: " << (float)triangles.size() / leaves.size() << std::endl;
+	std::cout << "Memory: " << getMemorySize() << " bytes" << std::endl;
+}
+
+void Bvh::setTriangles(const float* vertices, unsigned int vertexCount)
+{
+	triangles.clear();
+	bounds = KdStructs::BoundingBox();
+	for (unsigned int i = 0; i + 2 < vertexCount; i += 3)
+	{
+		const float* corner = vertices + i * 3;
+		triangles.push_back(KdStructs::Triangle(
+			KdStructs::Vector(corner[0], corner[1], corner[2]),
+			KdStructs::Vector(corner[3], corner[4], corner[5]),
+			KdStructs::Vector(corner[6], corner[7], corner[8])));
+		bounds.extend(KdStructs::BoundingBox(triangles.back()));
+	}
+}
+
+/// <summary>
+/// Splits the range into up to 4 children, always splitting the child with the biggest surface area,
+/// and creates leaves for children with up to 4 triangles. Returns the index of the created node.
+/// </summary>
+unsigned int Bvh::createNode(const Range& range, int nodeDepth)
+{
+	depth = std::max(depth, nodeDepth + 1);
+	unsigned int nodeIndex = nodes.size();
+	nodes.push_back(Node());
+
+	Range children[WIDTH];
+	int childCount = 1;
+	children[0] = range;
+	while (childCount < WIDTH)
+	{
+		int largest = -1;
+		for (int i = 0; i < childCount; i++)
+			if (children[i].end - children[i].begin > MAX_LEAF_TRIANGLES && (largest < 0 || children[i].bounds.surfaceArea() > children[largest].bounds.surfaceArea()))
+				largest = i;
+		if (largest < 0)
+			break;
+
+		Range split = children[largest];
+		size_t middle = splitRange(split, nodeDepth);
+		children[largest] = Range{ split.begin, middle, getRangeBounds(split.begin, middle) };
+		children[childCount++] = Range{ middle, split.end, getRangeBounds(middle, split.end) };
+	}
+
+	for (int lane = 0; lane < WIDTH; lane++)
+	{
+		unsigned int child = EMPTY_CHILD;
+		KdStructs::BoundingBox childBounds;
+		if (lane < childCount) {
+			const Range& childRange = children[lane];
+			unsigned int triangleCount = childRange.end - childRange.begin;
+			if (triangleCount <= MAX_LEAF_TRIANGLES) {
+				child = LEAF_FLAG | (unsigned int)leaves.size();
+				leaves.push_back(Leaf{ (unsigned int)childRange.begin, triangleCount });
+				KdStructs::appendTriangleBlocks(triangles, &triangleOrder[childRange.begin], triangleCount, triangleBlocks);
+			}
+			else
+				child = createNode(childRange, nodeDepth + 1);
+			childBounds = childRange.bounds;
+		}
+
+		// Nodes might have been added, no references across the recursion.
+		nodes[nodeIndex].children[lane] = child;
+		setChildBounds(nodes[nodeIndex], lane, childBounds);
+	}
+	return nodeIndex;
+}
+
+/// <summary>
+/// Sorts the triangles of the range into two parts at the cheapest bin border (binned SAH over the triangle centers)
+/// and returns where the second part starts. Falls back to the median of the widest axis.
+/// </summary>
+size_t Bvh::splitRange(const Range& range, int nodeDepth)
+{
+	KdStructs::BoundingBox centerBounds;
+	for (size_t i = range.begin; i < range.end; i++)
+		centerBounds.extend(centers[triangleOrder[i]]);
+
+	int bestAxis = -1;
+	int bestBin = 0;
+	float bestCost = std::numeric_limits<float>::max();
+	for (int axis = 0; axis < 3 && nodeDepth < MAX_SAH_DEPTH; axis++)
+	{
+		float extent = centerBounds.max[axis] - centerBounds.min[axis];
+		if (extent <= 0)
+			continue;
+
+		struct Bin
+		{
+			KdStructs::BoundingBox bounds;
+			unsigned int count = 0;
+		};
+		Bin bins[BVH_BINS];
+		float scale = BVH_BINS / extent;
+		for (size_t i = range.begin; i < range.end; i++)
+		{
+			unsigned int triangle = triangleOrder[i];
+			int bin = std::min(BVH_BINS - 1, (int)((centers[triangle][axis] - centerBounds.min[axis]) * scale));
+			bins[bin].count++;
+			bins[bin].bounds.extend(triangleBounds[triangle]);
+		}
+
+		// Costs of the right parts starting at each bin
+		float rightAreas[BVH_BINS];
+		unsigned int rightCounts[BVH_BINS];
+		KdStructs::BoundingBox rightBounds;
+		unsigned int rightCount = 0;
+		for (int bin = BVH_BINS - 1; bin > 0; bin--)
+		{
+			if (bins[bin].count > 0)
+				rightBounds.extend(bins[bin].bounds);
+			rightCount += bins[bin].count;
+			rightAreas[bin] = rightBounds.surfaceArea();
+			rightCounts[bin] = rightCount;
+		}
+
+		KdStructs::BoundingBox leftBounds;
+		unsigned int leftCount = 0;
+		for (int bin = 0; bin < BVH_BINS - 1; bin++)
+		{
+			if (bins[bin].count > 0)
+				leftBounds.extend(bins[bin].bounds);
+			leftCount += bins[bin].count;
+			if (leftCount == 0 || rightCounts[bin + 1] == 0)
+				continue;
+
+			float cost = leftCount * leftBounds.surfaceArea() + rightCounts[bin + 1] * rightAreas[bin + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = bin;
+			}
+		}
+	}
+
+	if (bestAxis >= 0) {
+		float scale = BVH_BINS / (centerBounds.max[bestAxis] - centerBounds.min[bestAxis]);
+		auto middle = std::partition(triangleOrder.begin() + range.begin, triangleOrder.begin() + range.end, [&](unsigned int triangle) {
+			return std::min(BVH_BINS - 1, (int)((centers[triangle][bestAxis] - centerBounds.min[bestAxis]) * scale)) <= bestBin;
+		});
+		return middle - triangleOrder.begin();
+	}
+
+	// All centers in one point or too deep: median of the widest axis.
+	int axis = 0;
+	for (int currentAxis = 1; currentAxis < 3; currentAxis++)
+		if (centerBounds.max[currentAxis] - centerBounds.min[currentAxis] > centerBounds.max[axis] - centerBounds.min[axis])
+			axis = currentAxis;
+
+	size_t median = range.begin + (range.end - range.begin) / 2;
+	std::nth_element(triangleOrder.begin() + range.begin, triangleOrder.begin() + median, triangleOrder.begin() + range.end, [&](unsigned int a, unsigned int b) {
+		return centers[a][axis] < centers[b][axis];
+	});
+	return median;
+}
+
+KdStructs::BoundingBox Bvh::getRangeBounds(size_t begin, size_t end) const
+{
+	KdStructs::BoundingBox rangeBounds;
+	for (size_t i = begin; i < end; i++)
+		rangeBounds.extend(triangleBounds[triangleOrder[i]]);
+	return rangeBounds;
+}
+
+void Bvh::setChildBounds(Node& node, int lane, const KdStructs::BoundingBox& childBounds)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		node.min[axis][lane] = childBounds.min[axis];
+		node.max[axis][lane] = childBounds.max[axis];
+	}
+}
+
+/// <summary>
+/// Tests the ray against the 4 child boxes of a node at once and visits the hit children closest first.
+/// Children starting behind the closest hit found so far are skipped when they are popped.
+/// </summary>
+template <typename Stats>
+bool Bvh::findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, Stats& stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	// The near plane of each slab depends on the direction's sign. This also makes inverted (empty) boxes miss.
+	__m128 origin[3];
+	__m128 inverseDirection[3];
+	bool negative[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		origin[axis] = _mm_set1_ps(ray.origin[axis]);
+		inverseDirection[axis] = _mm_set1_ps(1.0f / ray.direction[axis]);
+		negative[axis] = std::signbit(ray.direction[axis]);
+	}
+
+	struct StackEntry
+	{
+		unsigned int child;
+		float tNear;
+	};
+	StackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = StackEntry{ 0, 0.0f };
+
+	float closestDistance = ray.distance;
+	const KdStructs::Triangle* closestTriangle = nullptr;
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		if (entry.tNear > closestDistance) {
+			stats.skipFarChild();
+			continue;
+		}
+		stats.visitNode();
+
+		if (entry.child & LEAF_FLAG) {
+			unsigned int leaf = entry.child & ~LEAF_FLAG;
+			stats.testTriangles(leaves[leaf].triangleCount);
+			unsigned int triangle = intersectBlocks(&triangleBlocks[leaf], 1, ray, closestDistance);
+			if (triangle != KdStructs::NO_TRIANGLE)
+				closestTriangle = &triangles[triangle];
+			continue;
+		}
+
+		// Slab test of all children. NaNs (origin on a plane parallel to the ray) are ignored by min/max, as the second operand is returned.
+		const Node& node = nodes[entry.child];
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = _mm_set1_ps(closestDistance);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m128 nearPlane = _mm_load_ps(negative[axis] ? node.max[axis] : node.min[axis]);
+			__m128 farPlane = _mm_load_ps(negative[axis] ? node.min[axis] : node.max[axis]);
+			tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, origin[axis]), inverseDirection[axis]), tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, origin[axis]), inverseDirection[axis]), tFar);
+		}
+		int hitMask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+		if (hitMask == 0)
+			continue;
+
+		alignas(16) float distances[WIDTH];
+		_mm_store_ps(distances, tNear);
+
+		// Sorted far to near, so the closest child is on top of the stack.
+		StackEntry hitChildren[WIDTH];
+		int hitCount = 0;
+		for (int lane = 0; lane < WIDTH; lane++)
+		{
+			if (!(hitMask & (1 << lane)))
+				continue;
+			int position = hitCount++;
+			while (position > 0 && hitChildren[position - 1].tNear < distances[lane])
+			{
+				hitChildren[position] = hitChildren[position - 1];
+				position--;
+			}
+			hitChildren[position] = StackEntry{ node.children[lane], distances[lane] };
+		}
+		assert(stackSize + hitCount <= BVH_STACK_SIZE);
+		for (int i = 0; i < hitCount; i++)
+			stack[stackSize++] = hitChildren[i];
+	}
+
+	if (closestTriangle == nullptr)
+		return false;
+
+	hit = KdStructs::RayHit(closestTriangle, ray.origin + ray.direction * closestDistance, closestDistance);
+	return true;
+}
+
+/// <summary>
+/// Same traversal as findClosestHit in any order, returns at the first triangle closer than maxDistance.
+/// </summary>
+template <typename Stats>
+bool Bvh::findAnyHit(const KdStructs::Ray& ray, float maxDistance, Stats& stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	__m128 origin[3];
+	__m128 inverseDirection[3];
+	bool negative[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		origin[axis] = _mm_set1_ps(ray.origin[axis]);
+		inverseDirection[axis] = _mm_set1_ps(1.0f / ray.direction[axis]);
+		negative[axis] = std::signbit(ray.direction[axis]);
+	}
+	__m128 farLimit = _mm_set1_ps(maxDistance);
+
+	unsigned int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		unsigned int child = stack[--stackSize];
+		stats.visitNode();
+
+		if (child & LEAF_FLAG) {
+			unsigned int leaf = child & ~LEAF_FLAG;
+			stats.testTriangles(leaves[leaf].triangleCount);
+			if (occludedBlocks(&triangleBlocks[leaf], 1, ray, maxDistance)) {
+				stats.terminateEarly();
+				return true;
+			}
+			continue;
+		}
+
+		const Node& node = nodes[child];
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = farLimit;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			__m128 nearPlane = _mm_load_ps(negative[axis] ? node.max[axis] : node.min[axis]);
+			__m128 farPlane = _mm_load_ps(negative[axis] ? node.min[axis] : node.max[axis]);
+			tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, origin[axis]), inverseDirection[axis]), tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, origin[axis]), inverseDirection[axis]), tFar);
+		}
+		int hitMask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+		assert(stackSize + WIDTH <= BVH_STACK_SIZE);
+		for (int lane = 0; lane < WIDTH; lane++)
+			if (hitMask & (1 << lane))
+				stack[stackSize++] = node.children[lane];
+	}
+	return false;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+
+#include "RayQueryStructure.h"
+#include "Structures.h"
+#include "TriangleIntersection.h"
+
+/// <summary>
+/// Bounding volume hierarchy with 4 children per node (QBVH), built with the binned surface area heuristic.
+/// The boxes of all children are tested at once with SSE, every leaf holds up to 4 triangles in one SIMD block.
+/// Unlike the kd-tree, the hierarchy stays valid when the vertices move: refit only recomputes the boxes.
+/// </summary>
+class Bvh final : public RayQueryStructure
+{
+public:
+	/// <summary>
+	/// Builds the hierarchy over non-indexed vertices (3 per triangle).
+	/// </summary>
+	Bvh(const float* vertices, unsigned int vertexCount);
+
+	// Hits point into the triangle list, copies would point into the original.
+	Bvh(const Bvh&) = delete;
+	Bvh& operator=(const Bvh&) = delete;
+
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const override;
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, KdStructs::TraversalStats& stats) const override;
+	bool occluded(const KdStructs::Ray& ray, float maxDistance) const override;
+	bool occluded(const KdStructs::Ray& ray, float maxDistance, KdStructs::TraversalStats& stats) const override;
+	void setTriangleTest(KdStructs::TriangleTest test) override;
+
+	/// <summary>
+	/// Updates the triangles to the moved vertices (same count and order as built with) and recomputes
+	/// the boxes bottom-up. The hierarchy itself is kept, so it gets looser the further the vertices move.
+	/// </summary>
+	void refit(const float* vertices, unsigned int vertexCount);
+
+	const KdStructs::BoundingBox& getBounds() const override;
+	unsigned int getTriangleCount() const override;
+	const KdStructs::Triangle& getTriangle(unsigned int triangle) const override;
+	size_t getNodeCount() const override;
+	size_t getMemorySize() const override;
+	void printStatistics() const override;
+
+private:
+	static constexpr int WIDTH = 4;
+	// Child index flag for leaves, the rest of the index is the leaf (and block) index.
+	static constexpr unsigned int LEAF_FLAG = 0x80000000u;
+	static constexpr unsigned int EMPTY_CHILD = 0xFFFFFFFFu;
+
+	/// <summary>
+	/// Boxes of the children in structure of arrays layout (one SSE lane per child).
+	/// Empty lanes have an inverted box (min > max) that no ray can hit.
+	/// Children are always stored after their parent.
+	/// </summary>
+	struct alignas(16) Node
+	{
+		float min[3][WIDTH];
+		float max[3][WIDTH];
+		// Node index, LEAF_FLAG | leaf index or EMPTY_CHILD
+		unsigned int children[WIDTH];
+	};
+
+	// Range of triangleOrder, the leaf's block has the same index.
+	struct Leaf
+	{
+		unsigned int firstTriangle;
+		unsigned int triangleCount;
+	};
+
+	struct Range
+	{
+		size_t begin;
+		size_t end;
+		KdStructs::BoundingBox bounds;
+	};
+
+	void setTriangles(const float* vertices, unsigned int vertexCount);
+	unsigned int createNode(const Range& range, int depth);
+	size_t splitRange(const Range& range, int depth);
+	KdStructs::BoundingBox getRangeBounds(size_t begin, size_t end) const;
+	void setChildBounds(Node& node, int lane, const KdStructs::BoundingBox& childBounds);
+
+	template <typename Stats>
+	bool findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, Stats& stats) const;
+	template <typename Stats>
+	bool findAnyHit(const KdStructs::Ray& ray, float maxDistance, Stats& stats) const;
+
+	std::vector<Node> nodes;
+	std::vector<Leaf> leaves;
+	std::vector<KdStructs::TriangleBlock> triangleBlocks;
+	std::vector<KdStructs::Triangle> triangles;
+	// Triangle indices sorted by leaf
+	std::vector<unsigned int> triangleOrder;
+	// Only needed while building
+	std::vector<KdStructs::BoundingBox> triangleBounds;
+	std::vector<KdStructs::Vector> centers;
+	KdStructs::BoundingBox bounds;
+	int depth = 0;
+
+	KdStructs::SimdLevel simdLevel = KdStructs::SimdLevel::SCALAR;
+	KdStructs::BlockIntersector intersectBlocks = nullptr;
+	KdStructs::BlockOccluder occludedBlocks = nullptr;
+};
@@ -0,0 +1,435 @@
+#include "KdScene.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+// Median splits halve the objects, so unsigned int object ids need at most 32 levels.
+constexpr int MAX_TOP_DEPTH = 32;
+// Visiting a node replaces its entry with its two children, so the stack grows by at most one per level.
+constexpr int TOP_STACK_SIZE = 64;
+static_assert(MAX_TOP_DEPTH + 1 <= TOP_STACK_SIZE, "top level stack is smaller than the deepest top level");
+
+unsigned int KdScene::addMesh(float* vertices, unsigned int vertexCount, RayQueryStructure::Type type, ThreadPool* threadPool)
+{
+	uint64_t hash = KdTree::hashScene(vertices, vertexCount, KdTree::BuildMode::SAH) ^ ((uint64_t)type * 0x9E3779B97F4A7C15ull);
+	// The hash only selects candidates, a collision must not silently share different geometry
+	auto candidates = meshesByHash.equal_range(hash);
+	for (auto candidate = candidates.first; candidate != candidates.second; ++candidate)
+		if (hasTriangles(*meshes[candidate->second], vertices, vertexCount))
+			return candidate->second;
+
+	meshes.push_back(RayQueryStructure::create(type, vertices, vertexCount, threadPool));
+	meshes.back()->setTriangleTest(triangleTest);
+	meshesByHash.emplace(hash, (unsigned int)meshes.size() - 1);
+	return meshes.size() - 1;
+}
+
+unsigned int KdScene::addObject(float* vertices, unsigned int vertexCount, const glm::mat4& transform, RayQueryStructure::Type type, ThreadPool* threadPool)
+{
+	return addInstance(addMesh(vertices, vertexCount, type, threadPool), transform);
+}
+
+void KdScene::setTriangleTest(KdStructs::TriangleTest test)
+{
+	triangleTest = test;
+	for (std::unique_ptr<RayQueryStructure>& mesh : meshes)
+		mesh->setTriangleTest(test);
+}
+
+unsigned int KdScene::addInstance(unsigned int mesh, const glm::mat4& transform)
+{
+	Instance instance;
+	instance.mesh = mesh;
+	instance.structure = meshes[mesh].get();
+	instance.transform = transform;
+	instance.inverseTransform = glm::inverse(transform);
+	instance.mirrored = glm::determinant(glm::mat3(transform)) < 0;
+	updateWorldBounds(instance);
+	instances.push_back(std::move(instance));
+
+	needsRebuild = true;
+	return instances.size() - 1;
+}
+
+void KdScene::setTransform(unsigned int object, const glm::mat4& transform)
+{
+	Instance& instance = instances[object];
+	if (instance.transform == transform)
+		return;
+
+	instance.transform = transform;
+	instance.inverseTransform = glm::inverse(transform);
+	instance.mirrored = glm::determinant(glm::mat3(transform)) < 0;
+	updateWorldBounds(instance);
+	needsRefit = true;
+}
+
+const glm::mat4& KdScene::getTransform(unsigned int object) const
+{
+	return instances[object].transform;
+}
+
+unsigned int KdScene::getObjectCount() const
+{
+	return instances.size();
+}
+
+unsigned int KdScene::getMeshCount() const
+{
+	return meshes.size();
+}
+
+unsigned int KdScene::getMesh(unsigned int object) const
+{
+	return instances[object].mesh;
+}
+
+size_t KdScene::getMemorySize() const
+{
+	size_t size = topNodes.size() * sizeof(TopNode) + objectOrder.size() * sizeof(unsigned int) + instances.size() * sizeof(Instance);
+	for (const std::unique_ptr<RayQueryStructure>& mesh : meshes)
+		size += mesh->getMemorySize();
+	return size;
+}
+
+const KdStructs::BoundingBox& KdScene::getBounds(unsigned int object) const
+{
+	return instances[object].worldBounds;
+}
+
+void KdScene::update()
+{
+	if (needsRebuild)
+		rebuild();
+	else if (needsRefit)
+		refit();
+
+	needsRebuild = false;
+	needsRefit = false;
+}
+
+bool KdScene::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const
+{
+	unsigned int object;
+	return raycast(ray, hit, object);
+}
+
+bool KdScene::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object) const
+{
+	return findClosestHit(ray, hit, object, nullptr);
+}
+
+bool KdScene::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object, KdStructs::TraversalStats& stats) const
+{
+	return findClosestHit(ray, hit, object, &stats);
+}
+
+bool KdScene::findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object, KdStructs::TraversalStats* stats) const
+{
+	if (topNodes.empty())
+		return false;
+
+	struct StackEntry
+	{
+		unsigned int node;
+		float tNear;
+	};
+	StackEntry stack[TOP_STACK_SIZE];
+	int stackSize = 0;
+
+	float closestDistance = ray.distance;
+	bool found = false;
+
+	float tNear, tFar;
+	if (topNodes[0].bounds.intersect(ray.origin, ray.direction, tNear, tFar) && tFar >= 0 && tNear <= closestDistance)
+		stack[stackSize++] = { 0, tNear };
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		// A closer hit was found after the node was pushed.
+		if (entry.tNear > closestDistance)
+			continue;
+
+		const TopNode& node = topNodes[entry.node];
+		if (node.isLeaf())
+		{
+			for (unsigned int i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+			{
+				const Instance& instance = instances[objectOrder[i]];
+				// The ray parameter is the same in both spaces, so the object hit distance is the world distance.
+				KdStructs::RayHit objectHit;
+				KdStructs::Ray objectRay = toObjectSpace(ray, instance, closestDistance);
+				bool objectHasHit = stats != nullptr ? instance.structure->raycast(objectRay, objectHit, *stats) : instance.structure->raycast(objectRay, objectHit);
+				if (!objectHasHit)
+					continue;
+
+				closestDistance = objectHit.distance;
+				hit = KdStructs::RayHit(objectHit.triangle, ray.origin + ray.direction * objectHit.distance, objectHit.distance);
+				object = objectOrder[i];
+				found = true;
+			}
+			continue;
+		}
+
+		// Visit the closer child first (pushed last).
+		unsigned int children[2] = { entry.node + 1, node.right };
+		float childNear[2];
+		bool childHit[2];
+		for (int i = 0; i < 2; i++)
+			childHit[i] = topNodes[children[i]].bounds.intersect(ray.origin, ray.direction, childNear[i], tFar) && tFar >= 0 && childNear[i] <= closestDistance;
+
+		int first = childHit[1] && (!childHit[0] || childNear[1] < childNear[0]) ? 1 : 0;
+		int second = 1 - first;
+		assert(stackSize + 2 <= TOP_STACK_SIZE);
+		if (childHit[second])
+			stack[stackSize++] = { children[second], childNear[second] };
+		if (childHit[first])
+			stack[stackSize++] = { children[first], childNear[first] };
+	}
+	return found;
+}
+
+bool KdScene::occluded(const KdStructs::Ray& ray, float maxDistance) const
+{
+	if (topNodes.empty())
+		return false;
+
+	unsigned int stack[TOP_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		unsigned int nodeIndex = stack[--stackSize];
+		const TopNode& node = topNodes[nodeIndex];
+
+		float tNear, tFar;
+		if (!node.bounds.intersect(ray.origin, ray.direction, tNear, tFar) || tFar < 0 || tNear >= maxDistance)
+			continue;
+
+		if (node.isLeaf())
+		{
+			for (unsigned int i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+			{
+				const Instance& instance = instances[objectOrder[i]];
+				if (instance.structure->occluded(toObjectSpace(ray, instance, maxDistance), maxDistance))
+					return true;
+			}
+			continue;
+		}
+
+		assert(stackSize + 2 <= TOP_STACK_SIZE);
+		stack[stackSize++] = node.right;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+	return false;
+}
+
+unsigned int KdScene::queryAABB(const KdStructs::BoundingBox& box, std::vector<unsigned int>& objects) const
+{
+	return findObjects([&box](const KdStructs::BoundingBox& bounds) { return box.overlaps(bounds); }, objects);
+}
+
+unsigned int KdScene::queryFrustum(const KdStructs::Frustum& frustum, std::vector<unsigned int>& objects) const
+{
+	return findObjects([&frustum](const KdStructs::BoundingBox& bounds) { return frustum.intersects(bounds); }, objects);
+}
+
+template <typename BoxTest>
+unsigned int KdScene::findObjects(BoxTest isInRegion, std::vector<unsigned int>& objects) const
+{
+	objects.clear();
+	if (topNodes.empty())
+		return 0;
+
+	unsigned int stack[TOP_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		unsigned int nodeIndex = stack[--stackSize];
+		const TopNode& node = topNodes[nodeIndex];
+		if (!isInRegion(node.bounds))
+			continue;
+
+		if (node.isLeaf())
+		{
+			for (unsigned int i = node.firstObject; i < node.firstObject + node.objectCount; i++)
+				if (isInRegion(instances[objectOrder[i]].worldBounds))
+					objects.push_back(objectOrder[i]);
+			continue;
+		}
+
+		assert(stackSize + 2 <= TOP_STACK_SIZE);
+		stack[stackSize++] = node.right;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+
+	// Leaves are in top level order, callers expect the ids in order.
+	std::sort(objects.begin(), objects.end());
+	return objects.size();
+}
+
+void KdScene::printStatistics() const
+{
+	size_t meshSize = 0;
+	size_t uniqueTriangles = 0;
+	for (const std::unique_ptr<RayQueryStructure>& mesh : meshes)
+	{
+		meshSize += mesh->getMemorySize();
+		uniqueTriangles += mesh->getTriangleCount();
+	}
+
+	// What every object having its own tree would cost
+	size_t unsharedSize = 0;
+	size_t triangleCount = 0;
+	for (const Instance& instance : instances)
+	{
+		unsharedSize += instance.structure->getMemorySize();
+		triangleCount += instance.structure->getTriangleCount();
+	}
+
+	std::cout << "Objects: " << instances.size() << " (" << triangleCount << " triangles)" << std::endl;
+	std::cout << "Meshes: " << meshes.size() << " (" << uniqueTriangles << " triangles)" << std::endl;
+	std::cout << "Top level: " << topNodes.size() << " nodes, " << topNodes.size() * sizeof(TopNode) << " bytes" << std::endl;
+	std::cout << "Mesh trees: " << meshSize << " bytes (" << unsharedSize << " bytes without instancing)" << std::endl;
+}
+
+void KdScene::rebuild()
+{
+	objectOrder.clear();
+	for (unsigned int object = 0; object < instances.size(); object++)
+	{
+		// Objects without triangles can never be hit.
+		if (instances[object].structure->getNodeCount() > 0)
+			objectOrder.push_back(object);
+	}
+
+	topNodes.clear();
+	topNodes.reserve(objectOrder.size() * 2);
+	if (!objectOrder.empty())
+		createTopNode(0, objectOrder.size());
+}
+
+/// <summary>
+/// Builds the subtree for the objects [begin, end) of objectOrder by splitting them
+/// at the median of their centers on the widest axis. Returns the index of the created node.
+/// </summary>
+unsigned int KdScene::createTopNode(size_t begin, size_t end)
+{
+	unsigned int nodeIndex = topNodes.size();
+	topNodes.push_back(TopNode());
+
+	KdStructs::BoundingBox bounds;
+	KdStructs::BoundingBox centers;
+	for (size_t i = begin; i < end; i++)
+	{
+		const KdStructs::BoundingBox& objectBounds = instances[objectOrder[i]].worldBounds;
+		bounds.extend(objectBounds);
+		centers.extend((objectBounds.min + objectBounds.max) * 0.5f);
+	}
+	topNodes[nodeIndex].bounds = bounds;
+
+	if (end - begin == 1)
+	{
+		topNodes[nodeIndex].firstObject = begin;
+		topNodes[nodeIndex].objectCount = 1;
+		return nodeIndex;
+	}
+
+	int axis = 0;
+	for (int currentAxis = 1; currentAxis < DIMENSIONS; currentAxis++)
+		if (centers.max[currentAxis] - centers.min[currentAxis] > centers.max[axis] - centers.min[axis])
+			axis = currentAxis;
+
+	size_t median = begin + (end - begin) / 2;
+	std::nth_element(objectOrder.begin() + begin, objectOrder.begin() + median, objectOrder.begin() + end, [this, axis](unsigned int a, unsigned int b) {
+		const KdStructs::BoundingBox& boundsA = instances[a].worldBounds;
+		const KdStructs::BoundingBox& boundsB = instances[b].worldBounds;
+		return boundsA.min[axis] + boundsA.max[axis] < boundsB.min[axis] + boundsB.max[axis];
+	});
+
+	// The left child directly follows this node.
+	createTopNode(begin, median);
+	unsigned int right = createTopNode(median, end);
+	topNodes[nodeIndex].right = right;
+	return nodeIndex;
+}
+
+/// <summary>
+/// Recomputes the node bounds bottom-up, children always come after their parent.
+/// The hierarchy itself is kept, so it gets looser if objects move far.
+/// </summary>
+void KdScene::refit()
+{
+	for (size_t i = topNodes.size(); i-- > 0;)
+	{
+		TopNode& node = topNodes[i];
+		node.bounds = KdStructs::BoundingBox();
+		if (node.isLeaf())
+		{
+			for (unsigned int j = node.firstObject; j < node.firstObject + node.objectCount; j++)
+				node.bounds.extend(instances[objectOrder[j]].worldBounds);
+		}
+		else
+		{
+			node.bounds.extend(topNodes[i + 1].bounds);
+			node.bounds.extend(topNodes[node.right].bounds);
+		}
+	}
+}
+
+void KdScene::updateWorldBounds(Instance& instance)
+{
+	instance.worldBounds = KdStructs::BoundingBox();
+	if (instance.structure->getNodeCount() == 0)
+		return;
+
+	// Bounds of the transformed corners of the object space bounds
+	const KdStructs::BoundingBox& objectBounds = instance.structure->getBounds();
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec4 position = glm::vec4(
+			(corner & 1) ? objectBounds.max[0] : objectBounds.min[0],
+			(corner & 2) ? objectBounds.max[1] : objectBounds.min[1],
+			(corner & 4) ? objectBounds.max[2] : objectBounds.min[2],
+			1.0f);
+		position = instance.transform * position;
+		instance.worldBounds.extend(KdStructs::Vector(position.x, position.y, position.z));
+	}
+}
+
+/// <summary>
+/// Compares the triangles a mesh was built with to the given vertices, so no copy of the vertices has to be kept.
+/// </summary>
+bool KdScene::hasTriangles(const RayQueryStructure& mesh, const float* vertices, unsigned int vertexCount)
+{
+	if (mesh.getTriangleCount() != vertexCount / 3)
+		return false;
+
+	for (unsigned int triangle = 0; triangle < mesh.getTriangleCount(); triangle++)
+	{
+		const KdStructs::Triangle& corners = mesh.getTriangle(triangle);
+		const float* expected = vertices + (size_t)triangle * 9;
+		for (int axis = 0; axis < 3; axis++)
+			if (corners.a[axis] != expected[axis] || corners.b[axis] != expected[3 + axis] || corners.c[axis] != expected[6 + axis])
+				return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// The direction is not normalized, so distances along the ray stay the same.
+/// Mirroring transforms flip the winding, so the front faces of such instances are clockwise in object space.
+/// </summary>
+KdStructs::Ray KdScene::toObjectSpace(const KdStructs::Ray& ray, const Instance& instance, float distance) const
+{
+	glm::vec4 origin = instance.inverseTransform * glm::vec4(ray.origin[0], ray.origin[1], ray.origin[2], 1.0f);
+	glm::vec4 direction = instance.inverseTransform * glm::vec4(ray.direction[0], ray.direction[1], ray.direction[2], 0.0f);
+	KdStructs::Ray objectRay(KdStructs::Vector(origin.x, origin.y, origin.z), KdStructs::Vector(direction.x, direction.y, direction.z), distance, ray.cullBackfaces);
+	objectRay.clockwiseFrontFaces = ray.clockwiseFrontFaces != instance.mirrored;
+	return objectRay;
+}
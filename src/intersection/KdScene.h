@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "KdTree.h"
+#include "RayQueryStructure.h"
+
+/// <summary>
+/// Two-level acceleration structure for scenes with moving objects.
+/// Every object has its own kd-tree (or BVH) in object space, a bounding volume hierarchy over the
+/// world space bounds of the objects sits on top. Moving an object only refits the top level,
+/// adding one builds its tree and rebuilds the (small) top level.
+/// Objects with the same geometry (e.g. several cubes) are instances of one shared mesh tree,
+/// so memory scales with the unique geometry instead of the object count.
+/// </summary>
+class KdScene
+{
+public:
+	static constexpr unsigned int NO_OBJECT = std::numeric_limits<unsigned int>::max();
+
+	KdScene() = default;
+
+	/// <summary>
+	/// Adds the geometry (non-indexed vertices in object space) and builds its structure,
+	/// unless the same geometry was added with the same structure type before. Returns the id of the mesh.
+	/// </summary>
+	unsigned int addMesh(float* vertices, unsigned int vertexCount, RayQueryStructure::Type type = RayQueryStructure::Type::KD_TREE, ThreadPool* threadPool = nullptr);
+	/// <summary>
+	/// Adds an instance of the mesh. Returns the id of the object, ids are assigned in order starting at 0.
+	/// </summary>
+	unsigned int addInstance(unsigned int mesh, const glm::mat4& transform);
+	/// <summary>
+	/// addMesh + addInstance
+	/// </summary>
+	unsigned int addObject(float* vertices, unsigned int vertexCount, const glm::mat4& transform, RayQueryStructure::Type type = RayQueryStructure::Type::KD_TREE, ThreadPool* threadPool = nullptr);
+	void setTransform(unsigned int object, const glm::mat4& transform);
+	/// <summary>
+	/// Selects the ray-triangle test of all meshes, including the ones added later (see RayQueryStructure::setTriangleTest).
+	/// </summary>
+	void setTriangleTest(KdStructs::TriangleTest test);
+	const glm::mat4& getTransform(unsigned int object) const;
+	unsigned int getObjectCount() const;
+	unsigned int getMeshCount() const;
+	unsigned int getMesh(unsigned int object) const;
+	/// <summary>
+	/// Memory of the object trees (nodes, triangles and SIMD blocks), the mesh vertices and the top level.
+	/// </summary>
+	size_t getMemorySize() const;
+
+	/// <summary>
+	/// Applies the changes since the last update: rebuilds the top level if objects were added, refits it if objects moved.
+	/// Has to be called before querying the scene after changes.
+	/// </summary>
+	void update();
+
+	/// <summary>
+	/// Finds the closest hit in world space (up to ray.distance).
+	/// hit.triangle points to the triangle in object space, position and distance are in world space.
+	/// </summary>
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object) const;
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const;
+	/// <summary>
+	/// Same as raycast, the stats record one query per object tree that was cast against.
+	/// </summary>
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object, KdStructs::TraversalStats& stats) const;
+	/// <summary>
+	/// Returns true if any object is hit closer than maxDistance.
+	/// </summary>
+	bool occluded(const KdStructs::Ray& ray, float maxDistance) const;
+
+	/// <summary>
+	/// Finds the objects whose world bounds overlap the box, sorted by id.
+	/// The results are cleared first, returns their count.
+	/// </summary>
+	unsigned int queryAABB(const KdStructs::BoundingBox& box, std::vector<unsigned int>& objects) const;
+	/// <summary>
+	/// Finds the objects whose world bounds are not completely outside the frustum, sorted by id.
+	/// Meant for culling objects against the camera or light before rendering them.
+	/// </summary>
+	unsigned int queryFrustum(const KdStructs::Frustum& frustum, std::vector<unsigned int>& objects) const;
+
+	/// <summary>
+	/// Bounds of the object in world space.
+	/// </summary>
+	const KdStructs::BoundingBox& getBounds(unsigned int object) const;
+
+	void printStatistics() const;
+
+private:
+	struct Instance
+	{
+		unsigned int mesh = 0;
+		// Shared by all instances of the mesh
+		const RayQueryStructure* structure = nullptr;
+		glm::mat4 transform = glm::mat4(1.0f);
+		glm::mat4 inverseTransform = glm::mat4(1.0f);
+		// Negative determinant, the transform flips the winding of the triangles
+		bool mirrored = false;
+		KdStructs::BoundingBox worldBounds;
+	};
+
+	// Top level nodes in depth-first order, the left child directly follows its parent.
+	struct TopNode
+	{
+		KdStructs::BoundingBox bounds;
+		unsigned int right = KdStructs::NO_NODE;
+		// Leaves reference the objects [firstObject, firstObject + objectCount) of objectOrder
+		unsigned int firstObject = 0;
+		unsigned int objectCount = 0;
+
+		bool isLeaf() const { return objectCount > 0; }
+	};
+
+	bool findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, unsigned int& object, KdStructs::TraversalStats* stats) const;
+	// The test decides for a world space box if it is in the queried region.
+	template <typename BoxTest>
+	unsigned int findObjects(BoxTest isInRegion, std::vector<unsigned int>& objects) const;
+	void rebuild();
+	void refit();
+	unsigned int createTopNode(size_t begin, size_t end);
+	void updateWorldBounds(Instance& instance);
+	static bool hasTriangles(const RayQueryStructure& mesh, const float* vertices, unsigned int vertexCount);
+	KdStructs::Ray toObjectSpace(const KdStructs::Ray& ray, const Instance& instance, float distance) const;
+
+	std::vector<std::unique_ptr<RayQueryStructure>> meshes;
+	// Mesh ids by KdTree::hashScene of their vertices, combined with the structure type.
+	// Different geometry with the same hash gets its own mesh under the same key (see hasTriangles).
+	std::unordered_multimap<uint64_t, unsigned int> meshesByHash;
+	std::vector<Instance> instances;
+	std::vector<TopNode> topNodes;
+	std::vector<unsigned int> objectOrder;
+
+	KdStructs::TriangleTest triangleTest = KdStructs::TriangleTest::MOLLER_TRUMBORE;
+	bool needsRebuild = false;
+	bool needsRefit = false;
+};
@@ -1,238 +1,977 @@
 #include "KdTree.h"
 
 #include <algorithm>
+#include <cassert>
 #include <functional>
 
 #include <fstream>
 #include <limits>
 #include <cmath>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+#include <xmmintrin.h>
+
+// Cost of one traversal step vs. one ray-triangle test, used by the surface area heuristic.
+constexpr float TRAVERSAL_COST = 15.0f;
+constexpr float INTERSECTION_COST = 20.0f;
+// Cost reduction for splits cutting off empty space.
+constexpr float EMPTY_BONUS = 0.2f;
+// Number of candidate planes per axis is SAH_BINS - 1.
+constexpr int SAH_BINS = 32;
+constexpr unsigned int MAX_LEAF_TRIANGLES = 2;
+// Minimum number of points/triangles for building subtrees and reductions in parallel.
+constexpr size_t PARALLEL_BUILD_THRESHOLD = 4096;
+// Number of rays traced together by raycastBatch (one SSE register).
+constexpr int PACKET_SIZE = 4;
+// Rays per task of a parallel raycastBatch.
+constexpr size_t BATCH_CHUNK_SIZE = 1024;
+// Depth limit of SAH trees (8 + 1.3 * log2(triangles)), reached at 2^32 triangles.
+constexpr int MAX_SAH_DEPTH = 50;
+// Median splits halve the points, so unsigned int point counts need at most 32 levels.
+constexpr int MAX_MEDIAN_DEPTH = 32;
+// Traversals push at most one far child per level.
+constexpr int TRAVERSAL_STACK_SIZE = 64;
+static_assert(MAX_SAH_DEPTH <= TRAVERSAL_STACK_SIZE && MAX_MEDIAN_DEPTH <= TRAVERSAL_STACK_SIZE, "traversal stack is smaller than the deepest tree");
+// Relative tolerance of the traversal at splitting planes, planes this close to a segment end count as crossed.
+constexpr float TRAVERSAL_EPSILON = 1e-5f;
+
+// Saved trees, the version has to be increased whenever the layout of the file or the structures changes.
+constexpr char FILE_MAGIC[4] = { 'K', 'D', 'T', 'R' };
+constexpr uint32_t FILE_VERSION = 4;
+// Alignment of the arrays in the file (mapped files start at a page boundary).
+constexpr uint64_t FILE_ALIGNMENT = 64;
+
+namespace {
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sceneHash;
+		uint32_t buildMode;
+		// Files are only valid for the same structure layout.
+		uint32_t nodeSize;
+		uint32_t triangleSize;
+		uint32_t blockSize;
+		float boundsMin[3];
+		float boundsMax[3];
+
+		// Element count and position (from the start of the file) of each array
+		uint64_t nodeCount, nodeOffset;
+		uint64_t nodeTriangleOffsetCount, nodeTriangleOffsetOffset;
+		uint64_t triangleIndexCount, triangleIndexOffset;
+		uint64_t triangleCount, triangleOffset;
+		uint64_t blockCount, blockOffset;
+		uint64_t blockOffsetCount, blockOffsetOffset;
+		uint64_t pointPositionCount, pointPositionOffset;
+		// Empty for median trees (the point tree is the tree itself) and SAH trees saved before their point tree was built
+		uint64_t pointNodeCount, pointNodeOffset;
+		uint64_t pointTriangleOffsetCount, pointTriangleOffsetOffset;
+		uint64_t pointTriangleIndexCount, pointTriangleIndexOffset;
+		uint64_t fileSize;
+	};
 
+	uint64_t alignFileOffset(uint64_t offset)
+	{
+		return (offset + FILE_ALIGNMENT - 1) / FILE_ALIGNMENT * FILE_ALIGNMENT;
+	}
 
-KdTree::KdTree(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount) :
-	KdTree(getPointList(vertices, vertexCount, indices, indexCount)) {}
+	/// <summary>
+	/// Children of an inner node that the ray segment [tMin, tMax] has to visit.
+	/// The near child is the one the ray enters first, it is left of the plane for rays going into positive direction.
+	/// </summary>
+	struct SplitVisit
+	{
+		bool nearIsRight = false;
+		bool near = true;
+		bool far = false;
+		// End of the segment in the near child and start of the segment in the far child
+		float nearMax = 0;
+		float farMin = 0;
+	};
 
-KdTree::KdTree(float* vertices, unsigned int vertexCount) :
-	KdTree(getPointList(vertices, vertexCount)) {}
+	float traversalTolerance(float t)
+	{
+		return TRAVERSAL_EPSILON * std::max(1.0f, std::fabs(t));
+	}
 
-KdTree::KdTree(std::vector<KdStructs::Point*> points)
-{
-	KdStructs::Vector max = KdStructs::Vector(0, 0, 0);
-	KdStructs::Vector min = KdStructs::Vector(0, 0, 0);
-	// Get max values for axes.
-	for (int axis = 0; axis < DIMENSIONS; axis++)
+	/// <summary>
+	/// Splits the segment at the plane. Both parts reach a relative epsilon past the plane,
+	/// so a ray through a cell border finds the triangles on both sides despite the rounding of t.
+	/// Parallel rays only visit the side of their origin, or both if the origin lies in the plane.
+	/// </summary>
+	SplitVisit visitSplit(const KdStructs::Ray& ray, int axis, float split, float tMin, float tMax)
+	{
+		SplitVisit visit;
+		visit.nearMax = tMax;
+		visit.farMin = tMin;
+		if (ray.direction[axis] == 0.0f) {
+			visit.nearIsRight = ray.origin[axis] > split;
+			visit.far = std::fabs(ray.origin[axis] - split) <= traversalTolerance(split);
+			return visit;
+		}
+
+		float t = (split - ray.origin[axis]) / ray.direction[axis];
+		float tolerance = traversalTolerance(t);
+		visit.nearIsRight = ray.direction[axis] < 0;
+		visit.nearMax = std::min(tMax, t + tolerance);
+		visit.farMin = std::max(tMin, t - tolerance);
+		visit.near = tMin <= visit.nearMax;
+		visit.far = visit.farMin <= tMax;
+		return visit;
+	}
+
+	/// <summary>
+	/// Checks that an array lies inside the file and is aligned.
+	/// </summary>
+	bool isValidArray(uint64_t count, uint64_t offset, uint64_t elementSize, uint64_t fileSize)
 	{
-		auto comparator = getComparatorForAxis(axis);
+		return offset % FILE_ALIGNMENT == 0 && offset <= fileSize && count <= (fileSize - offset) / elementSize;
+	}
 
-		KdStructs::Point* minPoint = *std::min_element(points.begin(), points.end(), comparator);
-		KdStructs::Point* maxPoint = *std::max_element(points.begin(), points.end(), comparator);
+	/// <summary>
+	/// Checks that prefix offsets start at 0, never decrease and end at the size of the array they index.
+	/// </summary>
+	bool isValidOffsets(const unsigned int* offsets, uint64_t count, uint64_t total)
+	{
+		if (count == 0 || offsets[0] != 0 || offsets[count - 1] != total)
+			return false;
+		for (uint64_t i = 1; i < count; i++)
+			if (offsets[i] < offsets[i - 1])
+				return false;
+		return true;
+	}
 
-		max[axis] = maxPoint->pos[axis];
-		min[axis] = minPoint->pos[axis];
+	bool isValidIndices(const unsigned int* indices, uint64_t count, uint64_t limit)
+	{
+		for (uint64_t i = 0; i < count; i++)
+			if (indices[i] >= limit)
+				return false;
+		return true;
 	}
 
-	root = createKdTree(points, 0, max, min);
+	/// <summary>
+	/// Checks that the children of every node lie behind it in the array (depth-first order, so every traversal ends),
+	/// that the axes are valid and that no path is deeper than the traversal stack.
+	/// </summary>
+	bool isValidNodes(const KdStructs::Node* nodes, uint64_t count)
+	{
+		std::vector<int> depths(count, 0);
+		for (uint64_t i = 0; i < count; i++)
+		{
+			const KdStructs::Node& node = nodes[i];
+			if (node.axis() >= DIMENSIONS)
+				return false;
+
+			for (unsigned int child : { node.left((unsigned int)i), node.right() })
+			{
+				if (child == KdStructs::NO_NODE)
+					continue;
+				if (child <= i || child >= count)
+					return false;
+				depths[child] = std::max(depths[child], depths[i] + 1);
+				if (depths[child] > TRAVERSAL_STACK_SIZE)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Spatial hash for welding duplicate vertices. Positions are quantized to cells of Vector::EPSILON,
+	/// so all points equal to a position (closer than EPSILON on every axis) lie in the 27 surrounding cells.
+	/// </summary>
+	class PointGrid
+	{
+	public:
+		PointGrid(size_t expectedPoints)
+		{
+			cells.reserve(expectedPoints);
+			nextInCell.reserve(expectedPoints);
+		}
+
+		/// <summary>
+		/// Returns the index of the first added point equal to the position, or -1 if there is none.
+		/// </summary>
+		int find(const KdStructs::Vector& position, const std::vector<KdStructs::Point>& points) const
+		{
+			Cell cell = getCell(position);
+			int found = -1;
+			for (int x = -1; x <= 1; x++)
+				for (int y = -1; y <= 1; y++)
+					for (int z = -1; z <= 1; z++)
+					{
+						auto entry = cells.find(Cell{ cell.x + x, cell.y + y, cell.z + z });
+						if (entry == cells.end())
+							continue;
+						for (int point = entry->second; point != -1; point = nextInCell[point])
+							if ((found == -1 || point < found) && points[point].pos == position)
+								found = point;
+					}
+			return found;
+		}
+
+		/// <summary>
+		/// Adds the position of points[pointIndex], points have to be added in order.
+		/// </summary>
+		void add(const KdStructs::Vector& position, int pointIndex)
+		{
+			auto entry = cells.emplace(getCell(position), -1).first;
+			nextInCell.push_back(entry->second);
+			entry->second = pointIndex;
+		}
+
+	private:
+		struct Cell
+		{
+			long long x, y, z;
+
+			bool operator==(const Cell& other) const { return x == other.x && y == other.y && z == other.z; }
+		};
+
+		struct CellHash
+		{
+			size_t operator()(const Cell& cell) const
+			{
+				uint64_t hash = (uint64_t)cell.x * 73856093ull ^ (uint64_t)cell.y * 19349663ull ^ (uint64_t)cell.z * 83492791ull;
+				return (size_t)(hash ^ (hash >> 32));
+			}
+		};
+
+		static Cell getCell(const KdStructs::Vector& position)
+		{
+			const double size = KdStructs::Vector::EPSILON;
+			return Cell{ (long long)std::floor(position[0] / size), (long long)std::floor(position[1] / size), (long long)std::floor(position[2] / size) };
+		}
+
+		// Last added point of each cell, the points of a cell are linked by nextInCell.
+		std::unordered_map<Cell, int, CellHash> cells;
+		std::vector<int> nextInCell;
+	};
 }
 
-KdTree::~KdTree()
+KdTree::KdTree(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount, BuildMode buildMode, ThreadPool* threadPool) : buildMode(buildMode), threadPool(threadPool)
 {
-	for (KdStructs::Triangle* triangle : triangles)
-		delete triangle;
-	triangles.clear();
+	addTriangles(vertices, indices, indexCount);
+	if (buildMode == BuildMode::SAH) {
+		buildSah();
+		// The points are welded by vertex index, which the triangles don't know.
+		pointStorage.cornerVertices.assign(indices, indices + storage.triangles.size() * 3);
+		pointTreePending = !storage.triangles.empty();
+	}
+	else
+		buildMedian(weldPoints(storage.triangles, indices));
+	buildTriangleBlocks();
+	updateViews();
 
-	delete root;
+	// Only used while building.
+	this->threadPool = nullptr;
 }
 
-void KdTree::raycast(KdStructs::Ray ray, KdStructs::RayHit*& hit)
+KdTree::KdTree(float* vertices, unsigned int vertexCount, BuildMode buildMode, ThreadPool* threadPool) : buildMode(buildMode), threadPool(threadPool)
 {
-	checkCache++;
-	if (checkCache == std::numeric_limits<unsigned int>::max())
-		checkCache = 0;
-	findIntersection(root, ray, hit);
+	addTriangles(vertices, vertexCount);
+	if (buildMode == BuildMode::SAH) {
+		buildSah();
+		pointTreePending = !storage.triangles.empty();
+	}
+	else
+		buildMedian(weldPoints(storage.triangles, nullptr));
+	buildTriangleBlocks();
+	updateViews();
+
+	// Only used while building.
+	this->threadPool = nullptr;
 }
 
-std::vector<KdStructs::Node*> KdTree::getNodes()
+KdTree::~KdTree() = default;
+
+bool KdTree::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const
 {
-	std::vector<KdStructs::Node*> nodes;
+	KdStructs::NoTraversalStats stats;
+	return findClosestHit(ray, hit, stats);
+}
 
-	std::function<void(KdStructs::Node*)> getNodeRecursive;
-	getNodeRecursive = [&nodes, &getNodeRecursive](KdStructs::Node* node) {
-		if (node == nullptr)
-			return;
+bool KdTree::raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, KdStructs::TraversalStats& stats) const
+{
+	stats.beginRay();
+	bool hasHit = findClosestHit(ray, hit, stats);
+	stats.endRay();
+	return hasHit;
+}
 
-		nodes.push_back(node);
-		getNodeRecursive(node->left);
-		getNodeRecursive(node->right);
-	};
+template <typename Stats>
+bool KdTree::findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, Stats& stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	// Only the part of the ray inside the tree has to be traversed.
+	float tMin, tMax;
+	if (!bounds.intersect(ray.origin, ray.direction, tMin, tMax) || tMax < 0 || tMin > ray.distance)
+		return false;
+
+	// Median tree cells do not bound their triangles (see findIntersection), only the whole tree does.
+	if (buildMode == BuildMode::MEDIAN) {
+		tMin = 0;
+		tMax = ray.distance;
+	}
+
+	KdStructs::RayHit closestHit = KdStructs::RayHit(nullptr, ray.origin, ray.distance);
+	findIntersection(ray, std::max(tMin, 0.0f), std::min(tMax, ray.distance), closestHit, stats);
+	if (closestHit.triangle == nullptr)
+		return false;
+
+	// Position is only needed for the final hit.
+	closestHit.position = ray.origin + ray.direction * closestHit.distance;
+	hit = closestHit;
+	return true;
+}
+
+bool KdTree::occluded(const KdStructs::Ray& ray, float maxDistance) const
+{
+	KdStructs::NoTraversalStats stats;
+	return findAnyHit(ray, maxDistance, stats);
+}
+
+bool KdTree::occluded(const KdStructs::Ray& ray, float maxDistance, KdStructs::TraversalStats& stats) const
+{
+	stats.beginRay();
+	bool isOccluded = findAnyHit(ray, maxDistance, stats);
+	stats.endRay();
+	return isOccluded;
+}
+
+void KdTree::setTriangleTest(KdStructs::TriangleTest test)
+{
+	triangleTest = test;
+	intersectBlocks = KdStructs::getBlockIntersector(simdLevel, test);
+	occludedBlocks = KdStructs::getBlockOccluder(simdLevel, test);
+}
+
+template <typename Stats>
+bool KdTree::findAnyHit(const KdStructs::Ray& ray, float maxDistance, Stats& stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	float tMin, tMax;
+	if (!bounds.intersect(ray.origin, ray.direction, tMin, tMax) || tMax < 0 || tMin > maxDistance)
+		return false;
+
+	if (buildMode == BuildMode::MEDIAN) {
+		tMin = 0;
+		tMax = maxDistance;
+	}
+
+	return findOcclusion(ray, std::max(tMin, 0.0f), std::min(tMax, maxDistance), maxDistance, stats);
+}
+
+unsigned int KdTree::raycastBatch(const KdStructs::Ray* rays, size_t rayCount, KdStructs::RayHitBuffer& hits, ThreadPool* threadPool) const
+{
+	hits.resize(rayCount);
+
+	// Rays are independent, every chunk writes its own part of the buffer.
+	if (threadPool != nullptr && rayCount > BATCH_CHUNK_SIZE)
+		threadPool->ParallelFor(rayCount, BATCH_CHUNK_SIZE, [this, rays, &hits](size_t begin, size_t end) {
+			raycastRange(rays, begin, end, hits);
+		});
+	else
+		raycastRange(rays, 0, rayCount, hits);
+
+	unsigned int hitCount = 0;
+	for (size_t i = 0; i < rayCount; i++)
+		hitCount += hits.isHit(i) ? 1 : 0;
+	return hitCount;
+}
+
+unsigned int KdTree::nearest(const KdStructs::Vector& position, unsigned int k, std::vector<KdStructs::PointHit>& results) const
+{
+	results.clear();
+	buildPendingPointTree();
+	if (pointNodes.empty() || k == 0)
+		return 0;
+
+	// results is a max-heap of the k closest points found so far.
+	findNearest(0, position, k, results);
+	std::sort_heap(results.begin(), results.end());
+	return results.size();
+}
+
+unsigned int KdTree::withinRadius(const KdStructs::Vector& position, float radius, std::vector<KdStructs::PointHit>& results) const
+{
+	results.clear();
+	buildPendingPointTree();
+	if (pointNodes.empty() || radius < 0)
+		return 0;
+
+	findWithinRadius(0, position, radius * radius, results);
+	std::sort(results.begin(), results.end());
+	return results.size();
+}
+
+unsigned int KdTree::queryAABB(const KdStructs::BoundingBox& box, std::vector<unsigned int>& results) const
+{
+	return findInRegion(box, results);
+}
+
+unsigned int KdTree::queryFrustum(const KdStructs::Frustum& frustum, std::vector<unsigned int>& results) const
+{
+	return findInRegion(frustum, results);
+}
+
+unsigned int KdTree::getPointCount() const
+{
+	buildPendingPointTree();
+	return pointPositions.size();
+}
+
+KdStructs::Vector KdTree::getPointPosition(unsigned int point) const
+{
+	buildPendingPointTree();
+	return pointPositions[point];
+}
+
+KdStructs::ArrayView<unsigned int> KdTree::getPointTriangles(unsigned int point) const
+{
+	buildPendingPointTree();
+	return KdStructs::ArrayView<unsigned int>(pointTriangleIndices.data() + pointTriangleOffsets[point], pointTriangleOffsets[point + 1] - pointTriangleOffsets[point]);
+}
+
+const KdStructs::Triangle& KdTree::getTriangle(unsigned int triangle) const
+{
+	return triangles[triangle];
+}
+
+const KdStructs::BoundingBox& KdTree::getBounds() const
+{
+	return bounds;
+}
+
+unsigned int KdTree::getTriangleCount() const
+{
+	return triangles.size();
+}
+
+KdTree::MemoryReport KdTree::getMemoryReport() const
+{
+	MemoryReport report;
+	report.nodes = nodes.size() * sizeof(KdStructs::Node) + nodeTriangleOffsets.size() * sizeof(unsigned int) + blockOffsets.size() * sizeof(unsigned int);
+	report.triangleIndices = triangleIndices.size() * sizeof(unsigned int);
+	report.triangles = triangles.size() * sizeof(KdStructs::Triangle);
+	report.triangleBlocks = triangleBlocks.size() * sizeof(KdStructs::TriangleBlock);
+	report.pointTree = pointPositions.size() * sizeof(KdStructs::Vector);
+	// Median trees are their own point tree.
+	if (buildMode == BuildMode::SAH)
+		report.pointTree += pointNodes.size() * sizeof(KdStructs::Node) + pointTriangleOffsets.size() * sizeof(unsigned int) + pointTriangleIndices.size() * sizeof(unsigned int);
+	// Every triangle reference of a node takes one lane of the node's blocks.
+	if (!triangleBlocks.empty())
+		report.blockLaneFill = (float)triangleIndices.size() / (triangleBlocks.size() * KdStructs::TriangleBlock::LANES);
+	return report;
+}
+
+size_t KdTree::getMemorySize() const
+{
+	return getMemoryReport().getTotal();
+}
 
-	getNodeRecursive(root);
+size_t KdTree::getNodeCount() const
+{
+	return nodes.size();
+}
+
+KdStructs::ArrayView<KdStructs::Node> KdTree::getNodes() const
+{
 	return nodes;
 }
 
+KdStructs::ArrayView<unsigned int> KdTree::getTriangleIndices() const
+{
+	return triangleIndices;
+}
+
+KdStructs::ArrayView<unsigned int> KdTree::getNodeTriangles(unsigned int node) const
+{
+	return KdStructs::ArrayView<unsigned int>(triangleIndices.data() + nodeTriangleOffsets[node], nodeTriangleOffsets[node + 1] - nodeTriangleOffsets[node]);
+}
+
+bool KdTree::isMapped() const
+{
+	return mappedFile != nullptr;
+}
+
+uint64_t KdTree::hashScene(const float* vertices, unsigned int vertexCount, BuildMode buildMode)
+{
+	// FNV-1a over the raw vertex data
+	uint64_t hash = 14695981039346656037ull;
+	const unsigned char* bytes = (const unsigned char*)vertices;
+	size_t byteCount = (size_t)vertexCount * 3 * sizeof(float);
+	for (size_t i = 0; i < byteCount; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return (hash ^ (uint64_t)buildMode) * 1099511628211ull;
+}
+
+bool KdTree::save(const std::string& path, uint64_t sceneHash) const
+{
+	// A pending point tree is left out and built by the loaded tree, unless it needs the vertex indices.
+	if (!pointStorage.cornerVertices.empty())
+		buildPendingPointTree();
+
+	FileHeader header = {};
+	std::copy(FILE_MAGIC, FILE_MAGIC + 4, header.magic);
+	header.version = FILE_VERSION;
+	header.sceneHash = sceneHash;
+	header.buildMode = (uint32_t)buildMode;
+	header.nodeSize = sizeof(KdStructs::Node);
+	header.triangleSize = sizeof(KdStructs::Triangle);
+	header.blockSize = sizeof(KdStructs::TriangleBlock);
+	for (int axis = 0; axis < DIMENSIONS; axis++)
+	{
+		header.boundsMin[axis] = bounds.min[axis];
+		header.boundsMax[axis] = bounds.max[axis];
+	}
+
+	header.nodeCount = nodes.size();
+	header.nodeOffset = alignFileOffset(sizeof(FileHeader));
+	header.nodeTriangleOffsetCount = nodeTriangleOffsets.size();
+	header.nodeTriangleOffsetOffset = alignFileOffset(header.nodeOffset + nodes.size() * sizeof(KdStructs::Node));
+	header.triangleIndexCount = triangleIndices.size();
+	header.triangleIndexOffset = alignFileOffset(header.nodeTriangleOffsetOffset + nodeTriangleOffsets.size() * sizeof(unsigned int));
+	header.triangleCount = triangles.size();
+	header.triangleOffset = alignFileOffset(header.triangleIndexOffset + triangleIndices.size() * sizeof(unsigned int));
+	header.blockCount = triangleBlocks.size();
+	header.blockOffset = alignFileOffset(header.triangleOffset + triangles.size() * sizeof(KdStructs::Triangle));
+	header.blockOffsetCount = blockOffsets.size();
+	header.blockOffsetOffset = alignFileOffset(header.blockOffset + triangleBlocks.size() * sizeof(KdStructs::TriangleBlock));
+	header.pointPositionCount = pointPositions.size();
+	header.pointPositionOffset = alignFileOffset(header.blockOffsetOffset + blockOffsets.size() * sizeof(unsigned int));
+	header.pointNodeCount = buildMode == BuildMode::SAH ? pointNodes.size() : 0;
+	header.pointNodeOffset = alignFileOffset(header.pointPositionOffset + pointPositions.size() * sizeof(KdStructs::Vector));
+	header.pointTriangleOffsetCount = buildMode == BuildMode::SAH ? pointTriangleOffsets.size() : 0;
+	header.pointTriangleOffsetOffset = alignFileOffset(header.pointNodeOffset + header.pointNodeCount * sizeof(KdStructs::Node));
+	header.pointTriangleIndexCount = buildMode == BuildMode::SAH ? pointTriangleIndices.size() : 0;
+	header.pointTriangleIndexOffset = alignFileOffset(header.pointTriangleOffsetOffset + header.pointTriangleOffsetCount * sizeof(unsigned int));
+	header.fileSize = header.pointTriangleIndexOffset + header.pointTriangleIndexCount * sizeof(unsigned int);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	uint64_t position = 0;
+	auto writeArray = [&file, &position](const void* data, uint64_t offset, uint64_t size) {
+		static const char padding[FILE_ALIGNMENT] = {};
+		file.write(padding, offset - position);
+		file.write((const char*)data, size);
+		position = offset + size;
+	};
+	writeArray(&header, 0, sizeof(FileHeader));
+	writeArray(nodes.data(), header.nodeOffset, nodes.size() * sizeof(KdStructs::Node));
+	writeArray(nodeTriangleOffsets.data(), header.nodeTriangleOffsetOffset, nodeTriangleOffsets.size() * sizeof(unsigned int));
+	writeArray(triangleIndices.data(), header.triangleIndexOffset, triangleIndices.size() * sizeof(unsigned int));
+	writeArray(triangles.data(), header.triangleOffset, triangles.size() * sizeof(KdStructs::Triangle));
+	writeArray(triangleBlocks.data(), header.blockOffset, triangleBlocks.size() * sizeof(KdStructs::TriangleBlock));
+	writeArray(blockOffsets.data(), header.blockOffsetOffset, blockOffsets.size() * sizeof(unsigned int));
+	writeArray(pointPositions.data(), header.pointPositionOffset, pointPositions.size() * sizeof(KdStructs::Vector));
+	writeArray(pointNodes.data(), header.pointNodeOffset, header.pointNodeCount * sizeof(KdStructs::Node));
+	writeArray(pointTriangleOffsets.data(), header.pointTriangleOffsetOffset, header.pointTriangleOffsetCount * sizeof(unsigned int));
+	writeArray(pointTriangleIndices.data(), header.pointTriangleIndexOffset, header.pointTriangleIndexCount * sizeof(unsigned int));
+
+	return (bool)file;
+}
+
+KdTree* KdTree::load(const std::string& path, uint64_t sceneHash)
+{
+	std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+	if (!file->Open(path) || file->GetSize() < sizeof(FileHeader))
+		return nullptr;
+
+	const unsigned char* data = file->GetData();
+	const FileHeader& header = *(const FileHeader*)data;
+	uint64_t fileSize = file->GetSize();
+	if (!std::equal(FILE_MAGIC, FILE_MAGIC + 4, header.magic) || header.version != FILE_VERSION || header.sceneHash != sceneHash
+		|| header.nodeSize != sizeof(KdStructs::Node) || header.triangleSize != sizeof(KdStructs::Triangle) || header.blockSize != sizeof(KdStructs::TriangleBlock)
+		|| header.fileSize != fileSize)
+		return nullptr;
+
+	if (!isValidArray(header.nodeCount, header.nodeOffset, sizeof(KdStructs::Node), fileSize)
+		|| !isValidArray(header.nodeTriangleOffsetCount, header.nodeTriangleOffsetOffset, sizeof(unsigned int), fileSize)
+		|| !isValidArray(header.triangleIndexCount, header.triangleIndexOffset, sizeof(unsigned int), fileSize)
+		|| !isValidArray(header.triangleCount, header.triangleOffset, sizeof(KdStructs::Triangle), fileSize)
+		|| !isValidArray(header.blockCount, header.blockOffset, sizeof(KdStructs::TriangleBlock), fileSize)
+		|| !isValidArray(header.blockOffsetCount, header.blockOffsetOffset, sizeof(unsigned int), fileSize)
+		|| !isValidArray(header.pointPositionCount, header.pointPositionOffset, sizeof(KdStructs::Vector), fileSize)
+		|| !isValidArray(header.pointNodeCount, header.pointNodeOffset, sizeof(KdStructs::Node), fileSize)
+		|| !isValidArray(header.pointTriangleOffsetCount, header.pointTriangleOffsetOffset, sizeof(unsigned int), fileSize)
+		|| !isValidArray(header.pointTriangleIndexCount, header.pointTriangleIndexOffset, sizeof(unsigned int), fileSize)
+		|| header.blockOffsetCount != header.nodeCount + 1 || header.nodeTriangleOffsetCount != header.nodeCount + 1
+		|| (header.pointNodeCount != 0 && header.pointTriangleOffsetCount != header.pointNodeCount + 1)
+		|| header.pointPositionCount != (header.buildMode == (uint32_t)BuildMode::SAH ? header.pointNodeCount : header.nodeCount)
+		|| (header.buildMode != (uint32_t)BuildMode::MEDIAN && header.buildMode != (uint32_t)BuildMode::SAH))
+		return nullptr;
+
+	// The traversals trust the links and offsets, a damaged file must not make them read outside the arrays.
+	const KdStructs::TriangleBlock* blocks = (const KdStructs::TriangleBlock*)(data + header.blockOffset);
+	for (uint64_t block = 0; block < header.blockCount; block++)
+		if (!isValidIndices(blocks[block].triangles, KdStructs::TriangleBlock::LANES, header.triangleCount))
+			return nullptr;
+	if (!isValidNodes((const KdStructs::Node*)(data + header.nodeOffset), header.nodeCount)
+		|| !isValidOffsets((const unsigned int*)(data + header.nodeTriangleOffsetOffset), header.nodeTriangleOffsetCount, header.triangleIndexCount)
+		|| !isValidOffsets((const unsigned int*)(data + header.blockOffsetOffset), header.blockOffsetCount, header.blockCount)
+		|| !isValidIndices((const unsigned int*)(data + header.triangleIndexOffset), header.triangleIndexCount, header.triangleCount))
+		return nullptr;
+	if (header.pointNodeCount != 0 && (!isValidNodes((const KdStructs::Node*)(data + header.pointNodeOffset), header.pointNodeCount)
+		|| !isValidOffsets((const unsigned int*)(data + header.pointTriangleOffsetOffset), header.pointTriangleOffsetCount, header.pointTriangleIndexCount)
+		|| !isValidIndices((const unsigned int*)(data + header.pointTriangleIndexOffset), header.pointTriangleIndexCount, header.triangleCount)))
+		return nullptr;
+
+	KdTree* kdTree = new KdTree();
+	kdTree->buildMode = (BuildMode)header.buildMode;
+	kdTree->bounds = KdStructs::BoundingBox(
+		KdStructs::Vector(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+		KdStructs::Vector(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]));
+	kdTree->nodes = KdStructs::ArrayView<KdStructs::Node>((const KdStructs::Node*)(data + header.nodeOffset), header.nodeCount);
+	kdTree->nodeTriangleOffsets = KdStructs::ArrayView<unsigned int>((const unsigned int*)(data + header.nodeTriangleOffsetOffset), header.nodeTriangleOffsetCount);
+	kdTree->triangleIndices = KdStructs::ArrayView<unsigned int>((const unsigned int*)(data + header.triangleIndexOffset), header.triangleIndexCount);
+	kdTree->triangles = KdStructs::ArrayView<KdStructs::Triangle>((const KdStructs::Triangle*)(data + header.triangleOffset), header.triangleCount);
+	kdTree->triangleBlocks = KdStructs::ArrayView<KdStructs::TriangleBlock>((const KdStructs::TriangleBlock*)(data + header.blockOffset), header.blockCount);
+	kdTree->blockOffsets = KdStructs::ArrayView<unsigned int>((const unsigned int*)(data + header.blockOffsetOffset), header.blockOffsetCount);
+	kdTree->pointPositions = KdStructs::ArrayView<KdStructs::Vector>((const KdStructs::Vector*)(data + header.pointPositionOffset), header.pointPositionCount);
+	kdTree->pointNodes = kdTree->nodes;
+	kdTree->pointTriangleOffsets = kdTree->nodeTriangleOffsets;
+	kdTree->pointTriangleIndices = kdTree->triangleIndices;
+	if (kdTree->buildMode == BuildMode::SAH) {
+		kdTree->pointNodes = KdStructs::ArrayView<KdStructs::Node>((const KdStructs::Node*)(data + header.pointNodeOffset), header.pointNodeCount);
+		kdTree->pointTriangleOffsets = KdStructs::ArrayView<unsigned int>((const unsigned int*)(data + header.pointTriangleOffsetOffset), header.pointTriangleOffsetCount);
+		kdTree->pointTriangleIndices = KdStructs::ArrayView<unsigned int>((const unsigned int*)(data + header.pointTriangleIndexOffset), header.pointTriangleIndexCount);
+		kdTree->pointTreePending = header.pointNodeCount == 0 && header.triangleCount > 0;
+	}
+	kdTree->simdLevel = KdStructs::detectSimdLevel();
+	kdTree->setTriangleTest(KdStructs::TriangleTest::MOLLER_TRUMBORE);
+	kdTree->mappedFile = std::move(file);
+	return kdTree;
+}
+
+KdTree* KdTree::loadOrBuild(const std::string& path, float* vertices, unsigned int vertexCount, BuildMode buildMode, ThreadPool* threadPool)
+{
+	uint64_t sceneHash = hashScene(vertices, vertexCount, buildMode);
+	KdTree* kdTree = load(path, sceneHash);
+	if (kdTree != nullptr)
+		return kdTree;
+
+	kdTree = new KdTree(vertices, vertexCount, buildMode, threadPool);
+	if (!kdTree->save(path, sceneHash))
+		std::cout << "[!] Could not save kd-tree to " << path << std::endl;
+	return kdTree;
+}
+
 void KdTree::print()
 {
-	std::function<void(KdStructs::Node*)> printRecursive;
-	printRecursive = [&printRecursive](KdStructs::Node* node) {
-		std::cout << node->point->pos << " | " << node->axis << " | " << "Max: " << node->max << " Min: " << node->min << std::endl;
-		if (node->left != nullptr) {
+	std::function<void(unsigned int)> printRecursive;
+	printRecursive = [this, &printRecursive](unsigned int nodeIndex) {
+		const KdStructs::Node& node = nodes[nodeIndex];
+		std::cout << node.split << " | " << node.axis() << " | " << "Triangles: " << getNodeTriangles(nodeIndex).size() << std::endl;
+		if (node.left(nodeIndex) != KdStructs::NO_NODE) {
 			std::cout << "Left:" << std::endl;
-			printRecursive(node->left);
+			printRecursive(node.left(nodeIndex));
 		}
-		if (node->right != nullptr) {
+		if (node.right() != KdStructs::NO_NODE) {
 			std::cout << "Right:" << std::endl;
-			printRecursive(node->right);
+			printRecursive(node.right());
 		}
 	};
 
-	printRecursive(root);
+	if (!nodes.empty())
+		printRecursive(0);
 }
 
-void KdTree::printStatistics()
+void KdTree::printStatistics() const
 {
 	int maxDepth = 0;
 	int minDepth = std::numeric_limits<int>::max();
 	int numberOfNodes = 0;
-	int maxNumberTrianglesPerPoint = 0;
-	std::function<void(KdStructs::Node*, int)> printStatisticsRecursive;
-	printStatisticsRecursive = [&maxDepth, &minDepth, &numberOfNodes, &maxNumberTrianglesPerPoint, &printStatisticsRecursive](KdStructs::Node* node, int depth) {
-		if (node == nullptr)
+	int numberOfLeaves = 0;
+	int maxNumberTrianglesPerNode = 0;
+	// Expected cost of a random ray according to the surface area heuristic.
+	float traversalCost = 0;
+	float rootArea = bounds.surfaceArea();
+	std::function<void(unsigned int, int, const KdStructs::BoundingBox&)> printStatisticsRecursive;
+	printStatisticsRecursive = [&](unsigned int nodeIndex, int depth, const KdStructs::BoundingBox& nodeBounds) {
+		if (nodeIndex == KdStructs::NO_NODE)
 			return;
 
+		const KdStructs::Node& node = nodes[nodeIndex];
+		unsigned int triangleCount = nodeTriangleOffsets[nodeIndex + 1] - nodeTriangleOffsets[nodeIndex];
 		numberOfNodes++;
 		// Current depth higher than maxDepth -> new highest depth.
 		if (depth > maxDepth)
 			maxDepth = depth;
 
 		// If leaf node and smaller depth than minDepth -> new lowest depth.
-		if (node->left == nullptr && node->right == nullptr && depth < minDepth)
-			minDepth = depth;
+		if (node.isLeaf()) {
+			numberOfLeaves++;
+			if (depth < minDepth)
+				minDepth = depth;
+		}
 
-		if (node->point != nullptr && node->point->triangles.size() > maxNumberTrianglesPerPoint)
-			maxNumberTrianglesPerPoint = node->point->triangles.size();
+		if ((int)triangleCount > maxNumberTrianglesPerNode)
+			maxNumberTrianglesPerNode = triangleCount;
+
+		if (rootArea > 0)
+			traversalCost += nodeBounds.surfaceArea() / rootArea * ((node.isLeaf() ? 0 : TRAVERSAL_COST) + INTERSECTION_COST * triangleCount);
 
 		// Continue left and right recursively.
-		printStatisticsRecursive(node->left, depth + 1);
-		printStatisticsRecursive(node->right, depth + 1);
+		KdStructs::BoundingBox leftBounds = nodeBounds;
+		KdStructs::BoundingBox rightBounds = nodeBounds;
+		leftBounds.max[node.axis()] = node.split;
+		rightBounds.min[node.axis()] = node.split;
+		printStatisticsRecursive(node.left(nodeIndex), depth + 1, leftBounds);
+		printStatisticsRecursive(node.right(), depth + 1, rightBounds);
 	};
 
-	printStatisticsRecursive(root, 0);
+	if (!nodes.empty())
+		printStatisticsRecursive(0, 0, bounds);
+	std::cout << "Build mode: " << (buildMode == BuildMode::SAH ? "SAH" : "Median") << std::endl;
+	std::cout << "Number of triangles: " << triangles.size() << std::endl;
 	std::cout << "Max Depth: " << maxDepth << std::endl;
 	std::cout << "Min Depth: " << minDepth << std::endl;
-	std::cout << "Number of nodes: " << numberOfNodes << std::endl;
-	std::cout << "Max number of triangles per point: " << maxNumberTrianglesPerPoint << std::endl;
-}
+	std::cout << "Number of nodes: " << numberOfNodes << " (" << numberOfLeaves << " leaves)" << std::endl;
+	std::cout << "Max number of triangles per node: " << maxNumberTrianglesPerNode << std::endl;
+	MemoryReport memory = getMemoryReport();
+	std::cout << "Memory: " << memory.getTotal() << " bytes" << std::endl;
+	std::cout << "  Nodes: " << memory.nodes << " bytes (" << sizeof(KdStructs::Node) << " bytes per node + offsets)" << std::endl;
+	std::cout << "  Triangle indices: " << memory.triangleIndices << " bytes (" << triangleIndices.size() << " references)" << std::endl;
+	std::cout << "  Triangles: " << memory.triangles << " bytes" << std::endl;
+	std::cout << "  Triangle blocks: " << memory.triangleBlocks << " bytes (" << triangleBlocks.size() << " blocks, "
+		<< memory.blockLaneFill * 100 << "% lanes used, " << KdStructs::getSimdLevelName(simdLevel) << " kernel)" << std::endl;
+	std::cout << "  Point tree: " << memory.pointTree << " bytes (" << pointPositions.size() << " points)" << std::endl;
+	std::cout << "SAH traversal cost: " << traversalCost << std::endl;
+
+	if (nodes.empty())
+		return;
 
-std::vector<KdStructs::Point*> KdTree::getPointList(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount)
-{
-	std::vector<KdStructs::Point*> points;
-	points.resize(vertexCount, nullptr);
-	// Create points for each triangle and connect them (with a reference to the triangle).
-	for (int i = 0; i < indexCount; i += 3)
+	// Measure traversal speed with random rays starting inside the scene.
+	const int RAY_COUNT = 10000;
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	std::vector<KdStructs::Ray> rays;
+	rays.reserve(RAY_COUNT);
+	for (int i = 0; i < RAY_COUNT; i++)
 	{
-		// Get vertex indices, defining the current triangle
-		int vertexIndex1 = indices[i] * 3;
-		int vertexIndex2 = indices[i + 1] * 3;
-		int vertexIndex3 = indices[i + 2] * 3;
+		KdStructs::Vector origin;
+		KdStructs::Vector direction;
+		for (int axis = 0; axis < DIMENSIONS; axis++)
+		{
+			origin[axis] = bounds.min[axis] + distribution(random) * (bounds.max[axis] - bounds.min[axis]);
+			direction[axis] = distribution(random) * 2.0f - 1.0f;
+		}
+		rays.push_back(KdStructs::Ray(origin, direction * (1.0f / std::sqrt(direction.dot(direction))), 1000.0f));
+	}
 
-		// Convert vertexData to Vector.
-		KdStructs::Vector a = KdStructs::Vector(vertices[vertexIndex1], vertices[vertexIndex1 + 1], vertices[vertexIndex1 + 2]);
-		KdStructs::Vector b = KdStructs::Vector(vertices[vertexIndex2], vertices[vertexIndex2 + 1], vertices[vertexIndex2 + 2]);
-		KdStructs::Vector c = KdStructs::Vector(vertices[vertexIndex3], vertices[vertexIndex3 + 1], vertices[vertexIndex3 + 2]);
+	int hits = 0;
+	KdStructs::RayHit hit;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (const KdStructs::Ray& ray : rays)
+		hits += raycast(ray, hit) ? 1 : 0;
+	auto end = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+	std::cout << "Rays per second: " << (unsigned long long)(RAY_COUNT / seconds) << " (" << hits << "/" << RAY_COUNT << " hits)" << std::endl;
+}
 
-		KdStructs::Triangle* triangle = new KdStructs::Triangle(a, b, c);
-		//triangles.push_back(triangle);
+unsigned int KdTree::addTriangle(float* vertices, unsigned int vertexIndex1, unsigned int vertexIndex2, unsigned int vertexIndex3)
+{
+	vertexIndex1 *= 3;
+	vertexIndex2 *= 3;
+	vertexIndex3 *= 3;
+
+	// Convert vertexData to Vector.
+	KdStructs::Vector a = KdStructs::Vector(vertices[vertexIndex1], vertices[vertexIndex1 + 1], vertices[vertexIndex1 + 2]);
+	KdStructs::Vector b = KdStructs::Vector(vertices[vertexIndex2], vertices[vertexIndex2 + 1], vertices[vertexIndex2 + 2]);
+	KdStructs::Vector c = KdStructs::Vector(vertices[vertexIndex3], vertices[vertexIndex3 + 1], vertices[vertexIndex3 + 2]);
+
+	storage.triangles.push_back(KdStructs::Triangle(a, b, c));
+	bounds.extend(KdStructs::BoundingBox(storage.triangles.back()));
+	return storage.triangles.size() - 1;
+}
 
-		int pointIndex1 = vertexIndex1 / 3;
-		int pointIndex2 = vertexIndex2 / 3;
-		int pointIndex3 = vertexIndex3 / 3;
+void KdTree::addTriangles(float* vertices, unsigned int* indices, unsigned int indexCount)
+{
+	storage.triangles.reserve(indexCount / 3);
+	for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+		addTriangle(vertices, indices[i], indices[i + 1], indices[i + 2]);
+}
 
-		if (points[pointIndex1] != nullptr)
-			points[pointIndex1]->triangles.push_back(triangle);
-		else
-			points[pointIndex1] = new KdStructs::Point(a, triangle);
+void KdTree::addTriangles(float* vertices, unsigned int vertexCount)
+{
+	storage.triangles.reserve(vertexCount / 3);
+	for (unsigned int i = 0; i + 2 < vertexCount; i += 3)
+		addTriangle(vertices, i, i + 1, i + 2);
+}
 
-		if (points[pointIndex2] != nullptr)
-			points[pointIndex2]->triangles.push_back(triangle);
-		else
-			points[pointIndex2] = new KdStructs::Point(b, triangle);
+/// <summary>
+/// Creates the points of the triangle corners and connects them with their triangles.
+/// Corners with the same vertex index are one point, without indices corners at the same position are welded.
+/// </summary>
+std::vector<KdStructs::Point> KdTree::weldPoints(KdStructs::ArrayView<KdStructs::Triangle> cornerTriangles, const unsigned int* cornerVertices) const
+{
+	std::vector<KdStructs::Point> points;
+	if (cornerVertices != nullptr)
+	{
+		unsigned int vertexCount = 0;
+		for (size_t i = 0; i < cornerTriangles.size() * 3; i++)
+			vertexCount = std::max(vertexCount, cornerVertices[i] + 1);
+
+		std::vector<int> pointIndices(vertexCount, -1);
+		for (unsigned int triangle = 0; triangle < cornerTriangles.size(); triangle++)
+		{
+			const KdStructs::Triangle& corners = cornerTriangles[triangle];
+			const KdStructs::Vector* positions[3] = { &corners.a, &corners.b, &corners.c };
+
+			for (int j = 0; j < 3; j++)
+			{
+				int& pointIndex = pointIndices[cornerVertices[triangle * 3 + j]];
+				if (pointIndex != -1)
+					points[pointIndex].triangles.push_back(triangle);
+				else {
+					pointIndex = points.size();
+					points.push_back(KdStructs::Point(*positions[j], triangle));
+				}
+			}
+		}
+		return points;
+	}
 
-		if (points[pointIndex3] != nullptr)
-			points[pointIndex3]->triangles.push_back(triangle);
-		else
-			points[pointIndex3] = new KdStructs::Point(c, triangle);
+	PointGrid grid((size_t)cornerTriangles.size() * 3);
+	for (unsigned int triangle = 0; triangle < cornerTriangles.size(); triangle++)
+	{
+		KdStructs::Vector a = cornerTriangles[triangle].a;
+		KdStructs::Vector b = cornerTriangles[triangle].b;
+		KdStructs::Vector c = cornerTriangles[triangle].c;
+
+		for (const KdStructs::Vector& position : { a, b, c })
+		{
+			// Check if point is already in list (duplicate vertex).
+			int point = grid.find(position, points);
+			if (point != -1) {
+				// if in list, add triangle to point.
+				points[point].triangles.push_back(triangle);
+			}
+			else {
+				// If not in list, add it as a new point.
+				grid.add(position, points.size());
+				points.push_back(KdStructs::Point(position, triangle));
+			}
+		}
 	}
 	return points;
 }
 
-std::vector<KdStructs::Point*> KdTree::getPointList(float* vertices, unsigned int vertexCount) 
+void KdTree::buildMedian(std::vector<KdStructs::Point> points)
 {
-	std::vector<KdStructs::Point*> points;
-	// Create points for each triangle and connect them (with a reference to the triangle).
-	for (int i = 0; i < vertexCount; i += 3)
-	{
-		// Get vertex indices, defining the current triangle
-		int vertexIndex1 = i * 3;
-		int vertexIndex2 = (i + 1) * 3;
-		int vertexIndex3 = (i + 2) * 3;
+	BuildOutput output = createPointTree(points);
+	storage.nodes = std::move(output.nodes);
+	storage.nodeTriangleOffsets = std::move(output.triangleOffsets);
+	storage.triangleIndices = std::move(output.triangleIndices);
+	pointStorage.positions = std::move(output.positions);
+}
 
-		// Convert vertexData to Vector.
-		KdStructs::Vector a = KdStructs::Vector(vertices[vertexIndex1], vertices[vertexIndex1 + 1], vertices[vertexIndex1 + 2]);
-		KdStructs::Vector b = KdStructs::Vector(vertices[vertexIndex2], vertices[vertexIndex2 + 1], vertices[vertexIndex2 + 2]);
-		KdStructs::Vector c = KdStructs::Vector(vertices[vertexIndex3], vertices[vertexIndex3 + 1], vertices[vertexIndex3 + 2]);
+/// <summary>
+/// Median tree over the points, the tree of median builds and the point tree of SAH trees.
+/// </summary>
+KdTree::BuildOutput KdTree::createPointTree(const std::vector<KdStructs::Point>& points) const
+{
+	BuildOutput output;
+	if (points.empty())
+		return output;
 
-		KdStructs::Triangle* triangle = new KdStructs::Triangle(a, b, c);
-		//triangles.push_back(triangle);
+	// Every point becomes exactly one node, every point references its triangles once.
+	size_t triangleReferences = 0;
+	for (const KdStructs::Point& point : points)
+		triangleReferences += point.triangles.size();
 
-		// Check if point is already in list (duplicate vertex).
-		// For a.
-		KdStructs::Point* point = findPoint(KdStructs::Point(a), points);
-		if (point != nullptr) {
-			// if in list, add triangle to point.
-			point->triangles.push_back(triangle);
-		}
-		else {
-			// If not in list, add it as a new point.
-			points.push_back(new KdStructs::Point(a, triangle));
-		}
-		// For b.
-		point = findPoint(KdStructs::Point(b), points);
-		if (point != nullptr)
-			point->triangles.push_back(triangle);
-		else
-			points.push_back(new KdStructs::Point(b, triangle));
-		// For c.
-		point = findPoint(KdStructs::Point(c), points);
-		if (point != nullptr)
-			point->triangles.push_back(triangle);
-		else
-			points.push_back(new KdStructs::Point(c, triangle));
-	}
-	return points;
+	output.nodes.reserve(points.size());
+	output.triangleOffsets.reserve(points.size() + 1);
+	output.triangleIndices.reserve(triangleReferences);
+	output.positions.reserve(points.size());
+
+	std::vector<unsigned int> pointIndices(points.size());
+	for (unsigned int i = 0; i < pointIndices.size(); i++)
+		pointIndices[i] = i;
+
+	createKdTree(points, pointIndices, 0, pointIndices.size(), output);
+	output.triangleOffsets.push_back(output.triangleIndices.size());
+	return output;
 }
 
+/// <summary>
+/// SAH trees only need the welded points for the point queries, so their point tree is built by the first one.
+/// Safe to call from concurrent queries, the others wait for the build.
+/// </summary>
+void KdTree::buildPendingPointTree() const
+{
+	std::call_once(pointTreeBuilt, [this]() {
+		if (!pointTreePending)
+			return;
 
-KdStructs::Node* KdTree::createKdTree(std::vector<KdStructs::Point*> points, int depth, KdStructs::Vector max, KdStructs::Vector min)
+		const unsigned int* cornerVertices = pointStorage.cornerVertices.empty() ? nullptr : pointStorage.cornerVertices.data();
+		BuildOutput output = createPointTree(weldPoints(triangles, cornerVertices));
+		pointStorage.nodes = std::move(output.nodes);
+		pointStorage.triangleOffsets = std::move(output.triangleOffsets);
+		pointStorage.triangleIndices = std::move(output.triangleIndices);
+		pointStorage.positions = std::move(output.positions);
+		pointStorage.cornerVertices = std::vector<unsigned int>();
+
+		pointPositions = pointStorage.positions;
+		pointNodes = pointStorage.nodes;
+		pointTriangleOffsets = pointStorage.triangleOffsets;
+		pointTriangleIndices = pointStorage.triangleIndices;
+	});
+}
+
+/// <summary>
+/// Builds the subtree for the points [begin, end) depth-first into the output.
+/// Returns the index of the created node.
+/// </summary>
+unsigned int KdTree::createKdTree(const std::vector<KdStructs::Point>& points, std::vector<unsigned int>& pointIndices, size_t begin, size_t end, BuildOutput& output) const
 {
 	// If reached leaf, stop
-	if (points.empty())
-		return nullptr;
+	if (begin == end)
+		return KdStructs::NO_NODE;
 
-	// If only one point left, just add it.
-	if (points.size() == 1)
-		return new KdStructs::Node(points[0], nullptr, nullptr, 0, max, min);
+	unsigned int nodeIndex = output.nodes.size();
+	output.nodes.push_back(KdStructs::Node());
+	output.positions.push_back(KdStructs::Vector());
+	// The node's triangles are added before any child is created.
+	output.triangleOffsets.push_back(output.triangleIndices.size());
 
 	// Get widest axis
 	float maxAxisWidth = 0;
 	int axis = 0;
 
 	// Go through each axis and determine biggest extend.
-	for (int currentAxis = 0; currentAxis < DIMENSIONS; currentAxis++)
+	KdStructs::BoundingBox pointBounds;
+	if (threadPool != nullptr && end - begin >= PARALLEL_BUILD_THRESHOLD)
 	{
-		auto comparator = getComparatorForAxis(currentAxis);
-
-		KdStructs::Point* min = *std::min_element(points.begin(), points.end(), comparator);
-		KdStructs::Point* max = *std::max_element(points.begin(), points.end(), comparator);
+		// Parallel reduction, chunks are merged in order.
+		size_t chunkCount = (end - begin + PARALLEL_BUILD_THRESHOLD - 1) / PARALLEL_BUILD_THRESHOLD;
+		std::vector<KdStructs::BoundingBox> chunkBounds(chunkCount);
+		threadPool->ParallelFor(end - begin, PARALLEL_BUILD_THRESHOLD, [&](size_t chunkBegin, size_t chunkEnd) {
+			KdStructs::BoundingBox& chunk = chunkBounds[chunkBegin / PARALLEL_BUILD_THRESHOLD];
+			for (size_t i = begin + chunkBegin; i < begin + chunkEnd; i++)
+				chunk.extend(points[pointIndices[i]].pos);
+		});
+		for (const KdStructs::BoundingBox& chunk : chunkBounds)
+			pointBounds.extend(chunk);
+	}
+	else
+	{
+		for (size_t i = begin; i < end; i++)
+			pointBounds.extend(points[pointIndices[i]].pos);
+	}
 
-		float axisWidth = max->pos[currentAxis] - min->pos[currentAxis];
+	for (int currentAxis = 0; currentAxis < DIMENSIONS; currentAxis++)
+	{
+		float axisWidth = pointBounds.max[currentAxis] - pointBounds.min[currentAxis];
 
 		if (axisWidth > maxAxisWidth) {
 			maxAxisWidth = axisWidth;
@@ -241,134 +980,799 @@ KdStructs::Node* KdTree::createKdTree(std::vector<KdStructs::Point*> points, int
 	}
 
 	// Get median point (and sort by median).
-	int medianIndex = points.size() / 2;
-	std::nth_element(points.begin(), points.begin() + medianIndex, points.end(), getComparatorForAxis(axis));
-	KdStructs::Point* medianPoint = points[medianIndex];
+	size_t medianIndex = begin + (end - begin) / 2;
+	std::nth_element(pointIndices.begin() + begin, pointIndices.begin() + medianIndex, pointIndices.begin() + end, getComparatorForAxis(points, axis));
+	const KdStructs::Point& medianPoint = points[pointIndices[medianIndex]];
+
+	// Store the triangles of the median point with the node.
+	output.nodes[nodeIndex].split = medianPoint.pos[axis];
+	output.nodes[nodeIndex].setAxis(axis);
+	output.triangleIndices.insert(output.triangleIndices.end(), medianPoint.triangles.begin(), medianPoint.triangles.end());
+	output.positions[nodeIndex] = medianPoint.pos;
+
+	// Recursively go down each branch, skipping the median point.
+	// The left subtree directly follows this node.
+	if (threadPool != nullptr && end - begin >= PARALLEL_BUILD_THRESHOLD)
+	{
+		// Both halves only touch their own part of pointIndices.
+		BuildOutput leftOutput;
+		BuildOutput rightOutput;
+		ThreadPool::TaskGroup group;
+		threadPool->Run(group, [&]() { createKdTree(points, pointIndices, begin, medianIndex, leftOutput); });
+		createKdTree(points, pointIndices, medianIndex + 1, end, rightOutput);
+		threadPool->Wait(group);
+
+		if (appendSubtree(output, leftOutput) != KdStructs::NO_NODE)
+			output.nodes[nodeIndex].setLeft();
+
+		unsigned int right = appendSubtree(output, rightOutput);
+		if (right != KdStructs::NO_NODE)
+			output.nodes[nodeIndex].setRight(right);
+
+		return nodeIndex;
+	}
+
+	if (createKdTree(points, pointIndices, begin, medianIndex, output) != KdStructs::NO_NODE)
+		output.nodes[nodeIndex].setLeft();
 
-	std::vector<KdStructs::Point*> leftPoints(points.begin(), points.begin() + medianIndex);
-	// Remove median point from list by skipping it.
-	std::vector<KdStructs::Point*> rightPoints(points.begin() + medianIndex + 1, points.end());
+	unsigned int right = createKdTree(points, pointIndices, medianIndex + 1, end, output);
+	if (right != KdStructs::NO_NODE)
+		output.nodes[nodeIndex].setRight(right);
 
-	// Set max and min values for the splitting plane
-	KdStructs::Vector newMax = KdStructs::Vector(max);
-	KdStructs::Vector newMin = KdStructs::Vector(min);
-	newMax[axis] = medianPoint->pos[axis];
-	newMin[axis] = medianPoint->pos[axis];
+	return nodeIndex;
+}
 
-	// Recursively go down each branch.
-	KdStructs::Node* left = createKdTree(leftPoints, depth + 1, newMax, min);
-	KdStructs::Node* right = createKdTree(rightPoints, depth + 1, max, newMin);
+void KdTree::buildSah()
+{
+	if (storage.triangles.empty())
+		return;
 
-	return new KdStructs::Node(medianPoint, left, right, axis, max, min);
+	std::vector<KdStructs::BoundingBox> triangleBounds(storage.triangles.size());
+	auto computeBounds = [this, &triangleBounds](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			triangleBounds[i] = KdStructs::BoundingBox(storage.triangles[i]);
+	};
+	if (threadPool != nullptr)
+		threadPool->ParallelFor(storage.triangles.size(), PARALLEL_BUILD_THRESHOLD, computeBounds);
+	else
+		computeBounds(0, storage.triangles.size());
+
+	std::vector<unsigned int> triangleList(storage.triangles.size());
+	for (unsigned int i = 0; i < triangleList.size(); i++)
+		triangleList[i] = i;
+
+	int maxDepth = std::min(MAX_SAH_DEPTH, (int)std::round(8 + 1.3f * std::log2((float)storage.triangles.size())));
+	BuildOutput output;
+	createSahTree(triangleBounds, triangleList, bounds, maxDepth, 0, output);
+	output.triangleOffsets.push_back(output.triangleIndices.size());
+
+	storage.nodes = std::move(output.nodes);
+	storage.nodeTriangleOffsets = std::move(output.triangleOffsets);
+	storage.triangleIndices = std::move(output.triangleIndices);
 }
 
 /// <summary>
-/// 1. Check current node
-/// 2. Check near node first
-/// Skip far node if:
-/// - Non parallel ray (would never intersect far plane)
-/// - Distance from ray to splitting plane smaller 0 -> far plane behind us
-/// - Distance greater than maxDistance
-/// - Distance greater than current intersection
-/// 3. Check far node
+/// Builds the subtree for the given triangles depth-first into the output.
+/// Triangles overlapping both sides of a splitting plane are referenced by both children.
+/// Returns the index of the created node.
 /// </summary>
-void KdTree::findIntersection(KdStructs::Node* node, KdStructs::Ray ray, KdStructs::RayHit*& hit)
+unsigned int KdTree::createSahTree(const std::vector<KdStructs::BoundingBox>& triangleBounds, std::vector<unsigned int>& triangleList, const KdStructs::BoundingBox& bounds, int depth, int badRefines, BuildOutput& output)
 {
-	// No node, no triangle to intersect.
-	if (node == nullptr)
-		return;
+	unsigned int nodeIndex = output.nodes.size();
+	output.nodes.push_back(KdStructs::Node());
+	// Leaves add their triangles right away, inner nodes have none.
+	output.triangleOffsets.push_back(output.triangleIndices.size());
 
+	SahSplit split;
+	if (triangleList.size() > MAX_LEAF_TRIANGLES && depth > 0)
+		split = findSahSplit(triangleBounds, triangleList, bounds);
 
-	// Check current node.
-	for (KdStructs::Triangle* triangle : node->point->triangles) {
-		if (triangle->checkCache == this->checkCache)
-			continue;
-		else
-			triangle->checkCache = this->checkCache;
+	// Allow a few splits that are worse than a leaf, they often lead to better splits further down.
+	float leafCost = INTERSECTION_COST * triangleList.size();
+	if (split.cost > leafCost)
+		badRefines++;
+
+	if (split.axis == -1 || (split.cost > 4 * leafCost && triangleList.size() < 16) || badRefines >= 3)
+	{
+		output.triangleIndices.insert(output.triangleIndices.end(), triangleList.begin(), triangleList.end());
+		return nodeIndex;
+	}
+
+	// Sort triangles to the sides they overlap.
+	std::vector<unsigned int> leftTriangles;
+	std::vector<unsigned int> rightTriangles;
+	for (unsigned int triangle : triangleList)
+	{
+		KdStructs::BoundingBox clipped = triangleBounds[triangle].clip(bounds);
+		// Triangles lying in the splitting plane go to the left.
+		if (clipped.min[split.axis] < split.position || clipped.max[split.axis] <= split.position)
+			leftTriangles.push_back(triangle);
+		if (clipped.max[split.axis] > split.position)
+			rightTriangles.push_back(triangle);
+	}
+	// Not needed anymore, free memory before going down.
+	size_t triangleCount = triangleList.size();
+	std::vector<unsigned int>().swap(triangleList);
+
+	KdStructs::BoundingBox leftBounds = bounds;
+	KdStructs::BoundingBox rightBounds = bounds;
+	leftBounds.max[split.axis] = split.position;
+	rightBounds.min[split.axis] = split.position;
+
+	output.nodes[nodeIndex].split = split.position;
+	output.nodes[nodeIndex].setAxis(split.axis);
+	output.nodes[nodeIndex].setLeft();
+
+	if (threadPool != nullptr && triangleCount >= PARALLEL_BUILD_THRESHOLD)
+	{
+		// Build both subtrees separately and copy them behind this node afterwards,
+		// which results in exactly the same layout as the serial build.
+		BuildOutput leftOutput;
+		BuildOutput rightOutput;
+		ThreadPool::TaskGroup group;
+		threadPool->Run(group, [&]() { createSahTree(triangleBounds, leftTriangles, leftBounds, depth - 1, badRefines, leftOutput); });
+		createSahTree(triangleBounds, rightTriangles, rightBounds, depth - 1, badRefines, rightOutput);
+		threadPool->Wait(group);
+
+		appendSubtree(output, leftOutput);
+		unsigned int right = appendSubtree(output, rightOutput);
+		output.nodes[nodeIndex].setRight(right);
+		return nodeIndex;
+	}
+
+	createSahTree(triangleBounds, leftTriangles, leftBounds, depth - 1, badRefines, output);
+	unsigned int right = createSahTree(triangleBounds, rightTriangles, rightBounds, depth - 1, badRefines, output);
+	output.nodes[nodeIndex].setRight(right);
 
-		float distance = rayIntersectionWithTriangle(triangle, ray);
-		if (distance < 0)
+	return nodeIndex;
+}
+
+/// <summary>
+/// Evaluates SAH_BINS - 1 equally spaced candidate planes per axis.
+/// Triangle bounds are clipped to the node and counted in the bins of their min and max,
+/// so the number of triangles left and right of each plane follows from a single sweep.
+/// </summary>
+KdTree::SahSplit KdTree::findSahSplit(const std::vector<KdStructs::BoundingBox>& triangleBounds, const std::vector<unsigned int>& triangleList, const KdStructs::BoundingBox& bounds) const
+{
+	SahSplit bestSplit;
+	float area = bounds.surfaceArea();
+	if (area <= 0)
+		return bestSplit;
+
+	// Bin counts of all axes (min and max bins).
+	struct Bins
+	{
+		unsigned int minBins[DIMENSIONS][SAH_BINS] = {};
+		unsigned int maxBins[DIMENSIONS][SAH_BINS] = {};
+	};
+
+	auto fillBins = [&triangleBounds, &triangleList, &bounds](size_t begin, size_t end, Bins& bins) {
+		for (size_t i = begin; i < end; i++)
+		{
+			KdStructs::BoundingBox clipped = triangleBounds[triangleList[i]].clip(bounds);
+			for (int axis = 0; axis < DIMENSIONS; axis++)
+			{
+				float width = bounds.max[axis] - bounds.min[axis];
+				if (width <= 0)
+					continue;
+
+				float binsPerUnit = SAH_BINS / width;
+				int minBin = std::min(SAH_BINS - 1, std::max(0, (int)((clipped.min[axis] - bounds.min[axis]) * binsPerUnit)));
+				int maxBin = std::min(SAH_BINS - 1, std::max(0, (int)((clipped.max[axis] - bounds.min[axis]) * binsPerUnit)));
+				bins.minBins[axis][minBin]++;
+				bins.maxBins[axis][maxBin]++;
+			}
+		}
+	};
+
+	Bins bins;
+	if (threadPool != nullptr && triangleList.size() >= PARALLEL_BUILD_THRESHOLD)
+	{
+		// Parallel reduction, counts are summed up afterwards.
+		std::vector<Bins> chunkBins((triangleList.size() + PARALLEL_BUILD_THRESHOLD - 1) / PARALLEL_BUILD_THRESHOLD);
+		threadPool->ParallelFor(triangleList.size(), PARALLEL_BUILD_THRESHOLD, [&](size_t begin, size_t end) {
+			fillBins(begin, end, chunkBins[begin / PARALLEL_BUILD_THRESHOLD]);
+		});
+		for (const Bins& chunk : chunkBins)
+			for (int axis = 0; axis < DIMENSIONS; axis++)
+				for (int bin = 0; bin < SAH_BINS; bin++)
+				{
+					bins.minBins[axis][bin] += chunk.minBins[axis][bin];
+					bins.maxBins[axis][bin] += chunk.maxBins[axis][bin];
+				}
+	}
+	else
+		fillBins(0, triangleList.size(), bins);
+
+	for (int axis = 0; axis < DIMENSIONS; axis++)
+	{
+		float width = bounds.max[axis] - bounds.min[axis];
+		if (width <= 0)
 			continue;
 
-		KdStructs::Vector position = ray.origin + ray.direction * distance;
-		if (hit == nullptr)
-			hit = new KdStructs::RayHit(triangle, position, distance);
-		else if (distance <= hit->distance) {
-			hit->triangle = triangle;
-			hit->position = position;
-			hit->distance = distance;
+		// Sweep over the planes between the bins.
+		unsigned int leftCount = 0;
+		unsigned int rightCount = triangleList.size();
+		for (int bin = 1; bin < SAH_BINS; bin++)
+		{
+			leftCount += bins.minBins[axis][bin - 1];
+			rightCount -= bins.maxBins[axis][bin - 1];
+
+			float position = bounds.min[axis] + bin * width / SAH_BINS;
+			KdStructs::BoundingBox leftBounds = bounds;
+			KdStructs::BoundingBox rightBounds = bounds;
+			leftBounds.max[axis] = position;
+			rightBounds.min[axis] = position;
+
+			float cost = TRAVERSAL_COST + INTERSECTION_COST * (leftBounds.surfaceArea() * leftCount + rightBounds.surfaceArea() * rightCount) / area;
+			if (leftCount == 0 || rightCount == 0)
+				cost *= 1.0f - EMPTY_BONUS;
+
+			if (cost < bestSplit.cost)
+			{
+				bestSplit.axis = axis;
+				bestSplit.position = position;
+				bestSplit.cost = cost;
+			}
 		}
 	}
 
+	return bestSplit;
+}
 
-	int axis = node->axis;
+/// <summary>
+/// Copies a separately built subtree to the end of the output and relocates its indices.
+/// Returns the new index of the subtree's root.
+/// </summary>
+unsigned int KdTree::appendSubtree(BuildOutput& output, const BuildOutput& subtree)
+{
+	if (subtree.nodes.empty())
+		return KdStructs::NO_NODE;
 
-	// Get near and far nodes depending on ray's origin (Before or after splitting plane?).
-	KdStructs::Node* near = ray.origin[axis] > node->point->pos[axis] ? node->right : node->left;
-	KdStructs::Node* far = near == node->right ? node->left : node->right;
+	unsigned int nodeOffset = output.nodes.size();
+	unsigned int triangleOffset = output.triangleIndices.size();
+	for (KdStructs::Node node : subtree.nodes)
+	{
+		if (node.right() != KdStructs::NO_NODE)
+			node.setRight(node.right() + nodeOffset);
+		output.nodes.push_back(node);
+	}
+	for (unsigned int offset : subtree.triangleOffsets)
+		output.triangleOffsets.push_back(offset + triangleOffset);
+	output.triangleIndices.insert(output.triangleIndices.end(), subtree.triangleIndices.begin(), subtree.triangleIndices.end());
+	output.positions.insert(output.positions.end(), subtree.positions.begin(), subtree.positions.end());
+	return nodeOffset;
+}
 
+/// <summary>
+/// Copies the triangles of every node into SIMD blocks, stored in node order.
+/// </summary>
+void KdTree::buildTriangleBlocks()
+{
+	simdLevel = KdStructs::detectSimdLevel();
+	setTriangleTest(triangleTest);
 
-	// If our direction is parallel to the axis, only visit near
-	if (ray.direction[axis] == 0.0f) {
-		findIntersection(near, ray, hit);
+	storage.blockOffsets.resize(storage.nodes.size() + 1);
+	for (unsigned int nodeIndex = 0; nodeIndex < storage.nodes.size(); nodeIndex++)
+	{
+		unsigned int triangleOffset = storage.nodeTriangleOffsets[nodeIndex];
+		storage.blockOffsets[nodeIndex] = storage.triangleBlocks.size();
+		KdStructs::appendTriangleBlocks(storage.triangles, storage.triangleIndices.data() + triangleOffset,
+			storage.nodeTriangleOffsets[nodeIndex + 1] - triangleOffset, storage.triangleBlocks);
 	}
-	else {
-		// Distance from ray to splitting plane.
-		float t = (node->point->pos[axis] - ray.origin[axis]) / ray.direction[axis];
+	storage.blockOffsets[storage.nodes.size()] = storage.triangleBlocks.size();
+}
+
+void KdTree::updateViews()
+{
+	nodes = storage.nodes;
+	nodeTriangleOffsets = storage.nodeTriangleOffsets;
+	triangleIndices = storage.triangleIndices;
+	triangles = storage.triangles;
+	triangleBlocks = storage.triangleBlocks;
+	blockOffsets = storage.blockOffsets;
+
+	// Median trees are the point tree themselves, SAH trees build theirs on the first point query.
+	if (buildMode == BuildMode::MEDIAN) {
+		pointPositions = pointStorage.positions;
+		pointNodes = nodes;
+		pointTriangleOffsets = nodeTriangleOffsets;
+		pointTriangleIndices = triangleIndices;
+	}
+}
+
+/// <summary>
+/// Traverses the tree front to back along the ray segment [tMin, tMax] without recursion.
+/// 1. Check current node
+/// 2. Continue with the near node (side the ray enters first) and the part of the segment in front of the splitting plane
+/// 3. Push the far node with the part behind the splitting plane, it is visited when the near subtree is done
+/// Skip near/far node if (see visitSplit, planes within a small tolerance of the segment count as crossed):
+/// - Ray is parallel to the splitting plane (never reaches far node, unless the origin lies in the plane)
+/// - Splitting plane is behind the segment's start (segment lies only in far node)
+/// - Splitting plane is after the segment's end (segment lies only in near node)
+/// - Splitting plane is further away than the current intersection (far node)
+/// Far nodes further down the stack start even later, so the traversal ends with the first one behind the hit.
+/// </summary>
+template <typename Stats>
+void KdTree::findIntersection(const KdStructs::Ray& ray, float tMin, float tMax, KdStructs::RayHit& hit, Stats& stats) const
+{
+	struct StackEntry
+	{
+		unsigned int node;
+		float tMin;
+		float tMax;
+	};
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	unsigned int nodeIndex = 0;
+
+	while (true)
+	{
+		// No node, no triangle to intersect.
+		while (nodeIndex != KdStructs::NO_NODE)
+		{
+			const KdStructs::Node& node = nodes[nodeIndex];
+			stats.visitNode();
+			stats.testTriangles(nodeTriangleOffsets[nodeIndex + 1] - nodeTriangleOffsets[nodeIndex]);
+
+			// Check current node.
+			unsigned int blockOffset = blockOffsets[nodeIndex];
+			unsigned int triangle = intersectBlocks(triangleBlocks.data() + blockOffset, blockOffsets[nodeIndex + 1] - blockOffset, ray, hit.distance);
+			if (triangle != KdStructs::NO_TRIANGLE)
+				hit.triangle = &triangles[triangle];
+
+			if (node.isLeaf())
+				break;
+
+			int axis = node.axis();
+
+			// Triangles of the median tree are stored with their points and can reach outside of the node's cell,
+			// so the segment is never narrowed, the node of the ray's origin is always visited
+			// and the other one only if the plane lies between the origin and the current hit.
+			if (buildMode == BuildMode::MEDIAN) {
+				bool originRight = ray.origin[axis] > node.split || (ray.origin[axis] == node.split && ray.direction[axis] < 0);
+				unsigned int near = originRight ? node.right() : node.left(nodeIndex);
+				unsigned int far = originRight ? node.left(nodeIndex) : node.right();
+				SplitVisit visit = visitSplit(ray, axis, node.split, 0.0f, hit.distance);
+				if (visit.near && visit.far) {
+					if (far != KdStructs::NO_NODE) {
+						assert(stackSize < TRAVERSAL_STACK_SIZE);
+						stack[stackSize++] = { far, tMin, tMax };
+					}
+				}
+				else if (visit.nearIsRight == originRight && ray.direction[axis] != 0.0f)
+					stats.skipFarChild();
+				nodeIndex = near;
+				continue;
+			}
+
+			// Get near and far nodes depending on the ray's direction (which side does it enter first?).
+			SplitVisit visit = visitSplit(ray, axis, node.split, tMin, tMax);
+			unsigned int near = visit.nearIsRight ? node.right() : node.left(nodeIndex);
+			unsigned int far = visit.nearIsRight ? node.left(nodeIndex) : node.right();
+			if (!visit.far)
+				nodeIndex = near;
+			else if (!visit.near) {
+				nodeIndex = far;
+				tMin = visit.farMin;
+			}
+			else {
+				if (far != KdStructs::NO_NODE) {
+					assert(stackSize < TRAVERSAL_STACK_SIZE);
+					stack[stackSize++] = { far, visit.farMin, tMax };
+				}
+				nodeIndex = near;
+				tMax = visit.nearMax;
+			}
+		}
 
-		KdStructs::Ray newRay = KdStructs::Ray(ray.origin, ray.direction, hit != nullptr ? hit->distance : ray.distance);
-		// Only check far node if intersection is possible (ray can reach it).
-		// Also skip if current hit is smaller than splitting plane distance.
-		if (0 <= t && t < ray.distance && (hit == nullptr || hit->distance > t)) {
-			findIntersection(near, newRay, hit);
-			findIntersection(far, newRay, hit);
+		if (stackSize == 0)
+			return;
+
+		StackEntry entry = stack[--stackSize];
+		// Skip if current hit is smaller than splitting plane distance.
+		if (buildMode == BuildMode::SAH && hit.distance < entry.tMin - traversalTolerance(entry.tMin)) {
+			stats.skipFarChild();
+			stats.terminateEarly();
+			return;
 		}
-		else {
-			findIntersection(near, newRay, hit);
+		nodeIndex = entry.node;
+		tMin = entry.tMin;
+		tMax = entry.tMax;
+	}
+}
+
+/// <summary>
+/// Same traversal as findIntersection, but returns as soon as any triangle closer than maxDistance is hit.
+/// </summary>
+template <typename Stats>
+bool KdTree::findOcclusion(const KdStructs::Ray& ray, float tMin, float tMax, float maxDistance, Stats& stats) const
+{
+	struct StackEntry
+	{
+		unsigned int node;
+		float tMin;
+		float tMax;
+	};
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	unsigned int nodeIndex = 0;
+
+	while (true)
+	{
+		while (nodeIndex != KdStructs::NO_NODE)
+		{
+			const KdStructs::Node& node = nodes[nodeIndex];
+			stats.visitNode();
+			stats.testTriangles(nodeTriangleOffsets[nodeIndex + 1] - nodeTriangleOffsets[nodeIndex]);
+
+			unsigned int blockOffset = blockOffsets[nodeIndex];
+			if (occludedBlocks(triangleBlocks.data() + blockOffset, blockOffsets[nodeIndex + 1] - blockOffset, ray, maxDistance)) {
+				stats.terminateEarly();
+				return true;
+			}
+
+			if (node.isLeaf())
+				break;
+
+			int axis = node.axis();
+			if (buildMode == BuildMode::MEDIAN) {
+				bool originRight = ray.origin[axis] > node.split || (ray.origin[axis] == node.split && ray.direction[axis] < 0);
+				unsigned int near = originRight ? node.right() : node.left(nodeIndex);
+				unsigned int far = originRight ? node.left(nodeIndex) : node.right();
+				SplitVisit visit = visitSplit(ray, axis, node.split, 0.0f, maxDistance);
+				if (visit.near && visit.far && far != KdStructs::NO_NODE) {
+					assert(stackSize < TRAVERSAL_STACK_SIZE);
+					stack[stackSize++] = { far, tMin, tMax };
+				}
+				nodeIndex = near;
+				continue;
+			}
+
+			SplitVisit visit = visitSplit(ray, axis, node.split, tMin, tMax);
+			unsigned int near = visit.nearIsRight ? node.right() : node.left(nodeIndex);
+			unsigned int far = visit.nearIsRight ? node.left(nodeIndex) : node.right();
+			if (!visit.far)
+				nodeIndex = near;
+			else if (!visit.near) {
+				nodeIndex = far;
+				tMin = visit.farMin;
+			}
+			else {
+				if (far != KdStructs::NO_NODE) {
+					assert(stackSize < TRAVERSAL_STACK_SIZE);
+					stack[stackSize++] = { far, visit.farMin, tMax };
+				}
+				nodeIndex = near;
+				tMax = visit.nearMax;
+			}
 		}
+
+		if (stackSize == 0)
+			return false;
+
+		StackEntry entry = stack[--stackSize];
+		nodeIndex = entry.node;
+		tMin = entry.tMin;
+		tMax = entry.tMax;
+	}
+}
+
+/// <summary>
+/// Checks the node's point, then the side of the splitting plane containing the position.
+/// The other side is only checked if the plane is not farther away than the k-th closest point found so far.
+/// </summary>
+void KdTree::findNearest(unsigned int nodeIndex, const KdStructs::Vector& position, unsigned int k, std::vector<KdStructs::PointHit>& results) const
+{
+	const KdStructs::Node& node = pointNodes[nodeIndex];
+
+	KdStructs::Vector offset = pointPositions[nodeIndex] - position;
+	KdStructs::PointHit hit = KdStructs::PointHit(nodeIndex, offset.dot(offset));
+	if (results.size() < k) {
+		results.push_back(hit);
+		std::push_heap(results.begin(), results.end());
+	}
+	else if (hit < results.front()) {
+		std::pop_heap(results.begin(), results.end());
+		results.back() = hit;
+		std::push_heap(results.begin(), results.end());
+	}
+
+	// Points on the left are <= split, points on the right >= split.
+	float planeDistance = position[node.axis()] - node.split;
+	unsigned int nearNode = planeDistance < 0 ? node.left(nodeIndex) : node.right();
+	unsigned int farNode = planeDistance < 0 ? node.right() : node.left(nodeIndex);
+
+	if (nearNode != KdStructs::NO_NODE)
+		findNearest(nearNode, position, k, results);
+	if (farNode != KdStructs::NO_NODE && (results.size() < k || planeDistance * planeDistance <= results.front().distanceSquared))
+		findNearest(farNode, position, k, results);
+}
+
+void KdTree::findWithinRadius(unsigned int nodeIndex, const KdStructs::Vector& position, float radiusSquared, std::vector<KdStructs::PointHit>& results) const
+{
+	const KdStructs::Node& node = pointNodes[nodeIndex];
+
+	KdStructs::Vector offset = pointPositions[nodeIndex] - position;
+	float distanceSquared = offset.dot(offset);
+	if (distanceSquared <= radiusSquared)
+		results.push_back(KdStructs::PointHit(nodeIndex, distanceSquared));
+
+	// Only visit the sides the sphere reaches into.
+	float planeDistance = position[node.axis()] - node.split;
+	bool reachesOtherSide = planeDistance * planeDistance <= radiusSquared;
+	unsigned int left = node.left(nodeIndex);
+	unsigned int right = node.right();
+	if (left != KdStructs::NO_NODE && (planeDistance < 0 || reachesOtherSide))
+		findWithinRadius(left, position, radiusSquared, results);
+	if (right != KdStructs::NO_NODE && (planeDistance >= 0 || reachesOtherSide))
+		findWithinRadius(right, position, radiusSquared, results);
+}
+
+namespace {
+	// Region tests of queryAABB and queryFrustum.
+	bool isInRegion(const KdStructs::BoundingBox& box, const KdStructs::Triangle& triangle) { return box.overlaps(KdStructs::BoundingBox(triangle)); }
+	bool isInRegion(const KdStructs::Frustum& frustum, const KdStructs::Triangle& triangle) { return frustum.intersects(triangle); }
+	// The plane mask is only used by frustums, see KdStructs::Frustum::classify.
+	KdStructs::Overlap classifyCell(const KdStructs::BoundingBox& box, const KdStructs::BoundingBox& cell, unsigned int&)
+	{
+		if (!box.overlaps(cell))
+			return KdStructs::Overlap::OUTSIDE;
+		return box.contains(cell) ? KdStructs::Overlap::INSIDE : KdStructs::Overlap::PARTIAL;
+	}
+	KdStructs::Overlap classifyCell(const KdStructs::Frustum& frustum, const KdStructs::BoundingBox& cell, unsigned int& planeMask)
+	{
+		return frustum.classify(cell, planeMask);
+	}
+}
+
+/// <summary>
+/// Collects the triangles in the region, sorted by index and without duplicates.
+/// Median trees store the triangles with their points, the triangles reach out of the nodes' cells,
+/// so the cells can't be used to skip them and all triangles are tested.
+/// </summary>
+template <typename Region>
+unsigned int KdTree::findInRegion(const Region& region, std::vector<unsigned int>& results) const
+{
+	results.clear();
+	if (nodes.empty())
+		return 0;
+
+	if (buildMode == BuildMode::MEDIAN)
+	{
+		for (unsigned int triangle = 0; triangle < triangles.size(); triangle++)
+			if (isInRegion(region, triangles[triangle]))
+				results.push_back(triangle);
+		return results.size();
+	}
+
+	findInRegion(0, bounds, KdStructs::Frustum::ALL_PLANES, region, results);
+	// Triangles overlapping several leaves were found once per leaf.
+	std::sort(results.begin(), results.end());
+	results.erase(std::unique(results.begin(), results.end()), results.end());
+	return results.size();
+}
+
+/// <summary>
+/// Visits the SAH subtree if its cell touches the region, leaves reference every triangle whose bounds overlap their cell.
+/// Cells completely inside the region take all their triangles without testing them (for frustums this keeps
+/// triangles whose bounds reach into the frustum, which is still conservative).
+/// </summary>
+template <typename Region>
+void KdTree::findInRegion(unsigned int nodeIndex, const KdStructs::BoundingBox& cell, unsigned int planeMask, const Region& region, std::vector<unsigned int>& results) const
+{
+	KdStructs::Overlap overlap = classifyCell(region, cell, planeMask);
+	if (overlap == KdStructs::Overlap::OUTSIDE)
+		return;
+
+	if (overlap == KdStructs::Overlap::INSIDE)
+	{
+		// Subtrees are stored contiguously in depth-first order, the last node is the end of the rightmost path.
+		unsigned int lastNode = nodeIndex;
+		while (!nodes[lastNode].isLeaf())
+			lastNode = nodes[lastNode].right() != KdStructs::NO_NODE ? nodes[lastNode].right() : lastNode + 1;
+		results.insert(results.end(), triangleIndices.begin() + nodeTriangleOffsets[nodeIndex], triangleIndices.begin() + nodeTriangleOffsets[lastNode + 1]);
+		return;
 	}
+
+	for (unsigned int i = nodeTriangleOffsets[nodeIndex]; i < nodeTriangleOffsets[nodeIndex + 1]; i++)
+		if (isInRegion(region, triangles[triangleIndices[i]]))
+			results.push_back(triangleIndices[i]);
+
+	const KdStructs::Node& node = nodes[nodeIndex];
+	KdStructs::BoundingBox leftCell = cell;
+	KdStructs::BoundingBox rightCell = cell;
+	leftCell.max[node.axis()] = node.split;
+	rightCell.min[node.axis()] = node.split;
+	if (node.left(nodeIndex) != KdStructs::NO_NODE)
+		findInRegion(node.left(nodeIndex), leftCell, planeMask, region, results);
+	if (node.right() != KdStructs::NO_NODE)
+		findInRegion(node.right(), rightCell, planeMask, region, results);
 }
 
 /// <summary>
-/// MllerTrumbore intersection algorithm
-/// https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+/// Casts the rays [begin, end) of a batch.
 /// </summary>
-float KdTree::rayIntersectionWithTriangle(KdStructs::Triangle* triangle, KdStructs::Ray ray)
+void KdTree::raycastRange(const KdStructs::Ray* rays, size_t begin, size_t end, KdStructs::RayHitBuffer& hits) const
 {
-	const float EPSILON = 0.0000001;
+	// Median trees need the unclipped single ray traversal.
+	if (buildMode == BuildMode::MEDIAN || nodes.empty())
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			KdStructs::RayHit hit;
+			bool hasHit = raycast(rays[i], hit);
+			hits.triangles[i] = hasHit ? hit.triangle : nullptr;
+			hits.distances[i] = hit.distance;
+			hits.positionsX[i] = hit.position[0];
+			hits.positionsY[i] = hit.position[1];
+			hits.positionsZ[i] = hit.position[2];
+		}
+		return;
+	}
 
-	KdStructs::Vector v1 = triangle->a;
-	KdStructs::Vector v2 = triangle->b;
-	KdStructs::Vector v3 = triangle->c;
+	// Rays going into the same octant visit the children of a node in the same order,
+	// so they are collected per octant and traced as soon as a packet is full.
+	size_t packets[8][PACKET_SIZE];
+	int packetSizes[8] = {};
+	for (size_t i = begin; i < end; i++)
+	{
+		const KdStructs::Vector& direction = rays[i].direction;
+		int octant = (std::signbit(direction[0]) ? 1 : 0) | (std::signbit(direction[1]) ? 2 : 0) | (std::signbit(direction[2]) ? 4 : 0);
+		packets[octant][packetSizes[octant]++] = i;
+		if (packetSizes[octant] == PACKET_SIZE)
+		{
+			raycastPacket(rays, packets[octant], PACKET_SIZE, hits);
+			packetSizes[octant] = 0;
+		}
+	}
 
-	KdStructs::Vector edge1 = v2 - v1;
-	KdStructs::Vector edge2 = v3 - v1;
+	// Remaining partly filled packets
+	for (int octant = 0; octant < 8; octant++)
+		if (packetSizes[octant] > 0)
+			raycastPacket(rays, packets[octant], packetSizes[octant], hits);
+}
 
-	KdStructs::Vector h = ray.direction.cross(edge2);
-	float a = edge1.dot(h);
+/// <summary>
+/// Traces up to PACKET_SIZE rays with the same direction signs through the SAH tree together.
+/// Each lane keeps its own [tMin, tMax] segment, a node is visited if it is active for any lane
+/// and every active ray tests the leaf's triangle blocks with the tree's block kernel (same test as single rays).
+/// </summary>
+void KdTree::raycastPacket(const KdStructs::Ray* rays, const size_t* rayIndices, int rayCount, KdStructs::RayHitBuffer& hits) const
+{
+	alignas(16) float origins[DIMENSIONS][PACKET_SIZE];
+	alignas(16) float inverseDirections[DIMENSIONS][PACKET_SIZE];
+	alignas(16) float tMins[PACKET_SIZE];
+	alignas(16) float tMaxs[PACKET_SIZE];
+	alignas(16) float closest[PACKET_SIZE];
+	const KdStructs::Triangle* hitTriangles[PACKET_SIZE] = {};
+
+	for (int lane = 0; lane < PACKET_SIZE; lane++)
+	{
+		// Unused lanes get an empty segment and are never active.
+		tMins[lane] = std::numeric_limits<float>::max();
+		tMaxs[lane] = -std::numeric_limits<float>::max();
+		closest[lane] = -std::numeric_limits<float>::max();
+		for (int axis = 0; axis < DIMENSIONS; axis++)
+		{
+			origins[axis][lane] = 0;
+			inverseDirections[axis][lane] = 1;
+		}
+		if (lane >= rayCount)
+			continue;
 
-	// This ray is parallel to this triangle.
-	if (a > -EPSILON && a < EPSILON)
-		return -1;
+		const KdStructs::Ray& ray = rays[rayIndices[lane]];
+		for (int axis = 0; axis < DIMENSIONS; axis++)
+		{
+			origins[axis][lane] = ray.origin[axis];
+			inverseDirections[axis][lane] = 1.0f / ray.direction[axis];
+		}
 
-	float f = 1.0f / a;
-	KdStructs::Vector s = ray.origin - v1;
-	float u = f * s.dot(h);
+		float tMin, tMax;
+		if (!bounds.intersect(ray.origin, ray.direction, tMin, tMax) || tMax < 0 || tMin > ray.distance)
+			continue;
+		tMins[lane] = std::max(tMin, 0.0f);
+		tMaxs[lane] = std::min(tMax, ray.distance);
+		closest[lane] = ray.distance;
+	}
 
-	if (u < 0 || u > 1)
-		return -1;
+	__m128 origin[DIMENSIONS];
+	__m128 inverseDirection[DIMENSIONS];
+	bool negative[DIMENSIONS];
+	for (int axis = 0; axis < DIMENSIONS; axis++)
+	{
+		origin[axis] = _mm_load_ps(origins[axis]);
+		inverseDirection[axis] = _mm_load_ps(inverseDirections[axis]);
+		negative[axis] = std::signbit(rays[rayIndices[0]].direction[axis]);
+	}
+	__m128 closestDistance = _mm_load_ps(closest);
 
-	KdStructs::Vector q = s.cross(edge1);
-	float v = f * ray.direction.dot(q);
+	// Same tolerance as traversalTolerance, infinite distances (parallel rays) keep a finite tolerance.
+	auto tolerance = [](__m128 t)
+	{
+		__m128 magnitude = _mm_max_ps(_mm_set1_ps(1.0f), _mm_andnot_ps(_mm_set1_ps(-0.0f), t));
+		return _mm_mul_ps(_mm_set1_ps(TRAVERSAL_EPSILON), _mm_min_ps(magnitude, _mm_set1_ps(std::numeric_limits<float>::max())));
+	};
 
-	if (v < 0 || u + v > 1)
-		return -1;
+	struct StackEntry
+	{
+		unsigned int node;
+		__m128 tMin;
+		__m128 tMax;
+	};
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = StackEntry{ 0, _mm_load_ps(tMins), _mm_load_ps(tMaxs) };
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		unsigned int nodeIndex = entry.node;
+		__m128 tMin = entry.tMin;
+		// Everything behind the closest hit can be skipped.
+		__m128 tMax = _mm_min_ps(entry.tMax, _mm_add_ps(closestDistance, tolerance(closestDistance)));
+		int activeMask = _mm_movemask_ps(_mm_cmple_ps(tMin, tMax));
+
+		while (activeMask != 0 && !nodes[nodeIndex].isLeaf())
+		{
+			const KdStructs::Node& node = nodes[nodeIndex];
+			int axis = node.axis();
+
+			// Near child comes first along the direction, NaN (origin in a parallel plane) keeps both segments whole.
+			// Both segments reach a tolerance past the plane, so rays through the plane visit both children.
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.split), origin[axis]), inverseDirection[axis]);
+			__m128 planeTolerance = tolerance(t);
+			__m128 nearMax = _mm_min_ps(_mm_add_ps(t, planeTolerance), tMax);
+			__m128 farMin = _mm_max_ps(_mm_sub_ps(t, planeTolerance), tMin);
+			int nearMask = _mm_movemask_ps(_mm_cmple_ps(tMin, nearMax)) & activeMask;
+			int farMask = _mm_movemask_ps(_mm_cmple_ps(farMin, tMax)) & activeMask;
+
+			unsigned int near = negative[axis] ? node.right() : node.left(nodeIndex);
+			unsigned int far = negative[axis] ? node.left(nodeIndex) : node.right();
+
+			if (nearMask != 0 && farMask != 0) {
+				assert(stackSize < TRAVERSAL_STACK_SIZE);
+				stack[stackSize++] = StackEntry{ far, farMin, tMax };
+			}
+			else if (nearMask == 0)
+			{
+				nodeIndex = far;
+				tMin = farMin;
+				activeMask = farMask;
+				continue;
+			}
+
+			nodeIndex = near;
+			tMax = nearMax;
+			activeMask = nearMask;
+		}
 
-	float t = f * edge2.dot(q);
+		if (activeMask == 0)
+			continue;
+
+		// The rays are tested one by one, each against 4 or 8 triangles at once.
+		unsigned int blockOffset = blockOffsets[nodeIndex];
+		for (int lane = 0; lane < PACKET_SIZE; lane++)
+		{
+			if ((activeMask & (1 << lane)) == 0)
+				continue;
 
-	if (t > EPSILON) {
-		return t;
+			unsigned int triangle = intersectBlocks(triangleBlocks.data() + blockOffset, blockOffsets[nodeIndex + 1] - blockOffset, rays[rayIndices[lane]], closest[lane]);
+			if (triangle != KdStructs::NO_TRIANGLE)
+				hitTriangles[lane] = &triangles[triangle];
+		}
+		closestDistance = _mm_load_ps(closest);
 	}
 
-	return -1;
+	for (int lane = 0; lane < rayCount; lane++)
+	{
+		size_t rayIndex = rayIndices[lane];
+		const KdStructs::Ray& ray = rays[rayIndex];
+		KdStructs::Vector position = hitTriangles[lane] != nullptr ? ray.origin + ray.direction * closest[lane] : KdStructs::Vector(0, 0, 0);
+		hits.triangles[rayIndex] = hitTriangles[lane];
+		hits.distances[rayIndex] = hitTriangles[lane] != nullptr ? closest[lane] : std::numeric_limits<float>::max();
+		hits.positionsX[rayIndex] = position[0];
+		hits.positionsY[rayIndex] = position[1];
+		hits.positionsZ[rayIndex] = position[2];
+	}
 }
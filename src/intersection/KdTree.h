@@ -1,52 +1,278 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+#include "RayQueryStructure.h"
 #include "Structures.h"
+#include "TriangleIntersection.h"
+#include "../util/MappedFile.h"
+#include "../util/ThreadPool.h"
 
 constexpr int DIMENSIONS = 3;
 
-class KdTree
+class KdTree final : public RayQueryStructure
 {
 public:
-	KdTree(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount);
-	KdTree(float* vertices, unsigned int vertexCount);
-	KdTree(std::vector<KdStructs::Point*> points);
+	enum class BuildMode
+	{
+		// Splits the vertex points at the median of the widest axis, triangles are stored with their points.
+		MEDIAN,
+		// Splits the triangles using the surface area heuristic, triangles are stored in the leaves.
+		SAH,
+	};
+
+	/// <summary>
+	/// If a thread pool is given, the tree is built in parallel (same result as the serial build).
+	/// </summary>
+	KdTree(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount, BuildMode buildMode = BuildMode::MEDIAN, ThreadPool* threadPool = nullptr);
+	KdTree(float* vertices, unsigned int vertexCount, BuildMode buildMode = BuildMode::MEDIAN, ThreadPool* threadPool = nullptr);
 	~KdTree();
 
-	void raycast(KdStructs::Ray ray, KdStructs::RayHit*& hit);
-	std::vector<KdStructs::Node*> getNodes();
+	// The tree data is referenced by views, copies would point into the original.
+	KdTree(const KdTree&) = delete;
+	KdTree& operator=(const KdTree&) = delete;
+
+	/// <summary>
+	/// Hash of the geometry and build mode, stored with saved trees to detect outdated files.
+	/// </summary>
+	static uint64_t hashScene(const float* vertices, unsigned int vertexCount, BuildMode buildMode);
+
+	/// <summary>
+	/// Writes the built tree (nodes, triangle indices, triangles, SIMD blocks and bounds) to a binary file.
+	/// </summary>
+	bool save(const std::string& path, uint64_t sceneHash) const;
+
+	/// <summary>
+	/// Maps a file written by save. The tree uses the mapped data directly (no parsing, no copies).
+	/// Returns nullptr if the file is missing, invalid, from another version or for another scene.
+	/// </summary>
+	static KdTree* load(const std::string& path, uint64_t sceneHash);
+
+	/// <summary>
+	/// Loads the tree from the file if it matches the geometry, otherwise builds it and updates the file.
+	/// </summary>
+	static KdTree* loadOrBuild(const std::string& path, float* vertices, unsigned int vertexCount, BuildMode buildMode = BuildMode::MEDIAN, ThreadPool* threadPool = nullptr);
+
+	bool isMapped() const;
+
+	/// <summary>
+	/// Finds the closest triangle hit along the ray (up to ray.distance).
+	/// Returns false and leaves hit untouched if nothing was hit.
+	/// All queries only read the tree and keep their state on the stack, so they can run concurrently.
+	/// </summary>
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const override;
+	/// <summary>
+	/// Same as raycast, but records the work of the query in the stats (see KdStructs::TraversalStats).
+	/// The normal overload has no counters compiled in.
+	/// </summary>
+	bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, KdStructs::TraversalStats& stats) const override;
+	/// <summary>
+	/// Returns true if any triangle is hit closer than maxDistance (ray.distance is not used).
+	/// Stops at the first hit, meant for shadow and line of sight tests.
+	/// </summary>
+	bool occluded(const KdStructs::Ray& ray, float maxDistance) const override;
+	bool occluded(const KdStructs::Ray& ray, float maxDistance, KdStructs::TraversalStats& stats) const override;
+	/// <summary>
+	/// The watertight test doesn't miss rays through shared edges and vertices, but is a bit slower.
+	/// Single rays, packets and occlusion queries all use the selected test.
+	/// </summary>
+	void setTriangleTest(KdStructs::TriangleTest test) override;
+	/// <summary>
+	/// Casts rayCount rays and writes the closest hits into the buffer (resized to rayCount).
+	/// Rays with the same direction signs are traced together in packets of 4 (SAH trees only).
+	/// If a thread pool is given, chunks of rays are cast in parallel (same results as serial).
+	/// Returns the number of rays that hit something.
+	/// </summary>
+	unsigned int raycastBatch(const KdStructs::Ray* rays, size_t rayCount, KdStructs::RayHitBuffer& hits, ThreadPool* threadPool = nullptr) const;
+
+	/// <summary>
+	/// Finds the k points (welded vertices) closest to the position, sorted by distance.
+	/// The results are cleared first, returns their count (less than k if the tree has fewer points).
+	/// SAH trees build their point tree on the first point query.
+	/// </summary>
+	unsigned int nearest(const KdStructs::Vector& position, unsigned int k, std::vector<KdStructs::PointHit>& results) const;
+	/// <summary>
+	/// Finds all points within the radius (inclusive) of the position, sorted by distance.
+	/// The results are cleared first, returns their count.
+	/// </summary>
+	unsigned int withinRadius(const KdStructs::Vector& position, float radius, std::vector<KdStructs::PointHit>& results) const;
+
+	/// <summary>
+	/// Finds all triangles whose bounds overlap the box (see getTriangle), sorted by index.
+	/// The results are cleared first, returns their count.
+	/// </summary>
+	unsigned int queryAABB(const KdStructs::BoundingBox& box, std::vector<unsigned int>& results) const;
+	/// <summary>
+	/// Finds the triangles that may reach into the frustum, sorted by index. Conservative like KdStructs::Frustum:
+	/// no triangle inside is missed, some close to the edges are included. The results are cleared first, returns their count.
+	/// </summary>
+	unsigned int queryFrustum(const KdStructs::Frustum& frustum, std::vector<unsigned int>& results) const;
+
+	unsigned int getPointCount() const;
+	KdStructs::Vector getPointPosition(unsigned int point) const;
+	/// <summary>
+	/// Indices of the triangles the point belongs to (see getTriangle).
+	/// </summary>
+	KdStructs::ArrayView<unsigned int> getPointTriangles(unsigned int point) const;
+	const KdStructs::Triangle& getTriangle(unsigned int triangle) const override;
+
+	const KdStructs::BoundingBox& getBounds() const override;
+	unsigned int getTriangleCount() const override;
+	size_t getNodeCount() const override;
+	/// <summary>
+	/// Bytes used by each part of the tree data, blockLaneFill is the share of SIMD block lanes holding a triangle.
+	/// </summary>
+	struct MemoryReport
+	{
+		// Nodes with their triangle and block offsets, the part touched by every traversal step
+		size_t nodes = 0;
+		size_t triangleIndices = 0;
+		size_t triangles = 0;
+		size_t triangleBlocks = 0;
+		// Points of the point queries (SAH trees also keep a separate point tree, once it is built)
+		size_t pointTree = 0;
+		float blockLaneFill = 0;
+
+		size_t getTotal() const { return nodes + triangleIndices + triangles + triangleBlocks + pointTree; }
+	};
+	MemoryReport getMemoryReport() const;
+	/// <summary>
+	/// Bytes used by the tree data (nodes, triangles, SIMD blocks and point tree).
+	/// </summary>
+	size_t getMemorySize() const override;
+	KdStructs::ArrayView<KdStructs::Node> getNodes() const;
+	KdStructs::ArrayView<unsigned int> getTriangleIndices() const;
+	/// <summary>
+	/// Indices of the triangles stored with the node (see getTriangle).
+	/// </summary>
+	KdStructs::ArrayView<unsigned int> getNodeTriangles(unsigned int node) const;
 
 	void print();
-	void printStatistics();
+	void printStatistics() const override;
 
 private:
+	KdTree() = default;
 
-	std::vector<KdStructs::Point*> getPointList(float* vertices, unsigned int vertexCount, unsigned int* indices, unsigned int indexCount);
-	std::vector<KdStructs::Point*> getPointList(float* vertices, unsigned int vertexCount);
-	KdStructs::Node* createKdTree(std::vector<KdStructs::Point*> points, int depth, KdStructs::Vector max, KdStructs::Vector min);
-	void findIntersection(KdStructs::Node* node, KdStructs::Ray ray, KdStructs::RayHit*& hit);
-	float rayIntersectionWithTriangle(KdStructs::Triangle* triangle, KdStructs::Ray ray);
+	struct SahSplit
+	{
+		int axis = -1;
+		float position = 0;
+		float cost = std::numeric_limits<float>::max();
+	};
 
-	inline auto getComparatorForAxis(int axis) const
-	{ 
-		return [axis](KdStructs::Point* p1, KdStructs::Point* p2)
+	// Nodes and triangle indices of a (sub)tree while building.
+	struct BuildOutput
+	{
+		std::vector<KdStructs::Node> nodes;
+		std::vector<unsigned int> triangleIndices;
+		// Start of each node's triangles in triangleIndices
+		std::vector<unsigned int> triangleOffsets;
+		// Point of each node (median build only)
+		std::vector<KdStructs::Vector> positions;
+	};
+
+	unsigned int addTriangle(float* vertices, unsigned int vertexIndex1, unsigned int vertexIndex2, unsigned int vertexIndex3);
+	void addTriangles(float* vertices, unsigned int* indices, unsigned int indexCount);
+	void addTriangles(float* vertices, unsigned int vertexCount);
+	std::vector<KdStructs::Point> weldPoints(KdStructs::ArrayView<KdStructs::Triangle> cornerTriangles, const unsigned int* cornerVertices) const;
+
+	void buildMedian(std::vector<KdStructs::Point> points);
+	BuildOutput createPointTree(const std::vector<KdStructs::Point>& points) const;
+	unsigned int createKdTree(const std::vector<KdStructs::Point>& points, std::vector<unsigned int>& pointIndices, size_t begin, size_t end, BuildOutput& output) const;
+	void buildPendingPointTree() const;
+
+	void buildSah();
+	unsigned int createSahTree(const std::vector<KdStructs::BoundingBox>& triangleBounds, std::vector<unsigned int>& triangleList, const KdStructs::BoundingBox& bounds, int depth, int badRefines, BuildOutput& output);
+	SahSplit findSahSplit(const std::vector<KdStructs::BoundingBox>& triangleBounds, const std::vector<unsigned int>& triangleList, const KdStructs::BoundingBox& bounds) const;
+	static unsigned int appendSubtree(BuildOutput& output, const BuildOutput& subtree);
+	void buildTriangleBlocks();
+
+	// The stats policy is either KdStructs::TraversalStats or KdStructs::NoTraversalStats, whose empty methods compile away.
+	template <typename Stats>
+	bool findClosestHit(const KdStructs::Ray& ray, KdStructs::RayHit& hit, Stats& stats) const;
+	template <typename Stats>
+	void findIntersection(const KdStructs::Ray& ray, float tMin, float tMax, KdStructs::RayHit& hit, Stats& stats) const;
+	template <typename Stats>
+	bool findAnyHit(const KdStructs::Ray& ray, float maxDistance, Stats& stats) const;
+	template <typename Stats>
+	bool findOcclusion(const KdStructs::Ray& ray, float tMin, float tMax, float maxDistance, Stats& stats) const;
+	void findNearest(unsigned int nodeIndex, const KdStructs::Vector& position, unsigned int k, std::vector<KdStructs::PointHit>& results) const;
+	void findWithinRadius(unsigned int nodeIndex, const KdStructs::Vector& position, float radiusSquared, std::vector<KdStructs::PointHit>& results) const;
+	template <typename Region>
+	unsigned int findInRegion(const Region& region, std::vector<unsigned int>& results) const;
+	template <typename Region>
+	void findInRegion(unsigned int nodeIndex, const KdStructs::BoundingBox& cell, unsigned int planeMask, const Region& region, std::vector<unsigned int>& results) const;
+	void raycastRange(const KdStructs::Ray* rays, size_t begin, size_t end, KdStructs::RayHitBuffer& hits) const;
+	void raycastPacket(const KdStructs::Ray* rays, const size_t* rayIndices, int rayCount, KdStructs::RayHitBuffer& hits) const;
+
+	inline auto getComparatorForAxis(const std::vector<KdStructs::Point>& points, int axis) const
+	{
+		return [&points, axis](unsigned int p1, unsigned int p2)
 		{
-			return p1->pos[axis] < p2->pos[axis]; 
-		}; 
+			return points[p1].pos[axis] < points[p2].pos[axis];
+		};
 	}
 
-	inline KdStructs::Point* findPoint(KdStructs::Point point, std::vector<KdStructs::Point*> points) {
-		for (KdStructs::Point* currentPoint : points)
-			if (currentPoint->pos == point.pos)
-				return currentPoint;
-		return nullptr;
-	}
+	BuildMode buildMode = BuildMode::MEDIAN;
+	KdStructs::BoundingBox bounds;
+	// Not owned, only set while building.
+	ThreadPool* threadPool = nullptr;
+
+	// Tree data owned by a built tree (empty if it was loaded from a file).
+	struct Storage
+	{
+		std::vector<KdStructs::Node> nodes;
+		std::vector<unsigned int> nodeTriangleOffsets;
+		std::vector<unsigned int> triangleIndices;
+		std::vector<KdStructs::Triangle> triangles;
+		std::vector<KdStructs::TriangleBlock> triangleBlocks;
+		std::vector<unsigned int> blockOffsets;
+	};
+
+	// Point tree data owned by the tree, built later by the first point query of SAH trees.
+	struct PointStorage
+	{
+		std::vector<KdStructs::Vector> positions;
+		// Only used by SAH trees (median trees are built over the points)
+		std::vector<KdStructs::Node> nodes;
+		std::vector<unsigned int> triangleOffsets;
+		std::vector<unsigned int> triangleIndices;
+		// Vertex index of every triangle corner, kept until the point tree of an indexed SAH tree is built
+		std::vector<unsigned int> cornerVertices;
+	};
+
+	void updateViews();
+
+	Storage storage;
+	mutable PointStorage pointStorage;
+	bool pointTreePending = false;
+	mutable std::once_flag pointTreeBuilt;
+	std::unique_ptr<MappedFile> mappedFile;
+
+	// Linearized tree (depth-first order, root at index 0).
+	KdStructs::ArrayView<KdStructs::Node> nodes;
+	// Triangle indices of all nodes in node order, node i owns [nodeTriangleOffsets[i], nodeTriangleOffsets[i + 1]).
+	// Kept out of the nodes, so they stay 8 bytes and more of the tree fits into the cache.
+	KdStructs::ArrayView<unsigned int> nodeTriangleOffsets;
+	KdStructs::ArrayView<unsigned int> triangleIndices;
+	KdStructs::ArrayView<KdStructs::Triangle> triangles;
 
-	KdStructs::Node* root;
-	// Used for clean up.
-	std::vector<KdStructs::Triangle*> triangles;
+	// Copies of the node triangles for the SIMD kernel, node i owns blocks [blockOffsets[i], blockOffsets[i + 1]).
+	KdStructs::ArrayView<KdStructs::TriangleBlock> triangleBlocks;
+	KdStructs::ArrayView<unsigned int> blockOffsets;
+	KdStructs::SimdLevel simdLevel = KdStructs::SimdLevel::SCALAR;
+	KdStructs::TriangleTest triangleTest = KdStructs::TriangleTest::MOLLER_TRUMBORE;
+	KdStructs::BlockIntersector intersectBlocks = nullptr;
+	KdStructs::BlockOccluder occludedBlocks = nullptr;
 
-	unsigned int checkCache = 0;
+	// Median tree over the welded vertices for the point queries, every node is one point.
+	mutable KdStructs::ArrayView<KdStructs::Node> pointNodes;
+	mutable KdStructs::ArrayView<unsigned int> pointTriangleOffsets;
+	mutable KdStructs::ArrayView<unsigned int> pointTriangleIndices;
+	mutable KdStructs::ArrayView<KdStructs::Vector> pointPositions;
 };
 
@@ -0,0 +1,16 @@
+#include "RayQueryStructure.h"
+
+#include "Bvh.h"
+#include "KdTree.h"
+
+std::unique_ptr<RayQueryStructure> RayQueryStructure::create(Type type, float* vertices, unsigned int vertexCount, ThreadPool* threadPool)
+{
+	if (type == Type::BVH)
+		return std::make_unique<Bvh>(vertices, vertexCount);
+	return std::make_unique<KdTree>(vertices, vertexCount, KdTree::BuildMode::SAH, threadPool);
+}
+
+const char* RayQueryStructure::getTypeName(Type type)
+{
+	return type == Type::BVH ? "BVH" : "kd-tree";
+}
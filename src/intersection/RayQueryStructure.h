@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+
+#include "Structures.h"
+#include "TriangleIntersection.h"
+#include "../util/ThreadPool.h"
+
+/// <summary>
+/// Ray queries shared by the acceleration structures (KdTree, Bvh), so the structure can be chosen per scene.
+/// All queries only read the structure and can run concurrently.
+/// </summary>
+class RayQueryStructure
+{
+public:
+	enum class Type
+	{
+		// SAH kd-tree (KdTree::BuildMode::SAH)
+		KD_TREE,
+		// Binned SAH bounding volume hierarchy with 4 children per node, can be refit when vertices move
+		BVH,
+	};
+
+	/// <summary>
+	/// Builds the structure over non-indexed vertices.
+	/// </summary>
+	static std::unique_ptr<RayQueryStructure> create(Type type, float* vertices, unsigned int vertexCount, ThreadPool* threadPool = nullptr);
+	static const char* getTypeName(Type type);
+
+	virtual ~RayQueryStructure() = default;
+
+	/// <summary>
+	/// Finds the closest triangle hit along the ray (up to ray.distance).
+	/// Returns false and leaves hit untouched if nothing was hit.
+	/// </summary>
+	virtual bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit) const = 0;
+	/// <summary>
+	/// Same as raycast, but records the work of the query in the stats.
+	/// </summary>
+	virtual bool raycast(const KdStructs::Ray& ray, KdStructs::RayHit& hit, KdStructs::TraversalStats& stats) const = 0;
+	/// <summary>
+	/// Returns true if any triangle is hit closer than maxDistance (ray.distance is not used).
+	/// </summary>
+	virtual bool occluded(const KdStructs::Ray& ray, float maxDistance) const = 0;
+	virtual bool occluded(const KdStructs::Ray& ray, float maxDistance, KdStructs::TraversalStats& stats) const = 0;
+	/// <summary>
+	/// Selects the ray-triangle test used by all queries (Moller-Trumbore by default).
+	/// Not thread safe, set it before querying.
+	/// </summary>
+	virtual void setTriangleTest(KdStructs::TriangleTest test) = 0;
+
+	virtual const KdStructs::BoundingBox& getBounds() const = 0;
+	virtual unsigned int getTriangleCount() const = 0;
+	/// <summary>
+	/// Triangles in the order of the vertices the structure was built with.
+	/// </summary>
+	virtual const KdStructs::Triangle& getTriangle(unsigned int triangle) const = 0;
+	virtual size_t getNodeCount() const = 0;
+	/// <summary>
+	/// Bytes used by the structure's data.
+	/// </summary>
+	virtual size_t getMemorySize() const = 0;
+	virtual void printStatistics() const = 0;
+};
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 
 namespace KdStructs {
 
@@ -8,18 +12,15 @@ namespace KdStructs {
 	struct Triangle;
 
 
+	/// <summary>
+	/// Plain 3-float value type. Trivially copyable and never allocates,
+	/// so rays, hits and triangles can be passed around and copied freely.
+	/// </summary>
 	struct Vector
 	{
-		Vector(float values[3]) : values(values) {}
-		Vector(float x, float y, float z) : values(new float[3]{ x,y,z }) {}
-		Vector(const Vector& vector) : values(new float[3]{ vector[0], vector[1], vector[2] }) {}
+		Vector() = default;
+		Vector(float x, float y, float z) : values{ x, y, z } {}
 
-		~Vector() {
-			delete[] values;
-			values = nullptr;
-		}
-
-		Vector& operator=(const Vector& other) { values[0] = other[0]; values[1] = other[1]; values[2] = other[2]; return *this; }
 		float operator[](int i) const { return values[i]; }
 		float& operator[](int i) { return values[i]; }
 		Vector operator+(const Vector& other) const { return Vector(values[0] + other[0], values[1] + other[1], values[2] + other[2]); }
@@ -38,26 +39,26 @@ namespace KdStructs {
 
 		void print() { std::cout << "{" << values[0] << "," << values[1] << "," << values[2] << "}" << std::endl; }
 
-		float* values = nullptr;
-		const float EPSILON = 0.0001f;
+		float values[3] = { 0, 0, 0 };
+		static constexpr float EPSILON = 0.0001f;
 	};
 
+	static_assert(std::is_trivially_copyable<Vector>::value, "Vector has to stay a plain value type");
+
 	inline std::ostream& operator<<(std::ostream& str, const Vector& vector) {
 		return str << "{" << vector.values[0] << "," << vector.values[1] << "," << vector.values[2] << "}";
 	}
 
 	struct Point
 	{
-		Point(Vector pos, std::vector<Triangle*> triangles) : pos(pos), triangles(triangles) {}
-		Point(Vector pos, Triangle* triangle) : pos(pos) { triangles.push_back(triangle); }
+		Point(Vector pos, unsigned int triangle) : pos(pos) { triangles.push_back(triangle); }
 		Point(Vector pos) : pos(pos) {}
 
-		bool operator==(const Point* other) const { return pos == other->pos; }
 		bool operator==(const Point& other) const { return pos == other.pos; }
 
 		Vector pos;
-		// Triangles this point belongs to
-		std::vector<Triangle*> triangles;
+		// Indices of the triangles this point belongs to
+		std::vector<unsigned int> triangles;
 	};
 
 
@@ -68,61 +69,460 @@ namespace KdStructs {
 		Vector a;
 		Vector b;
 		Vector c;
+	};
+
+	/// <summary>
+	/// Axis aligned bounding box
+	/// </summary>
+	struct BoundingBox
+	{
+		BoundingBox() = default;
+		BoundingBox(Vector min, Vector max) : min(min), max(max) {}
+		BoundingBox(const Triangle& triangle) : min(triangle.a), max(triangle.a) { extend(triangle.b); extend(triangle.c); }
+
+		void extend(const Vector& point)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				min[axis] = std::fmin(min[axis], point[axis]);
+				max[axis] = std::fmax(max[axis], point[axis]);
+			}
+		}
+
+		void extend(const BoundingBox& other) { extend(other.min); extend(other.max); }
+
+		// Overlap of both boxes (might be empty -> min > max)
+		BoundingBox clip(const BoundingBox& other) const
+		{
+			return BoundingBox(
+				Vector(std::fmax(min[0], other.min[0]), std::fmax(min[1], other.min[1]), std::fmax(min[2], other.min[2])),
+				Vector(std::fmin(max[0], other.max[0]), std::fmin(max[1], other.max[1]), std::fmin(max[2], other.max[2])));
+		}
 
-		unsigned int checkCache = 0;
+		/// <summary>
+		/// Slab test, returns the distances where the ray enters and leaves the box.
+		/// </summary>
+		bool intersect(const Vector& origin, const Vector& direction, float& tNear, float& tFar) const
+		{
+			tNear = -std::numeric_limits<float>::max();
+			tFar = std::numeric_limits<float>::max();
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (direction[axis] == 0.0f)
+				{
+					// Parallel to the slab, origin has to be inside.
+					if (origin[axis] < min[axis] || origin[axis] > max[axis])
+						return false;
+					continue;
+				}
+
+				float t1 = (min[axis] - origin[axis]) / direction[axis];
+				float t2 = (max[axis] - origin[axis]) / direction[axis];
+				tNear = std::fmax(tNear, std::fmin(t1, t2));
+				tFar = std::fmin(tFar, std::fmax(t1, t2));
+			}
+			return tNear <= tFar;
+		}
+
+		float surfaceArea() const
+		{
+			Vector size = max - min;
+			return 2.0f * (size[0] * size[1] + size[0] * size[2] + size[1] * size[2]);
+		}
+
+		// Both boxes overlap or touch
+		bool overlaps(const BoundingBox& other) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+				if (min[axis] > other.max[axis] || max[axis] < other.min[axis])
+					return false;
+			return true;
+		}
+
+		bool contains(const BoundingBox& other) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+				if (other.min[axis] < min[axis] || other.max[axis] > max[axis])
+					return false;
+			return true;
+		}
+
+		Vector min = Vector(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+		Vector max = Vector(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
 	};
 
 	/// <summary>
-	/// Aka. Partition, Cell
-	/// Node storing kd-tree
+	/// Points with normal . point + distance >= 0 are in front of the plane.
+	/// The normal does not have to be normalized, only the sign of getDistance is used.
 	/// </summary>
-	struct Node
+	struct Plane
 	{
-		Node(Point* point, Node* left, Node* right, int axis, Vector max, Vector min) : point(point), left(left), right(right), axis(axis), max(max), min(min) {}
+		Plane() = default;
+		Plane(Vector normal, float distance) : normal(normal), distance(distance) {}
 
-		~Node() {
-			if (point) delete point;
-			if (left) delete left;
-			if (right) delete right;
+		float getDistance(const Vector& point) const { return normal.dot(point) + distance; }
 
-			point = nullptr;
-			left = nullptr;
-			right = nullptr;
+		Vector normal;
+		float distance = 0;
+	};
+
+	// How much of a box lies in a region
+	enum class Overlap
+	{
+		OUTSIDE,
+		PARTIAL,
+		INSIDE,
+	};
+
+	/// <summary>
+	/// Convex volume bounded by 6 planes facing inwards, e.g. the view volume of a camera or light.
+	/// The tests are conservative: everything reported outside is outside, but boxes and triangles
+	/// close to the edges can be reported as intersecting without touching the volume.
+	/// </summary>
+	struct Frustum
+	{
+		/// <summary>
+		/// Extracts the planes from a column-major (OpenGL) projection * view matrix,
+		/// the frustum is in the space the matrix transforms from (world space).
+		/// </summary>
+		static Frustum fromMatrix(const float* matrix)
+		{
+			// Clip space is -w <= x, y, z <= w, every bound gives one plane of the form row3 +- row.
+			Frustum frustum;
+			for (int axis = 0; axis < 3; axis++)
+				for (int side = 0; side < 2; side++)
+				{
+					float sign = side == 0 ? 1.0f : -1.0f;
+					frustum.planes[axis * 2 + side] = Plane(
+						Vector(matrix[3] + sign * matrix[axis], matrix[7] + sign * matrix[4 + axis], matrix[11] + sign * matrix[8 + axis]),
+						matrix[15] + sign * matrix[12 + axis]);
+				}
+			return frustum;
 		}
 
-		// Point of this splitting plane
-		Point* point = nullptr;
+		/// <summary>
+		/// Tests the box against the planes in planeMask (bit i = planes[i]). Planes the box is completely in front of
+		/// are removed from the mask, boxes inside this one only have to be tested against the remaining planes.
+		/// </summary>
+		Overlap classify(const BoundingBox& box, unsigned int& planeMask) const
+		{
+			for (int i = 0; i < 6; i++)
+			{
+				if ((planeMask & (1u << i)) == 0)
+					continue;
 
-		// Splitting plane to the left and right
-		Node* left = nullptr;
-		Node* right = nullptr;
+				// Corners furthest in front of and behind the plane
+				const Plane& plane = planes[i];
+				Vector front, back;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					front[axis] = plane.normal[axis] >= 0 ? box.max[axis] : box.min[axis];
+					back[axis] = plane.normal[axis] >= 0 ? box.min[axis] : box.max[axis];
+				}
+				if (plane.getDistance(front) < 0)
+					return Overlap::OUTSIDE;
+				if (plane.getDistance(back) >= 0)
+					planeMask &= ~(1u << i);
+			}
+			return planeMask == 0 ? Overlap::INSIDE : Overlap::PARTIAL;
+		}
+
+		// False if the box is completely behind one of the planes
+		bool intersects(const BoundingBox& box) const
+		{
+			unsigned int planeMask = ALL_PLANES;
+			return classify(box, planeMask) != Overlap::OUTSIDE;
+		}
 
-		// Axis in which this splitting plane lies
-		int axis = 0;
+		// False if all corners of the triangle are behind one of the planes
+		bool intersects(const Triangle& triangle) const
+		{
+			for (const Plane& plane : planes)
+				if (plane.getDistance(triangle.a) < 0 && plane.getDistance(triangle.b) < 0 && plane.getDistance(triangle.c) < 0)
+					return false;
+			return true;
+		}
 
-		// Splitting plane limits for each axis
-		// Defines where splitting plane for this node starts and ends
-		// 0 -> undefined/endless
-		Vector max;
-		Vector min;
+		Plane planes[6];
+		static constexpr unsigned int ALL_PLANES = 0x3F;
 	};
 
+	// Index used for a missing child node
+	constexpr unsigned int NO_NODE = std::numeric_limits<unsigned int>::max();
+
+	/// <summary>
+	/// Aka. Partition, Cell
+	/// Node of the linearized kd-tree. Nodes are stored depth-first in one array,
+	/// so the left child (if any) directly follows its parent and only the index of
+	/// the right child has to be stored.
+	/// The node's triangles are not stored in the node itself: nodes reference contiguous ranges
+	/// in node order, so the tree keeps one offset per node (plus the end) next to the node array.
+	/// </summary>
+	struct Node
+	{
+		// Position of the splitting plane on the node's axis
+		float split = 0;
+
+		// Bits 0-1: axis in which this splitting plane lies
+		// Bit 2: has a left child (at index + 1)
+		// Bits 3-31: index of the right child (0 -> no right child, root can never be one)
+		unsigned int flags = 0;
+
+		int axis() const { return flags & AXIS_MASK; }
+		unsigned int left(unsigned int index) const { return (flags & HAS_LEFT) ? index + 1 : NO_NODE; }
+		unsigned int right() const { return (flags >> RIGHT_SHIFT) != 0 ? flags >> RIGHT_SHIFT : NO_NODE; }
+		bool isLeaf() const { return (flags & ~AXIS_MASK) == 0; }
+
+		void setAxis(int axis) { flags = (flags & ~AXIS_MASK) | (unsigned int)axis; }
+		void setLeft() { flags |= HAS_LEFT; }
+		void setRight(unsigned int index) { flags = (flags & ((1u << RIGHT_SHIFT) - 1)) | (index << RIGHT_SHIFT); }
+
+		static constexpr unsigned int AXIS_MASK = 3;
+		static constexpr unsigned int HAS_LEFT = 4;
+		static constexpr unsigned int RIGHT_SHIFT = 3;
+	};
+
+	static_assert(sizeof(Node) == 8, "kd-tree nodes should stay 8 bytes");
+
 
 	struct Ray
 	{
-		Ray(Vector origin, Vector direction, float distance) : origin(origin), direction(direction), distance(distance) {}
+		Ray(Vector origin, Vector direction, float distance, bool cullBackfaces = false)
+			: origin(origin), direction(direction), distance(distance), cullBackfaces(cullBackfaces) {}
 
 		Vector origin;
 		Vector direction;
 		float distance = 0;
+		// Skip triangles facing away from the ray (clockwise as seen from the origin), e.g. for closed meshes
+		bool cullBackfaces = false;
+		// Front faces are wound clockwise instead, for rays in the object space of mirrored instances
+		bool clockwiseFrontFaces = false;
+	};
+
+	/// <summary>
+	/// Distribution of a per query count in power of two buckets:
+	/// bucket 0 holds 0, bucket i holds [2^(i-1), 2^i).
+	/// </summary>
+	struct Histogram
+	{
+		static constexpr int BUCKET_COUNT = 33;
+
+		void add(unsigned int value)
+		{
+			int bucket = 0;
+			while (bucket < BUCKET_COUNT - 1 && value >= (1ull << bucket))
+				bucket++;
+			buckets[bucket]++;
+			count++;
+			max = value > max ? value : max;
+		}
+
+		static unsigned long long getBucketMin(int bucket) { return bucket == 0 ? 0 : 1ull << (bucket - 1); }
+
+		/// <summary>
+		/// Upper end of the bucket containing the given fraction (0..1) of the values, e.g. 0.95 for the 95th percentile.
+		/// </summary>
+		unsigned long long getPercentile(double fraction) const
+		{
+			unsigned long long seen = 0;
+			for (int bucket = 0; bucket < BUCKET_COUNT; bucket++)
+			{
+				seen += buckets[bucket];
+				if (seen > 0 && seen >= fraction * count)
+					return bucket == 0 ? 0 : (1ull << bucket) - 1;
+			}
+			return max;
+		}
+
+		void merge(const Histogram& other)
+		{
+			for (int bucket = 0; bucket < BUCKET_COUNT; bucket++)
+				buckets[bucket] += other.buckets[bucket];
+			count += other.count;
+			max = other.max > max ? other.max : max;
+		}
+
+		void print() const
+		{
+			for (int bucket = 0; bucket < BUCKET_COUNT; bucket++)
+			{
+				if (buckets[bucket] == 0)
+					continue;
+				if (bucket == 0)
+					std::cout << "  0: ";
+				else
+					std::cout << "  " << getBucketMin(bucket) << "-" << (1ull << bucket) - 1 << ": ";
+				std::cout << buckets[bucket]
+					<< " (" << 100.0 * buckets[bucket] / count << "%)" << std::endl;
+			}
+		}
+
+		unsigned long long buckets[BUCKET_COUNT] = {};
+		unsigned long long count = 0;
+		unsigned int max = 0;
+	};
+
+	/// <summary>
+	/// Work done by ray queries, summed up over all queries it was passed to.
+	/// Only the query overloads taking stats count, the normal ones have no counters compiled in.
+	/// Not thread safe, use one per thread and merge them.
+	/// </summary>
+	struct TraversalStats
+	{
+		void beginRay()
+		{
+			rays++;
+			rayNodes = 0;
+			rayTriangles = 0;
+		}
+		void endRay()
+		{
+			nodesPerRay.add(rayNodes);
+			trianglesPerRay.add(rayTriangles);
+		}
+		void visitNode()
+		{
+			nodesVisited++;
+			rayNodes++;
+		}
+		void testTriangles(unsigned int count)
+		{
+			trianglesTested += count;
+			rayTriangles += count;
+		}
+		// The far child was not visited because the closest hit so far is in front of the splitting plane.
+		void skipFarChild() { farChildSkips++; }
+		// The query stopped before traversing its whole segment: an occlusion query at its first hit,
+		// a raycast because its hit is in front of all remaining far nodes.
+		void terminateEarly() { earlyTerminations++; }
+
+		void merge(const TraversalStats& other)
+		{
+			rays += other.rays;
+			nodesVisited += other.nodesVisited;
+			trianglesTested += other.trianglesTested;
+			farChildSkips += other.farChildSkips;
+			earlyTerminations += other.earlyTerminations;
+			nodesPerRay.merge(other.nodesPerRay);
+			trianglesPerRay.merge(other.trianglesPerRay);
+		}
+
+		void print() const
+		{
+			double rayCount = rays > 0 ? (double)rays : 1.0;
+			std::cout << "Rays: " << rays << std::endl;
+			std::cout << "Nodes visited: " << nodesVisited << " (" << nodesVisited / rayCount << " per ray, max " << nodesPerRay.max << ")" << std::endl;
+			std::cout << "Triangles tested: " << trianglesTested << " (" << trianglesTested / rayCount << " per ray, max " << trianglesPerRay.max << ")" << std::endl;
+			std::cout << "Far child skips: " << farChildSkips << std::endl;
+			std::cout << "Early terminations: " << earlyTerminations << std::endl;
+			std::cout << "Nodes per ray:" << std::endl;
+			nodesPerRay.print();
+			std::cout << "Triangles per ray:" << std::endl;
+			trianglesPerRay.print();
+		}
+
+		unsigned long long rays = 0;
+		unsigned long long nodesVisited = 0;
+		unsigned long long trianglesTested = 0;
+		unsigned long long farChildSkips = 0;
+		unsigned long long earlyTerminations = 0;
+		Histogram nodesPerRay;
+		Histogram trianglesPerRay;
+
+	private:
+		// Counts of the current query
+		unsigned int rayNodes = 0;
+		unsigned int rayTriangles = 0;
+	};
+
+	/// <summary>
+	/// Stats policy of the normal queries, the calls are optimized away.
+	/// </summary>
+	struct NoTraversalStats
+	{
+		void visitNode() {}
+		void testTriangles(unsigned int) {}
+		void skipFarChild() {}
+		void terminateEarly() {}
+	};
+
+	/// <summary>
+	/// Result of the point queries (nearest, withinRadius).
+	/// </summary>
+	struct PointHit
+	{
+		PointHit() = default;
+		PointHit(unsigned int point, float distanceSquared) : point(point), distanceSquared(distanceSquared) {}
+
+		// Closer first, ties are ordered by point index.
+		bool operator<(const PointHit& other) const
+		{
+			return distanceSquared < other.distanceSquared || (distanceSquared == other.distanceSquared && point < other.point);
+		}
+
+		// Index of the point in the tree (see KdTree::getPointPosition)
+		unsigned int point = 0;
+		float distanceSquared = 0;
 	};
 
 	struct RayHit
 	{
-		RayHit(Triangle* triangle, Vector position, float distance) : triangle(triangle), position(position), distance(distance) {}
+		RayHit() = default;
+		RayHit(const Triangle* triangle, Vector position, float distance) : triangle(triangle), position(position), distance(distance) {}
 
-		Triangle* triangle = nullptr;
+		const Triangle* triangle = nullptr;
 		Vector position;
-		float distance = 0;
+		float distance = std::numeric_limits<float>::max();
 	};
-}
\ No newline at end of file
+
+	/// <summary>
+	/// Results of a ray batch as structure of arrays, index i belongs to ray i.
+	/// Owned by the caller and reused between batches, so it only allocates when it grows.
+	/// </summary>
+	struct RayHitBuffer
+	{
+		void resize(size_t count)
+		{
+			triangles.resize(count);
+			distances.resize(count);
+			positionsX.resize(count);
+			positionsY.resize(count);
+			positionsZ.resize(count);
+		}
+
+		size_t size() const { return triangles.size(); }
+		bool isHit(size_t index) const { return triangles[index] != nullptr; }
+		Vector position(size_t index) const { return Vector(positionsX[index], positionsY[index], positionsZ[index]); }
+
+		// nullptr -> ray did not hit anything
+		std::vector<const Triangle*> triangles;
+		std::vector<float> distances;
+		std::vector<float> positionsX;
+		std::vector<float> positionsY;
+		std::vector<float> positionsZ;
+	};
+
+	/// <summary>
+	/// Read-only view of a contiguous array (owned by a vector or inside a mapped file).
+	/// </summary>
+	template <typename T>
+	struct ArrayView
+	{
+		ArrayView() = default;
+		ArrayView(const T* data, size_t size) : values(data), count(size) {}
+		ArrayView(const std::vector<T>& vector) : values(vector.data()), count(vector.size()) {}
+
+		const T& operator[](size_t i) const { return values[i]; }
+		const T* data() const { return values; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		const T* begin() const { return values; }
+		const T* end() const { return values + count; }
+
+		const T* values = nullptr;
+		size_t count = 0;
+	};
+
+	static_assert(std::is_trivially_copyable<Ray>::value && std::is_trivially_copyable<RayHit>::value, "Rays and hits are copied by value");
+	static_assert(std::is_trivially_copyable<Triangle>::value, "Triangles are stored by value");
+}
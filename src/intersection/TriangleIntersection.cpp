@@ -0,0 +1,660 @@
+#include "TriangleIntersection.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define KD_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows AVX intrinsics everywhere, GCC/Clang need them enabled per function.
+#if defined(KD_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define KD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KD_TARGET_AVX2
+#endif
+
+namespace KdStructs {
+
+	namespace {
+		const float EPSILON = 0.0000001f;
+
+		/// <summary>
+		/// Per-ray setup of the watertight test: the axes are permuted so the direction is largest along z
+		/// and the ray is sheared onto the z axis, so the triangles only have to be tested in 2D.
+		/// </summary>
+		struct RayShear
+		{
+			RayShear() = default;
+			explicit RayShear(const Ray& ray)
+			{
+				kz = 0;
+				for (int axis = 1; axis < 3; axis++)
+					if (std::fabs(ray.direction[axis]) > std::fabs(ray.direction[kz]))
+						kz = axis;
+				kx = (kz + 1) % 3;
+				ky = (kx + 1) % 3;
+				// Keeps the winding of the triangles (and with it the sign of front faces).
+				if (ray.direction[kz] < 0)
+					std::swap(kx, ky);
+
+				x = ray.direction[kx] / ray.direction[kz];
+				y = ray.direction[ky] / ray.direction[kz];
+				z = 1.0f / ray.direction[kz];
+			}
+
+			int kx = 0;
+			int ky = 1;
+			int kz = 2;
+			float x = 0;
+			float y = 0;
+			float z = 1;
+		};
+
+		/// <summary>
+		/// Scalar Moller-Trumbore with precomputed edges.
+		/// https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+		/// </summary>
+		inline float intersect(const Vector& v0, const Vector& edge1, const Vector& edge2, const Ray& ray)
+		{
+			Vector h = ray.direction.cross(edge2);
+			float a = edge1.dot(h);
+
+			// This ray is parallel to this triangle (or hits its back, a < 0).
+			float facing = ray.clockwiseFrontFaces ? -a : a;
+			if (ray.cullBackfaces ? facing < EPSILON : (a > -EPSILON && a < EPSILON))
+				return -1;
+
+			float f = 1.0f / a;
+			Vector s = ray.origin - v0;
+			float u = f * s.dot(h);
+
+			if (u < 0 || u > 1)
+				return -1;
+
+			Vector q = s.cross(edge1);
+			float v = f * ray.direction.dot(q);
+
+			if (v < 0 || u + v > 1)
+				return -1;
+
+			float t = f * edge2.dot(q);
+
+			if (t > EPSILON) {
+				return t;
+			}
+
+			return -1;
+		}
+
+		/// <summary>
+		/// Scalar watertight test (Woop, Benthin, Wald: Watertight Ray/Triangle Intersection, 2013).
+		/// The edge functions of a shared edge are computed from the same (permuted and sheared) coordinates
+		/// by both triangles and only differ in sign, so with inclusive tests one of them always accepts the hit.
+		/// </summary>
+		inline float intersectWatertight(const Vector& v0, const Vector& v1, const Vector& v2, const Ray& ray, const RayShear& shear)
+		{
+			Vector a = v0 - ray.origin;
+			Vector b = v1 - ray.origin;
+			Vector c = v2 - ray.origin;
+			float ax = a[shear.kx] - shear.x * a[shear.kz];
+			float ay = a[shear.ky] - shear.y * a[shear.kz];
+			float bx = b[shear.kx] - shear.x * b[shear.kz];
+			float by = b[shear.ky] - shear.y * b[shear.kz];
+			float cx = c[shear.kx] - shear.x * c[shear.kz];
+			float cy = c[shear.ky] - shear.y * c[shear.kz];
+
+			// Scaled barycentric coordinates, all >= 0 for front faces and all <= 0 for back faces.
+			float u = cx * by - cy * bx;
+			float v = ax * cy - ay * cx;
+			float w = bx * ay - by * ax;
+			bool front = u >= 0 && v >= 0 && w >= 0;
+			bool back = u <= 0 && v <= 0 && w <= 0;
+			if (ray.clockwiseFrontFaces)
+				std::swap(front, back);
+			if (!front && (!back || ray.cullBackfaces))
+				return -1;
+
+			// Ray in the plane of the triangle (or degenerate triangle)
+			float determinant = u + v + w;
+			if (determinant == 0)
+				return -1;
+
+			float t = (u * (shear.z * a[shear.kz]) + v * (shear.z * b[shear.kz]) + w * (shear.z * c[shear.kz])) / determinant;
+			return t > EPSILON ? t : -1;
+		}
+
+		template <TriangleTest test>
+		inline float intersectLane(const TriangleBlock& triangles, int lane, const Ray& ray, const RayShear& shear)
+		{
+			Vector v0(triangles.v0[0][lane], triangles.v0[1][lane], triangles.v0[2][lane]);
+			Vector v1(triangles.v1[0][lane], triangles.v1[1][lane], triangles.v1[2][lane]);
+			Vector v2(triangles.v2[0][lane], triangles.v2[1][lane], triangles.v2[2][lane]);
+			if constexpr (test == TriangleTest::WATERTIGHT)
+				return intersectWatertight(v0, v1, v2, ray, shear);
+			else
+				return intersect(v0, v1 - v0, v2 - v0, ray);
+		}
+
+		template <TriangleTest test>
+		unsigned int intersectBlocksScalar(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float& distance)
+		{
+			RayShear shear = test == TriangleTest::WATERTIGHT ? RayShear(ray) : RayShear();
+			unsigned int closestTriangle = NO_TRIANGLE;
+			for (unsigned int block = 0; block < blockCount; block++)
+				for (int lane = 0; lane < TriangleBlock::LANES; lane++)
+				{
+					const TriangleBlock& triangles = blocks[block];
+					float t = intersectLane<test>(triangles, lane, ray, shear);
+					if (t < 0 || t > distance)
+						continue;
+
+					distance = t;
+					closestTriangle = triangles.triangles[lane];
+				}
+			return closestTriangle;
+		}
+
+		template <TriangleTest test>
+		bool occludedBlocksScalar(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float maxDistance)
+		{
+			RayShear shear = test == TriangleTest::WATERTIGHT ? RayShear(ray) : RayShear();
+			for (unsigned int block = 0; block < blockCount; block++)
+				for (int lane = 0; lane < TriangleBlock::LANES; lane++)
+				{
+					float t = intersectLane<test>(blocks[block], lane, ray, shear);
+					if (t >= 0 && t < maxDistance)
+						return true;
+				}
+			return false;
+		}
+
+#ifdef KD_SIMD_X86
+		// Same operations (and order) as the scalar versions, so all kernels return the same distances.
+
+		/// <summary>
+		/// Ray broadcast to all lanes, with the setup of the watertight test.
+		/// </summary>
+		struct SseRay
+		{
+			__m128 origin[3];
+			__m128 direction[3];
+			RayShear shear;
+			__m128 shearX, shearY, shearZ;
+			bool cullBackfaces;
+			bool clockwiseFrontFaces;
+		};
+
+		template <TriangleTest test>
+		inline void loadRaySse(const Ray& ray, SseRay& sseRay)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				sseRay.origin[axis] = _mm_set1_ps(ray.origin[axis]);
+				sseRay.direction[axis] = _mm_set1_ps(ray.direction[axis]);
+			}
+			if constexpr (test == TriangleTest::WATERTIGHT)
+			{
+				sseRay.shear = RayShear(ray);
+				sseRay.shearX = _mm_set1_ps(sseRay.shear.x);
+				sseRay.shearY = _mm_set1_ps(sseRay.shear.y);
+				sseRay.shearZ = _mm_set1_ps(sseRay.shear.z);
+			}
+			sseRay.cullBackfaces = ray.cullBackfaces;
+			sseRay.clockwiseFrontFaces = ray.clockwiseFrontFaces;
+		}
+
+		/// <summary>
+		/// Tests one block (4 triangles) against the ray with Moller-Trumbore.
+		/// Returns the mask of hit lanes, t holds the distances.
+		/// </summary>
+		inline __m128 testBlockSse(const TriangleBlock& triangles, const SseRay& ray, __m128& t)
+		{
+			const __m128* origin = ray.origin;
+			const __m128* direction = ray.direction;
+			__m128 v0X = _mm_load_ps(triangles.v0[0]), v0Y = _mm_load_ps(triangles.v0[1]), v0Z = _mm_load_ps(triangles.v0[2]);
+			__m128 edge1X = _mm_sub_ps(_mm_load_ps(triangles.v1[0]), v0X);
+			__m128 edge1Y = _mm_sub_ps(_mm_load_ps(triangles.v1[1]), v0Y);
+			__m128 edge1Z = _mm_sub_ps(_mm_load_ps(triangles.v1[2]), v0Z);
+			__m128 edge2X = _mm_sub_ps(_mm_load_ps(triangles.v2[0]), v0X);
+			__m128 edge2Y = _mm_sub_ps(_mm_load_ps(triangles.v2[1]), v0Y);
+			__m128 edge2Z = _mm_sub_ps(_mm_load_ps(triangles.v2[2]), v0Z);
+
+			// h = direction x edge2
+			__m128 hX = _mm_sub_ps(_mm_mul_ps(direction[1], edge2Z), _mm_mul_ps(direction[2], edge2Y));
+			__m128 hY = _mm_sub_ps(_mm_mul_ps(direction[2], edge2X), _mm_mul_ps(direction[0], edge2Z));
+			__m128 hZ = _mm_sub_ps(_mm_mul_ps(direction[0], edge2Y), _mm_mul_ps(direction[1], edge2X));
+			__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, hX), _mm_mul_ps(edge1Y, hY)), _mm_mul_ps(edge1Z, hZ));
+			__m128 front = _mm_cmpge_ps(a, _mm_set1_ps(EPSILON));
+			__m128 back = _mm_cmple_ps(a, _mm_set1_ps(-EPSILON));
+			if (ray.clockwiseFrontFaces)
+				std::swap(front, back);
+			__m128 valid = front;
+			if (ray.cullBackfaces) {
+				// Only back faces (or parallel) in this block, the rest can be skipped.
+				t = _mm_setzero_ps();
+				if (_mm_movemask_ps(valid) == 0)
+					return valid;
+			}
+			else
+				valid = _mm_or_ps(front, back);
+			__m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+			__m128 sX = _mm_sub_ps(origin[0], v0X);
+			__m128 sY = _mm_sub_ps(origin[1], v0Y);
+			__m128 sZ = _mm_sub_ps(origin[2], v0Z);
+			__m128 u = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, hX), _mm_mul_ps(sY, hY)), _mm_mul_ps(sZ, hZ)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, _mm_setzero_ps()), _mm_cmple_ps(u, _mm_set1_ps(1.0f))));
+
+			// q = s x edge1
+			__m128 qX = _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y));
+			__m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z));
+			__m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X));
+			__m128 v = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], qX), _mm_mul_ps(direction[1], qY)), _mm_mul_ps(direction[2], qZ)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, _mm_setzero_ps()), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f))));
+
+			t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)));
+			return _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(EPSILON)));
+		}
+
+		/// <summary>
+		/// Same as testBlockSse with the watertight test.
+		/// </summary>
+		inline __m128 testBlockWatertightSse(const TriangleBlock& triangles, const SseRay& ray, __m128& t)
+		{
+			int kx = ray.shear.kx, ky = ray.shear.ky, kz = ray.shear.kz;
+			__m128 aZ = _mm_sub_ps(_mm_load_ps(triangles.v0[kz]), ray.origin[kz]);
+			__m128 bZ = _mm_sub_ps(_mm_load_ps(triangles.v1[kz]), ray.origin[kz]);
+			__m128 cZ = _mm_sub_ps(_mm_load_ps(triangles.v2[kz]), ray.origin[kz]);
+			__m128 aX = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v0[kx]), ray.origin[kx]), _mm_mul_ps(ray.shearX, aZ));
+			__m128 aY = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v0[ky]), ray.origin[ky]), _mm_mul_ps(ray.shearY, aZ));
+			__m128 bX = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v1[kx]), ray.origin[kx]), _mm_mul_ps(ray.shearX, bZ));
+			__m128 bY = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v1[ky]), ray.origin[ky]), _mm_mul_ps(ray.shearY, bZ));
+			__m128 cX = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v2[kx]), ray.origin[kx]), _mm_mul_ps(ray.shearX, cZ));
+			__m128 cY = _mm_sub_ps(_mm_sub_ps(_mm_load_ps(triangles.v2[ky]), ray.origin[ky]), _mm_mul_ps(ray.shearY, cZ));
+
+			__m128 u = _mm_sub_ps(_mm_mul_ps(cX, bY), _mm_mul_ps(cY, bX));
+			__m128 v = _mm_sub_ps(_mm_mul_ps(aX, cY), _mm_mul_ps(aY, cX));
+			__m128 w = _mm_sub_ps(_mm_mul_ps(bX, aY), _mm_mul_ps(bY, aX));
+			__m128 zero = _mm_setzero_ps();
+			__m128 front = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)), _mm_cmpge_ps(w, zero));
+			__m128 back = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(u, zero), _mm_cmple_ps(v, zero)), _mm_cmple_ps(w, zero));
+			if (ray.clockwiseFrontFaces)
+				std::swap(front, back);
+			__m128 valid = ray.cullBackfaces ? front : _mm_or_ps(front, back);
+			t = zero;
+			// No triangle of the block contains the ray
+			if (_mm_movemask_ps(valid) == 0)
+				return valid;
+
+			__m128 determinant = _mm_add_ps(_mm_add_ps(u, v), w);
+			valid = _mm_and_ps(valid, _mm_cmpneq_ps(determinant, zero));
+			__m128 scaledT = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(u, _mm_mul_ps(ray.shearZ, aZ)),
+				_mm_mul_ps(v, _mm_mul_ps(ray.shearZ, bZ))),
+				_mm_mul_ps(w, _mm_mul_ps(ray.shearZ, cZ)));
+			t = _mm_div_ps(scaledT, determinant);
+			return _mm_and_ps(valid, _mm_cmpgt_ps(t, _mm_set1_ps(EPSILON)));
+		}
+
+		template <TriangleTest test>
+		inline __m128 testBlock(const TriangleBlock& triangles, const SseRay& ray, __m128& t)
+		{
+			if constexpr (test == TriangleTest::WATERTIGHT)
+				return testBlockWatertightSse(triangles, ray, t);
+			else
+				return testBlockSse(triangles, ray, t);
+		}
+
+		template <TriangleTest test>
+		unsigned int intersectBlocksSse(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float& distance)
+		{
+			SseRay sseRay;
+			loadRaySse<test>(ray, sseRay);
+
+			unsigned int closestTriangle = NO_TRIANGLE;
+			for (unsigned int block = 0; block < blockCount; block++)
+			{
+				__m128 t;
+				__m128 valid = testBlock<test>(blocks[block], sseRay, t);
+				valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_set1_ps(distance)));
+				int hitMask = _mm_movemask_ps(valid);
+				if (hitMask == 0)
+					continue;
+
+				alignas(16) float distances[TriangleBlock::LANES];
+				_mm_store_ps(distances, t);
+				for (int lane = 0; lane < TriangleBlock::LANES; lane++)
+					if ((hitMask & (1 << lane)) && distances[lane] <= distance)
+					{
+						distance = distances[lane];
+						closestTriangle = blocks[block].triangles[lane];
+					}
+			}
+			return closestTriangle;
+		}
+
+		template <TriangleTest test>
+		bool occludedBlocksSse(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float maxDistance)
+		{
+			SseRay sseRay;
+			loadRaySse<test>(ray, sseRay);
+
+			for (unsigned int block = 0; block < blockCount; block++)
+			{
+				__m128 t;
+				__m128 valid = testBlock<test>(blocks[block], sseRay, t);
+				if (_mm_movemask_ps(_mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(maxDistance)))) != 0)
+					return true;
+			}
+			return false;
+		}
+
+		KD_TARGET_AVX2 inline __m256 loadBlockPair(const float* first, const float* second)
+		{
+			return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(first)), _mm_load_ps(second), 1);
+		}
+
+		struct Avx2Ray
+		{
+			__m256 origin[3];
+			__m256 direction[3];
+			RayShear shear;
+			__m256 shearX, shearY, shearZ;
+			bool cullBackfaces;
+			bool clockwiseFrontFaces;
+		};
+
+		template <TriangleTest test>
+		KD_TARGET_AVX2 inline void loadRayAvx2(const Ray& ray, Avx2Ray& avx2Ray)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				avx2Ray.origin[axis] = _mm256_set1_ps(ray.origin[axis]);
+				avx2Ray.direction[axis] = _mm256_set1_ps(ray.direction[axis]);
+			}
+			if constexpr (test == TriangleTest::WATERTIGHT)
+			{
+				avx2Ray.shear = RayShear(ray);
+				avx2Ray.shearX = _mm256_set1_ps(avx2Ray.shear.x);
+				avx2Ray.shearY = _mm256_set1_ps(avx2Ray.shear.y);
+				avx2Ray.shearZ = _mm256_set1_ps(avx2Ray.shear.z);
+			}
+			avx2Ray.cullBackfaces = ray.cullBackfaces;
+			avx2Ray.clockwiseFrontFaces = ray.clockwiseFrontFaces;
+		}
+
+		/// <summary>
+		/// Same as testBlockSse for two blocks (8 triangles) at once.
+		/// </summary>
+		KD_TARGET_AVX2 inline __m256 testBlockPairAvx2(const TriangleBlock& first, const TriangleBlock& second, const Avx2Ray& ray, __m256& t)
+		{
+			const __m256* origin = ray.origin;
+			const __m256* direction = ray.direction;
+			__m256 v0X = loadBlockPair(first.v0[0], second.v0[0]);
+			__m256 v0Y = loadBlockPair(first.v0[1], second.v0[1]);
+			__m256 v0Z = loadBlockPair(first.v0[2], second.v0[2]);
+			__m256 edge1X = _mm256_sub_ps(loadBlockPair(first.v1[0], second.v1[0]), v0X);
+			__m256 edge1Y = _mm256_sub_ps(loadBlockPair(first.v1[1], second.v1[1]), v0Y);
+			__m256 edge1Z = _mm256_sub_ps(loadBlockPair(first.v1[2], second.v1[2]), v0Z);
+			__m256 edge2X = _mm256_sub_ps(loadBlockPair(first.v2[0], second.v2[0]), v0X);
+			__m256 edge2Y = _mm256_sub_ps(loadBlockPair(first.v2[1], second.v2[1]), v0Y);
+			__m256 edge2Z = _mm256_sub_ps(loadBlockPair(first.v2[2], second.v2[2]), v0Z);
+
+			// h = direction x edge2
+			__m256 hX = _mm256_sub_ps(_mm256_mul_ps(direction[1], edge2Z), _mm256_mul_ps(direction[2], edge2Y));
+			__m256 hY = _mm256_sub_ps(_mm256_mul_ps(direction[2], edge2X), _mm256_mul_ps(direction[0], edge2Z));
+			__m256 hZ = _mm256_sub_ps(_mm256_mul_ps(direction[0], edge2Y), _mm256_mul_ps(direction[1], edge2X));
+			__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, hX), _mm256_mul_ps(edge1Y, hY)), _mm256_mul_ps(edge1Z, hZ));
+			__m256 front = _mm256_cmp_ps(a, _mm256_set1_ps(EPSILON), _CMP_GE_OQ);
+			__m256 back = _mm256_cmp_ps(a, _mm256_set1_ps(-EPSILON), _CMP_LE_OQ);
+			if (ray.clockwiseFrontFaces)
+				std::swap(front, back);
+			__m256 valid = front;
+			if (ray.cullBackfaces) {
+				t = _mm256_setzero_ps();
+				if (_mm256_movemask_ps(valid) == 0)
+					return valid;
+			}
+			else
+				valid = _mm256_or_ps(front, back);
+			__m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+			__m256 sX = _mm256_sub_ps(origin[0], v0X);
+			__m256 sY = _mm256_sub_ps(origin[1], v0Y);
+			__m256 sZ = _mm256_sub_ps(origin[2], v0Z);
+			__m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, hX), _mm256_mul_ps(sY, hY)), _mm256_mul_ps(sZ, hZ)));
+			valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(u, _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+
+			// q = s x edge1
+			__m256 qX = _mm256_sub_ps(_mm256_mul_ps(sY, edge1Z), _mm256_mul_ps(sZ, edge1Y));
+			__m256 qY = _mm256_sub_ps(_mm256_mul_ps(sZ, edge1X), _mm256_mul_ps(sX, edge1Z));
+			__m256 qZ = _mm256_sub_ps(_mm256_mul_ps(sX, edge1Y), _mm256_mul_ps(sY, edge1X));
+			__m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction[0], qX), _mm256_mul_ps(direction[1], qY)), _mm256_mul_ps(direction[2], qZ)));
+			valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+
+			t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2X, qX), _mm256_mul_ps(edge2Y, qY)), _mm256_mul_ps(edge2Z, qZ)));
+			return _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(EPSILON), _CMP_GT_OQ));
+		}
+
+		/// <summary>
+		/// Same as testBlockWatertightSse for two blocks (8 triangles) at once.
+		/// </summary>
+		KD_TARGET_AVX2 inline __m256 testBlockPairWatertightAvx2(const TriangleBlock& first, const TriangleBlock& second, const Avx2Ray& ray, __m256& t)
+		{
+			int kx = ray.shear.kx, ky = ray.shear.ky, kz = ray.shear.kz;
+			__m256 aZ = _mm256_sub_ps(loadBlockPair(first.v0[kz], second.v0[kz]), ray.origin[kz]);
+			__m256 bZ = _mm256_sub_ps(loadBlockPair(first.v1[kz], second.v1[kz]), ray.origin[kz]);
+			__m256 cZ = _mm256_sub_ps(loadBlockPair(first.v2[kz], second.v2[kz]), ray.origin[kz]);
+			__m256 aX = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v0[kx], second.v0[kx]), ray.origin[kx]), _mm256_mul_ps(ray.shearX, aZ));
+			__m256 aY = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v0[ky], second.v0[ky]), ray.origin[ky]), _mm256_mul_ps(ray.shearY, aZ));
+			__m256 bX = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v1[kx], second.v1[kx]), ray.origin[kx]), _mm256_mul_ps(ray.shearX, bZ));
+			__m256 bY = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v1[ky], second.v1[ky]), ray.origin[ky]), _mm256_mul_ps(ray.shearY, bZ));
+			__m256 cX = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v2[kx], second.v2[kx]), ray.origin[kx]), _mm256_mul_ps(ray.shearX, cZ));
+			__m256 cY = _mm256_sub_ps(_mm256_sub_ps(loadBlockPair(first.v2[ky], second.v2[ky]), ray.origin[ky]), _mm256_mul_ps(ray.shearY, cZ));
+
+			__m256 u = _mm256_sub_ps(_mm256_mul_ps(cX, bY), _mm256_mul_ps(cY, bX));
+			__m256 v = _mm256_sub_ps(_mm256_mul_ps(aX, cY), _mm256_mul_ps(aY, cX));
+			__m256 w = _mm256_sub_ps(_mm256_mul_ps(bX, aY), _mm256_mul_ps(bY, aX));
+			__m256 zero = _mm256_setzero_ps();
+			__m256 front = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)), _mm256_cmp_ps(w, zero, _CMP_GE_OQ));
+			__m256 back = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_LE_OQ), _mm256_cmp_ps(v, zero, _CMP_LE_OQ)), _mm256_cmp_ps(w, zero, _CMP_LE_OQ));
+			if (ray.clockwiseFrontFaces)
+				std::swap(front, back);
+			__m256 valid = ray.cullBackfaces ? front : _mm256_or_ps(front, back);
+			t = zero;
+			if (_mm256_movemask_ps(valid) == 0)
+				return valid;
+
+			__m256 determinant = _mm256_add_ps(_mm256_add_ps(u, v), w);
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(determinant, zero, _CMP_NEQ_UQ));
+			__m256 scaledT = _mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(u, _mm256_mul_ps(ray.shearZ, aZ)),
+				_mm256_mul_ps(v, _mm256_mul_ps(ray.shearZ, bZ))),
+				_mm256_mul_ps(w, _mm256_mul_ps(ray.shearZ, cZ)));
+			t = _mm256_div_ps(scaledT, determinant);
+			return _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(EPSILON), _CMP_GT_OQ));
+		}
+
+		template <TriangleTest test>
+		KD_TARGET_AVX2 inline __m256 testBlockPair(const TriangleBlock& first, const TriangleBlock& second, const Avx2Ray& ray, __m256& t)
+		{
+			if constexpr (test == TriangleTest::WATERTIGHT)
+				return testBlockPairWatertightAvx2(first, second, ray, t);
+			else
+				return testBlockPairAvx2(first, second, ray, t);
+		}
+
+		template <TriangleTest test>
+		KD_TARGET_AVX2 unsigned int intersectBlocksAvx2(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float& distance)
+		{
+			Avx2Ray avx2Ray;
+			loadRayAvx2<test>(ray, avx2Ray);
+
+			unsigned int closestTriangle = NO_TRIANGLE;
+			unsigned int block = 0;
+			for (; block + 1 < blockCount; block += 2)
+			{
+				const TriangleBlock& first = blocks[block];
+				const TriangleBlock& second = blocks[block + 1];
+				__m256 t;
+				__m256 valid = testBlockPair<test>(first, second, avx2Ray, t);
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(distance), _CMP_LE_OQ));
+				int hitMask = _mm256_movemask_ps(valid);
+				if (hitMask == 0)
+					continue;
+
+				alignas(32) float distances[2 * TriangleBlock::LANES];
+				_mm256_store_ps(distances, t);
+				for (int lane = 0; lane < 2 * TriangleBlock::LANES; lane++)
+					if ((hitMask & (1 << lane)) && distances[lane] <= distance)
+					{
+						distance = distances[lane];
+						closestTriangle = lane < TriangleBlock::LANES ? first.triangles[lane] : second.triangles[lane - TriangleBlock::LANES];
+					}
+			}
+
+			// Odd block at the end
+			if (block < blockCount)
+			{
+				unsigned int triangle = intersectBlocksSse<test>(&blocks[block], 1, ray, distance);
+				if (triangle != NO_TRIANGLE)
+					closestTriangle = triangle;
+			}
+			return closestTriangle;
+		}
+
+		template <TriangleTest test>
+		KD_TARGET_AVX2 bool occludedBlocksAvx2(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float maxDistance)
+		{
+			Avx2Ray avx2Ray;
+			loadRayAvx2<test>(ray, avx2Ray);
+
+			unsigned int block = 0;
+			for (; block + 1 < blockCount; block += 2)
+			{
+				__m256 t;
+				__m256 valid = testBlockPair<test>(blocks[block], blocks[block + 1], avx2Ray, t);
+				if (_mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(maxDistance), _CMP_LT_OQ))) != 0)
+					return true;
+			}
+
+			return block < blockCount && occludedBlocksSse<test>(&blocks[block], 1, ray, maxDistance);
+		}
+#endif
+
+		template <TriangleTest test>
+		BlockIntersector getBlockIntersector(SimdLevel level)
+		{
+#ifdef KD_SIMD_X86
+			if (level == SimdLevel::AVX2)
+				return intersectBlocksAvx2<test>;
+			if (level == SimdLevel::SSE)
+				return intersectBlocksSse<test>;
+#endif
+			return intersectBlocksScalar<test>;
+		}
+
+		template <TriangleTest test>
+		BlockOccluder getBlockOccluder(SimdLevel level)
+		{
+#ifdef KD_SIMD_X86
+			if (level == SimdLevel::AVX2)
+				return occludedBlocksAvx2<test>;
+			if (level == SimdLevel::SSE)
+				return occludedBlocksSse<test>;
+#endif
+			return occludedBlocksScalar<test>;
+		}
+	}
+
+	float rayIntersectionWithTriangle(const Triangle& triangle, const Ray& ray)
+	{
+		return intersect(triangle.a, triangle.b - triangle.a, triangle.c - triangle.a, ray);
+	}
+
+	float rayIntersectionWithTriangleWatertight(const Triangle& triangle, const Ray& ray)
+	{
+		return intersectWatertight(triangle.a, triangle.b, triangle.c, ray, RayShear(ray));
+	}
+
+	void appendTriangleBlocks(const std::vector<Triangle>& triangles, const unsigned int* triangleIndices, unsigned int count, std::vector<TriangleBlock>& blocks)
+	{
+		for (unsigned int first = 0; first < count; first += TriangleBlock::LANES)
+		{
+			TriangleBlock block;
+			for (unsigned int lane = 0; lane < (unsigned int)TriangleBlock::LANES && first + lane < count; lane++)
+			{
+				const Triangle& triangle = triangles[triangleIndices[first + lane]];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					block.v0[axis][lane] = triangle.a[axis];
+					block.v1[axis][lane] = triangle.b[axis];
+					block.v2[axis][lane] = triangle.c[axis];
+				}
+				block.triangles[lane] = triangleIndices[first + lane];
+			}
+			blocks.push_back(block);
+		}
+	}
+
+	SimdLevel detectSimdLevel()
+	{
+#if defined(KD_SIMD_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		// AVX registers also have to be saved by the OS (OSXSAVE + XCR0).
+		bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		if (avx && maxLeaf >= 7) {
+			__cpuidex(info, 7, 0);
+			if (info[1] & (1 << 5))
+				return SimdLevel::AVX2;
+		}
+		return sse2 ? SimdLevel::SSE : SimdLevel::SCALAR;
+#elif defined(KD_SIMD_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return SimdLevel::AVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return SimdLevel::SSE;
+		return SimdLevel::SCALAR;
+#else
+		return SimdLevel::SCALAR;
+#endif
+	}
+
+	BlockIntersector getBlockIntersector(SimdLevel level, TriangleTest test)
+	{
+		return test == TriangleTest::WATERTIGHT ? getBlockIntersector<TriangleTest::WATERTIGHT>(level) : getBlockIntersector<TriangleTest::MOLLER_TRUMBORE>(level);
+	}
+
+	BlockOccluder getBlockOccluder(SimdLevel level, TriangleTest test)
+	{
+		return test == TriangleTest::WATERTIGHT ? getBlockOccluder<TriangleTest::WATERTIGHT>(level) : getBlockOccluder<TriangleTest::MOLLER_TRUMBORE>(level);
+	}
+
+	const char* getSimdLevelName(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::AVX2:
+			return "AVX2";
+		case SimdLevel::SSE:
+			return "SSE";
+		default:
+			return "Scalar";
+		}
+	}
+
+	const char* getTriangleTestName(TriangleTest test)
+	{
+		return test == TriangleTest::WATERTIGHT ? "Watertight" : "Moller-Trumbore";
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+
+#include "Structures.h"
+
+namespace KdStructs {
+
+	/// <summary>
+	/// Four triangles in structure of arrays layout (one SIMD lane each). The corners are stored as they are
+	/// (not as edges), so triangles sharing an edge use exactly the same coordinates, which the watertight
+	/// test relies on. Unused lanes are all zero and never hit anything.
+	/// </summary>
+	struct alignas(16) TriangleBlock
+	{
+		static constexpr int LANES = 4;
+
+		float v0[3][LANES] = {};
+		float v1[3][LANES] = {};
+		float v2[3][LANES] = {};
+		// Index of the triangle in the tree's triangle list
+		unsigned int triangles[LANES] = {};
+	};
+
+	static_assert(sizeof(TriangleBlock) == 160, "Triangle blocks should stay tightly packed");
+
+	// Returned by the block kernels if no triangle was hit.
+	constexpr unsigned int NO_TRIANGLE = std::numeric_limits<unsigned int>::max();
+
+	enum class SimdLevel
+	{
+		SCALAR,
+		// 4 triangles per instruction
+		SSE,
+		// 8 triangles per instruction (two blocks)
+		AVX2,
+	};
+
+	enum class TriangleTest
+	{
+		// Moller-Trumbore with epsilon thresholds, rays can slip through between triangles sharing an edge
+		MOLLER_TRUMBORE,
+		// Shear based test (Woop, Benthin, Wald 2013) with inclusive edges, a ray hitting a shared edge
+		// or vertex always hits at least one of the triangles. A bit slower.
+		WATERTIGHT,
+	};
+
+	/// <summary>
+	/// Tests the ray against all triangles of the blocks.
+	/// Returns the triangle index of the closest hit with a distance up to the given one and
+	/// updates the distance, or NO_TRIANGLE if nothing was hit.
+	/// Back faces (clockwise as seen from the ray origin, like OpenGL) are skipped if ray.cullBackfaces is set,
+	/// ray.clockwiseFrontFaces swaps the winding of front and back faces.
+	/// </summary>
+	typedef unsigned int (*BlockIntersector)(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float& distance);
+
+	/// <summary>
+	/// Any-hit version: returns true as soon as a triangle is hit closer than maxDistance.
+	/// </summary>
+	typedef bool (*BlockOccluder)(const TriangleBlock* blocks, unsigned int blockCount, const Ray& ray, float maxDistance);
+
+	/// <summary>
+	/// Moller-Trumbore for a single triangle (respects ray.cullBackfaces).
+	/// Returns the distance along the ray or -1 if it was not hit.
+	/// </summary>
+	float rayIntersectionWithTriangle(const Triangle& triangle, const Ray& ray);
+	/// <summary>
+	/// Same as rayIntersectionWithTriangle with the watertight test.
+	/// </summary>
+	float rayIntersectionWithTriangleWatertight(const Triangle& triangle, const Ray& ray);
+
+	/// <summary>
+	/// Appends ceil(count / 4) blocks holding the given triangles.
+	/// </summary>
+	void appendTriangleBlocks(const std::vector<Triangle>& triangles, const unsigned int* triangleIndices, unsigned int count, std::vector<TriangleBlock>& blocks);
+
+	/// <summary>
+	/// Best instruction set supported by the CPU (and OS) this is running on.
+	/// </summary>
+	SimdLevel detectSimdLevel();
+	BlockIntersector getBlockIntersector(SimdLevel level, TriangleTest test = TriangleTest::MOLLER_TRUMBORE);
+	BlockOccluder getBlockOccluder(SimdLevel level, TriangleTest test = TriangleTest::MOLLER_TRUMBORE);
+	const char* getSimdLevelName(SimdLevel level);
+	const char* getTriangleTestName(TriangleTest test);
+}
@@ -1,3 +1,4 @@
+#include <memory>
 #include <stdexcept>
 #include <vector>
 #include <chrono>
@@ -19,6 +20,7 @@
 #include "world/ParticleSystem.h"
 #include "intersection/KdTree.h"
 #include "world/World.h"
+#include "util/GLState.h"
 
 // Defines the glfw window size
 #define SCREEN_WIDTH 1920.0f
@@ -37,6 +39,7 @@ ProceduralSystem* proceduralSystem;
 ParticleSystem* particleSystem;
 
 KdTree* kdTree;
+std::unique_ptr<ThreadPool> threadPool;
 
 void setupGLFW();
 void setupKdTree();
@@ -53,10 +56,10 @@ int main()
 {
 	setupGLFW();
 
+	auto start = std::chrono::high_resolution_clock::now();
 	world = new World(camera, light, SCREEN_WIDTH, SCREEN_HEIGHT);
-	proceduralSystem = new ProceduralSystem(SCREEN_WIDTH, SCREEN_HEIGHT, camera);
-	particleSystem = new ParticleSystem(camera);
-
+	proceduralSystem = new ProceduralSystem(SCREEN_WIDTH, SCREEN_HEIGHT);
+	particleSystem = new ParticleSystem();
 
 	Material material = Material("art/bricks2.jpg", "art/bricks2_normal.jpg", "art/bricks2_disp.jpg", GL_RGB);
 	material.ambientStrength = 0.1f;
@@ -83,6 +86,14 @@ int main()
 	world->Add(new Plane(material, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f)));
 
 	setupKdTree();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	// Programs are only compiled on the first run (or after changes), later runs load them from the cache.
+	// Programs not used yet (particles) keep building and are waited for on their first use.
+	std::cout << "\n[*] Shader programs: " << Shader::getCachedProgramCount() << " loaded from " << Shader::PROGRAM_CACHE_DIRECTORY
+		<< ", " << Shader::getCompiledProgramCount() << " compiled (" << Shader::getPendingProgramCount() << " still building)" << std::endl;
+	std::cout << "Shader time (waiting included): " << Shader::getBuildMicroseconds() << " microseconds." << std::endl;
+	std::cout << "Startup time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds." << std::endl;
 
 	std::chrono::high_resolution_clock clock;
 	auto lastFrameTime = clock.now();
@@ -118,6 +129,9 @@ int main()
 
 
 		printError();
+		GLState::BeginFrame();
+		// Reads back the programs the driver finished in the background, before they are used.
+		Shader::pollPendingPrograms();
 
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, true);
@@ -127,6 +141,8 @@ int main()
 		// Clear color buffer and depth buffer
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		// Refits the raycast structure if objects moved.
+		world->UpdateScene();
 		world->Render(wireframeModeActive);
 
 		proceduralSystem->Update(camera, wireframeModeActive);
@@ -183,7 +199,8 @@ int main()
 				" | P_To_Spawn(*,/): " + std::to_string(particleSystem->NumberOfParticlesToSpawn) +
 				" | P_Frequency(+,-): " + spawnFrequency +
 				" | P_Number: " + std::to_string(particleSystem->GetNumberOfParticles()) +
-				" | PG_Number: " + std::to_string(particleSystem->GetNumberOfGenerators());
+				" | PG_Number: " + std::to_string(particleSystem->GetNumberOfGenerators()) +
+				" | GL calls: " + std::to_string(GLState::GetLastFrame().issued) + " (" + std::to_string(GLState::GetLastFrame().skipped) + " skipped)";
 				//" | Tess_Level: " + tessAmount +
 				//" | Tess_Displ: " + tessDisplacement;
 			glfwSetWindowTitle(window, lastInput.c_str());
@@ -195,6 +212,8 @@ int main()
 		glfwPollEvents();
 	}
 
+	// Joins the workers before the GL teardown instead of leaving them running at exit.
+	threadPool.reset();
 	glfwTerminate();
 
 	return 0;
@@ -250,13 +269,21 @@ void setupKdTree()
 	// Kd-Tree
 	std::vector<float> vertices = world->GetWorldVertices();
 
-	std::cout << "\n[*] Building kd-tree" << std::endl;
+	threadPool = std::make_unique<ThreadPool>();
+
+	std::cout << "\n[*] Loading kd-tree (" << threadPool->GetThreadCount() << " threads)" << std::endl;
 	auto start = std::chrono::high_resolution_clock::now();
-	kdTree = new KdTree(&vertices[0], vertices.size() / 3);
+	// The cache file is rebuilt automatically if the world geometry changes.
+	kdTree = KdTree::loadOrBuild("kdtree.cache", &vertices[0], vertices.size() / 3, KdTree::BuildMode::SAH, threadPool.get());
 	auto end = std::chrono::high_resolution_clock::now();
-	std::cout << "[->] Done!" << std::endl;
-	std::cout << "Building time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds." << std::endl;
+	std::cout << "[->] Done! (" << (kdTree->isMapped() ? "loaded from kdtree.cache" : "built") << ")" << std::endl;
+	std::cout << "Loading time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds." << std::endl;
 	kdTree->printStatistics();
+
+	// Per-object trees for raycasts, follow moving objects
+	std::cout << "\n[*] Dynamic scene" << std::endl;
+	world->UpdateScene();
+	world->GetScene().printStatistics();
 }
 
 void HandleMouseClick()
@@ -268,17 +295,35 @@ void HandleMouseClick()
 	KdStructs::Vector direction = KdStructs::Vector(directionVector.x, directionVector.y, directionVector.z);
 
 	// Cast ray into scene
-	KdStructs::RayHit* hit = nullptr;
+	KdStructs::RayHit hit;
+	unsigned int object;
+	KdStructs::Ray ray = KdStructs::Ray(position, direction, 1000);
 
 	std::cout << "\n[*] Casting Ray." << std::endl;
 	auto start = std::chrono::high_resolution_clock::now();
-	kdTree->raycast(KdStructs::Ray(position, direction, 1000), hit);
+	bool hasHit = world->GetScene().raycast(ray, hit, object);
 	auto end = std::chrono::high_resolution_clock::now();
 	std::cout << "Raycast time: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds." << std::endl;
+
+	// Again with counters (not timed), shows why picking from some positions is slow.
+	KdStructs::TraversalStats stats;
+	world->GetScene().raycast(ray, hit, object, stats);
+	stats.print();
 	std::cout << std::endl;
 
-	if (hit != nullptr)
-		particleSystem->SpawnPosition = glm::vec3(hit->position[0], hit->position[1], hit->position[2]);
+	if (!hasHit)
+		return;
+
+	std::cout << "Hit object " << object << " at distance " << hit.distance << std::endl;
+
+	particleSystem->SpawnPosition = glm::vec3(hit.position[0], hit.position[1], hit.position[2]);
+
+	// Vertex closest to the hit (e.g. for snapping)
+	std::vector<KdStructs::PointHit> closestPoints;
+	if (kdTree->nearest(hit.position, 1, closestPoints) > 0) {
+		unsigned int point = closestPoints[0].point;
+		std::cout << "Closest vertex: " << kdTree->getPointPosition(point) << " (" << kdTree->getPointTriangles(point).size() << " triangles)" << std::endl;
+	}
 }
 
 #pragma region Input
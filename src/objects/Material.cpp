@@ -1,18 +1,42 @@
 #include "Material.h"
 
 #include <glad\glad.h>
+#include "../util/GLState.h"
+#include "../shaders/UniformBlocks.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb-image/stb_image.h"
 
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+	// One buffer per distinct material, kept until the program ends.
+	std::vector<std::unique_ptr<UniformBuffer<MaterialData>>> uniformBuffers;
+
+	const UniformBuffer<MaterialData>* GetUniformBuffer(const MaterialData& data)
+	{
+		for (const auto& buffer : uniformBuffers)
+		{
+			if (std::memcmp(&buffer->GetData(), &data, sizeof(data)) == 0)
+				return buffer.get();
+		}
+
+		uniformBuffers.push_back(std::make_unique<UniformBuffer<MaterialData>>(MATERIAL_DATA_BINDING));
+		uniformBuffers.back()->Update(data);
+		return uniformBuffers.back().get();
+	}
+}
 
 unsigned int Material::LoadTexture(const char* path, unsigned int colorFormat)
 {
 	//stbi_set_flip_vertically_on_load(true);
 	unsigned int texture;
 	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	GLState::BindTexture(GL_TEXTURE_2D, texture);
 
 	// Set texture wrapping options. S == x-axis | T == y-axis
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -36,4 +60,18 @@ unsigned int Material::LoadTexture(const char* path, unsigned int colorFormat)
 
 	stbi_image_free(data);
 	return texture;
+}
+
+void Material::BindUniformBuffer() const
+{
+	MaterialData data;
+	data.textureColor = color;
+	data.ambientStrength = ambientStrength;
+	data.diffuseStrength = diffuseStrength;
+	data.specularStrength = specularStrength;
+	data.focus = focus;
+
+	if (m_uniformBuffer == nullptr || std::memcmp(&m_uniformBuffer->GetData(), &data, sizeof(data)) != 0)
+		m_uniformBuffer = GetUniformBuffer(data);
+	m_uniformBuffer->Bind();
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 #include <glm/vec3.hpp>
 
+struct MaterialData;
+template <typename T>
+class UniformBuffer;
+
 class Material
 {
 public:
@@ -35,4 +39,14 @@ public:
 	}
 
 	unsigned int LoadTexture(const char* path, unsigned int colorFormat);
+
+	/// <summary>
+	/// Binds the uniform buffer with the material's values (MaterialData block).
+	/// Materials with the same values share one buffer, so drawing them needs no upload and no rebind.
+	/// </summary>
+	void BindUniformBuffer() const;
+
+private:
+	// Buffer found for the values at the last bind, looked up again when the values changed.
+	mutable const UniformBuffer<MaterialData>* m_uniformBuffer = nullptr;
 };
\ No newline at end of file
@@ -1,6 +1,10 @@
 #include "Object.h"
 #include <glm/gtx/transform.hpp>
 
+namespace
+{
+	const UniformHandle UNIFORM_MODEL_MAT("modelMat");
+}
 
 Object::Object(Material material, glm::vec3 position, glm::vec3 eulerAngles, glm::vec3 scaleFactor)
 {
@@ -14,40 +18,36 @@ Object::Object(Material material, glm::vec3 position, glm::vec3 eulerAngles, glm
 void Object::Render(const Shader& shader, bool wireframeMode)
 {
 	// Add texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, material.texture);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, material.texture);
 
 	// Add normalMap
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, material.normalMap);
+	GLState::ActiveTexture(GL_TEXTURE1);
+	GLState::BindTexture(GL_TEXTURE_2D, material.normalMap);
 
 	// Add displacement
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, material.displacementMap);
+	GLState::ActiveTexture(GL_TEXTURE2);
+	GLState::BindTexture(GL_TEXTURE_2D, material.displacementMap);
 
 	// Set render mode to wireframe
 	if (wireframeMode)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		GLState::PolygonMode(GL_LINE);
 
-	glBindVertexArray(VAO);
-	shader.setMat4("modelMat", transform);
-	shader.setFloat("ambientStrength", material.ambientStrength);
-	shader.setFloat("diffuseStrength", material.diffuseStrength);
-	shader.setFloat("specularStrength", material.specularStrength);
-	shader.setFloat("focus", material.focus);
-	shader.setVec3("textureColor", material.color);
+	GLState::BindVertexArray(VAO);
+	shader.setMat4(UNIFORM_MODEL_MAT, transform);
+	material.BindUniformBuffer();
 
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_VERTICES);
 	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
 
 	// Reset render mode
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	GLState::PolygonMode(GL_FILL);
 }
 
 void Object::RenderDepth(const Shader& shader)
 {
-	glBindVertexArray(VAO);
-	shader.setMat4("modelMat", transform);
+	GLState::BindVertexArray(VAO);
+	shader.setMat4(UNIFORM_MODEL_MAT, transform);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO_VERTICES);
 	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
 }
@@ -68,12 +68,25 @@ std::vector<float> Object::GetVerticesInWorldSpace()
 	return worldVertices;
 }
 
+std::vector<float> Object::GetVerticesInObjectSpace()
+{
+	std::vector<float> objectVertices = std::vector<float>(vertexCount * 3);
+	for (int i = 0; i < vertexCount; i++)
+	{
+		int index = indices[i] * 3;
+		objectVertices[index] = vertices[index];
+		objectVertices[index + 1] = vertices[index + 1];
+		objectVertices[index + 2] = vertices[index + 2];
+	}
+	return objectVertices;
+}
+
 void Object::initialize()
 {
 	// Generate Vertex-Array-Cube to store vertex attribute configuration and which VBO(s) to use
 	glGenVertexArrays(1, &VAO);
 	// Bind Vertex-Array-Cube to configure VBO(s)
-	glBindVertexArray(VAO);
+	GLState::BindVertexArray(VAO);
 
 	// Generate Vertex-Buffer-Cube to manage memory on GPU and store vertices
 	glGenBuffers(1, &VBO_VERTICES);
@@ -109,7 +122,7 @@ void Object::initialize()
 	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(0));
 	glEnableVertexAttribArray(3);
 
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 }
 
 void Object::calculateTangents()
@@ -24,6 +24,7 @@ public:
 	void RenderDepth(const Shader& shader);
 
 	std::vector<float> GetVerticesInWorldSpace();
+	std::vector<float> GetVerticesInObjectSpace();
 
 protected:
 	void initialize();
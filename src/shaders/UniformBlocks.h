@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glad\glad.h>
+#include <glm/matrix.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+#include "../util/GLState.h"
+
+// Binding points of the uniform blocks, Shader assigns them to the blocks of every program by name.
+constexpr GLuint FRAME_DATA_BINDING = 0;
+constexpr GLuint MATERIAL_DATA_BINDING = 1;
+
+/// <summary>
+/// Camera, light and render settings shared by all programs, uploaded once per frame.
+/// Mirrors the std140 layout of the FrameData block in the shaders, keep both in the same order.
+/// </summary>
+struct FrameData
+{
+	glm::mat4 viewMat;
+	glm::mat4 projectionMat;
+	glm::mat4 lightSpaceMat;
+	// A vec3 takes 16 bytes in std140, the next float fills the gap.
+	glm::vec3 cameraPos;
+	float bumpiness;
+	glm::vec3 lightPos;
+	float lightIntensity;
+	glm::vec3 lightColor;
+	float ambientLightAmount;
+	float heightScale;
+	float minVariance;
+	int steps;
+	int refinementSteps;
+	float displacementFactor;
+	float tesselationAmount;
+	// The block size is rounded up to 16 bytes
+	float padding[2] = {};
+};
+
+static_assert(offsetof(FrameData, lightSpaceMat) == 128, "FrameData does not match the std140 layout");
+static_assert(offsetof(FrameData, cameraPos) == 192, "FrameData does not match the std140 layout");
+static_assert(offsetof(FrameData, lightPos) == 208, "FrameData does not match the std140 layout");
+static_assert(offsetof(FrameData, lightColor) == 224, "FrameData does not match the std140 layout");
+static_assert(offsetof(FrameData, heightScale) == 240, "FrameData does not match the std140 layout");
+static_assert(offsetof(FrameData, displacementFactor) == 256, "FrameData does not match the std140 layout");
+static_assert(sizeof(FrameData) == 272, "FrameData does not match the std140 layout");
+
+/// <summary>
+/// Values of a Material, mirrors the MaterialData block in the shaders.
+/// </summary>
+struct MaterialData
+{
+	glm::vec3 textureColor;
+	float ambientStrength;
+	float diffuseStrength;
+	float specularStrength;
+	float focus;
+	float padding = 0.0f;
+};
+
+static_assert(offsetof(MaterialData, diffuseStrength) == 16, "MaterialData does not match the std140 layout");
+static_assert(sizeof(MaterialData) == 32, "MaterialData does not match the std140 layout");
+
+/// <summary>
+/// Buffer holding one uniform block, shared by every program that uses the block.
+/// Keeps a copy of the uploaded data, so updates with the same values are skipped like uniforms in Shader.
+/// </summary>
+template <typename T>
+class UniformBuffer
+{
+public:
+	explicit UniformBuffer(GLuint binding) : m_binding(binding)
+	{
+		glCreateBuffers(1, &m_buffer);
+		glNamedBufferData(m_buffer, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+	}
+
+	~UniformBuffer()
+	{
+		glDeleteBuffers(1, &m_buffer);
+	}
+
+	UniformBuffer(const UniformBuffer&) = delete;
+	UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+	void Update(const T& data)
+	{
+		bool changed = !m_hasData || std::memcmp(&m_data, &data, sizeof(T)) != 0;
+		GLState::Count(changed);
+		if (!changed)
+			return;
+
+		// Direct state access, the GL_UNIFORM_BUFFER binding stays untouched.
+		glNamedBufferSubData(m_buffer, 0, sizeof(T), &data);
+		m_data = data;
+		m_hasData = true;
+	}
+
+	/// <summary>
+	/// Binds the buffer to its block's binding point, used by all programs drawn afterwards.
+	/// </summary>
+	void Bind() const
+	{
+		GLState::BindUniformBuffer(m_binding, m_buffer);
+	}
+
+	const T& GetData() const
+	{
+		return m_data;
+	}
+
+private:
+	GLuint m_buffer = 0;
+	GLuint m_binding;
+	T m_data;
+	bool m_hasData = false;
+};
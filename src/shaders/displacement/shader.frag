@@ -18,25 +18,35 @@ uniform sampler2D normalMap;
 uniform sampler2D displacementMap;
 uniform sampler2D shadowMap;
 
-uniform vec3 textureColor;
-
-uniform float ambientStrength;
-uniform float diffuseStrength;
-uniform float specularStrength;
-uniform float focus;
-
-
-uniform vec3 lightColor;
-uniform float lightIntensity;
-uniform float ambientLightAmount;
-
-uniform float bumpiness;
-uniform float heightScale;
-
-uniform int steps;
-uniform int refinementSteps;
-
-uniform float minVariance = 0.00001;
+// Per-frame data, shared by all programs (FrameData in UniformBlocks.h)
+layout (std140) uniform FrameData
+{
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 lightSpaceMat;
+    vec3 cameraPos;
+    float bumpiness;
+    vec3 lightPos;
+    float lightIntensity;
+    vec3 lightColor;
+    float ambientLightAmount;
+    float heightScale;
+    float minVariance;
+    int steps;
+    int refinementSteps;
+    float displacementFactor;
+    float tesselationAmount;
+};
+
+// Values of the object's material (MaterialData in UniformBlocks.h)
+layout (std140) uniform MaterialData
+{
+    vec3 textureColor;
+    float ambientStrength;
+    float diffuseStrength;
+    float specularStrength;
+    float focus;
+};
 
 float calculateShadowAmount(vec4 fragPosLightSpace, vec3 lightDirection, vec3 normal){
     // Transform to range between -1 and 1
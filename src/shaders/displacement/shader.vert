@@ -21,14 +21,26 @@ out VS_OUT{
 
 // Local to World
 uniform mat4 modelMat;
-// World to View (Camera)
-uniform mat4 viewMat;
-// View to Clip (perspective)
-uniform mat4 projectionMat;
-
-uniform vec3 lightPos;
-uniform vec3 cameraPos;
-uniform mat4 lightSpaceMat;
+
+// Per-frame data, shared by all programs (FrameData in UniformBlocks.h)
+layout (std140) uniform FrameData
+{
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 lightSpaceMat;
+    vec3 cameraPos;
+    float bumpiness;
+    vec3 lightPos;
+    float lightIntensity;
+    vec3 lightColor;
+    float ambientLightAmount;
+    float heightScale;
+    float minVariance;
+    int steps;
+    int refinementSteps;
+    float displacementFactor;
+    float tesselationAmount;
+};
 
 void main()
 {
@@ -5,10 +5,28 @@
 #include <glm/matrix.hpp>
 #include <glm\gtc\type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+
+#include "../util/GLState.h"
+#include "UniformBlocks.h"
+
+// KHR_parallel_shader_compile is not part of the generated glad loader.
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+#endif
 
 enum ShaderType
 {
@@ -19,101 +37,233 @@ enum ShaderType
 	TESS_EVAL_SHADER = GL_TESS_EVALUATION_SHADER,
 };
 
+/// <summary>
+/// Uniform name hashed with FNV-1a. Only string literals convert to it, names built at runtime do not compile.
+/// Used to create a UniformHandle, the setters never hash.
+/// </summary>
+struct UniformId
+{
+	uint32_t hash;
+	const char* name;
+
+	template <size_t N>
+	constexpr UniformId(const char (&name)[N]) : hash(hashName(name)), name(name) {}
+
+	/// <summary>
+	/// Hashes the whole name, members of struct arrays ("lights[1].color") keep their index.
+	/// </summary>
+	static constexpr uint32_t hashName(const char* name)
+	{
+		uint32_t hash = 2166136261u;
+		for (; *name != '\0'; name++)
+			hash = (hash ^ (uint8_t)*name) * 16777619u;
+		return hash;
+	}
+};
+
+/// <summary>
+/// Index of a uniform name, the same in every program. Create it once per name (a static constant at the call site),
+/// setting a uniform through it is an array access. Programs without the uniform report it as invalid.
+/// </summary>
+class UniformHandle
+{
+public:
+	explicit UniformHandle(UniformId id) : index(getIndex(id.hash, id.name)), name(id.name) {}
+
+	static constexpr unsigned int INVALID = 0xFFFFFFFFu;
+
+	unsigned int index;
+	// Only kept for error messages
+	const char* name;
+
+	/// <summary>
+	/// Index of the name, added to the table if it is new. INVALID if the hash belongs to another name.
+	/// </summary>
+	static unsigned int getIndex(uint32_t hash, const char* name)
+	{
+		static std::unordered_map<uint32_t, unsigned int> indices;
+		static std::vector<std::string> names;
+
+		auto inserted = indices.emplace(hash, (unsigned int)names.size());
+		if (inserted.second)
+			names.push_back(name);
+		else if (names[inserted.first->second] != name)
+		{
+			std::cout << "Uniform hash collision: " << name << " and " << names[inserted.first->second] << std::endl;
+			return INVALID;
+		}
+		return inserted.first->second;
+	}
+};
+
+/// <summary>
+/// Program built from GLSL files. Linked programs are kept in PROGRAM_CACHE_DIRECTORY (glGetProgramBinary),
+/// later runs load them with glProgramBinary instead of compiling, as long as sources and driver are the same.
+/// Compiling and linking only submits the work, the driver builds the program in the background
+/// (on multiple threads with KHR_parallel_shader_compile). The program is waited for when it is first used.
+/// </summary>
 class Shader
 {
 public:
 	// ID of the program
 	unsigned int shaderProgramID = -1;
 
+	// Created next to kdtree.cache, one file per program named by its hash.
+	static constexpr const char* PROGRAM_CACHE_DIRECTORY = "shadercache";
+
 	Shader() = default;
 
+	// Pending programs are registered by address and the program name is owned, so a copy or move would dangle.
+	Shader(const Shader&) = delete;
+	Shader& operator=(const Shader&) = delete;
+	Shader(Shader&&) = delete;
+	Shader& operator=(Shader&&) = delete;
+
 	~Shader()
 	{
-		glDeleteShader(shaderProgramID);
+		removePending();
+		for (GLuint shader : pendingShaders)
+			glDeleteShader(shader);
+		if (shaderProgramID != -1)
+			GLState::DeleteProgram(shaderProgramID);
 	}
 
+	/// <summary>
+	/// Reads the stage's source, it is only compiled by linkProgram if the program is not in the cache.
+	/// Add all stages before linking, every link builds (or loads) the whole program again.
+	/// </summary>
 	void addShader(const char* shaderPath, ShaderType type, bool shouldLinkProgram = true)
 	{
-		std::string shaderString = readFile(shaderPath);
+		sources.push_back({ shaderPath, type, readFile(shaderPath) });
 
-		const char* shaderCode = shaderString.c_str();
+		if (shouldLinkProgram)
+			linkProgram();
+	}
 
-		int success;
-		char infoLog[512];
+	/// <summary>
+	/// Outputs recorded by transform feedback, applied before linking (and part of the cache key).
+	/// </summary>
+	void setTransformFeedbackVaryings(const char* const* varyings, int count, GLenum bufferMode)
+	{
+		transformFeedbackVaryings.assign(varyings, varyings + count);
+		transformFeedbackBufferMode = bufferMode;
+	}
 
-		// Create shader Object
-		unsigned int shader;
-		shader = glCreateShader(type);
-		if (shaderProgramID == -1)
-			shaderProgramID = glCreateProgram();
+	void activate() const
+	{
+		finishLink();
+		GLState::UseProgram(shaderProgramID);
+	}
 
-		// Attach shader source to shader object
-		glShaderSource(shader, 1, &shaderCode, nullptr);
-		// Compile shader (at run-time)
-		glCompileShader(shader);
-		// Check compilation
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
+	/// <summary>
+	/// Loads the program from the cache or submits its compilation and linking without waiting for the result.
+	/// Submit all programs before using the first one, so the driver can build them at the same time.
+	/// </summary>
+	void linkProgram()
+	{
+		auto start = std::chrono::high_resolution_clock::now();
 
-		// Shader program
-		glAttachShader(shaderProgramID, shader);
+		// Relinking a program that is still building drops the old build.
+		removePending();
+		for (GLuint shader : pendingShaders)
+			glDeleteShader(shader);
+		pendingShaders.clear();
+		linkPending = false;
 
-		if (shouldLinkProgram)
-			linkProgram();
+		// Always a new program, a program binary can not be loaded into a program with attached shaders.
+		if (shaderProgramID != -1)
+			recreateProgram();
+		else
+			shaderProgramID = glCreateProgram();
 
-		// Delete Shaders after linking, not needed anymore
-		glDeleteShader(shader);
+		programHash = hashProgram();
+		if (loadProgramBinary(programHash))
+		{
+			cachedProgramCount++;
+			cacheUniformLocations();
+			bindUniformBlocks();
+		}
+		else
+		{
+			submitCompileAndLink();
+			pendingPrograms.push_back(this);
+			compiledProgramCount++;
+		}
 
+		auto end = std::chrono::high_resolution_clock::now();
+		buildMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
 	}
 
-	void activate() const
+	/// <summary>
+	/// True once the driver finished the program, never blocks.
+	/// Without KHR_parallel_shader_compile only programs that were already waited for are known to be done.
+	/// </summary>
+	bool isLinkComplete() const
 	{
-		glUseProgram(shaderProgramID);
+		if (!linkPending)
+			return true;
+		if (!hasParallelCompile())
+			return false;
+
+		GLint complete = GL_FALSE;
+		glGetProgramiv(shaderProgramID, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete == GL_TRUE;
 	}
 
-	void linkProgram() const
+	/// <summary>
+	/// Finishes the pending programs the driver is done with, the rest is left building. Cheap to call every frame.
+	/// </summary>
+	static void pollPendingPrograms()
 	{
-		int success;
-		char infoLog[512];
-
-		glLinkProgram(shaderProgramID);
-
-		// Check compilation
-		glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &success);
-		if (!success)
+		// Finishing removes the program from the list
+		std::vector<const Shader*> programs = pendingPrograms;
+		for (const Shader* program : programs)
 		{
-			glGetProgramInfoLog(shaderProgramID, 512, nullptr, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_ERROR\n" << infoLog << std::endl;
+			if (program->isLinkComplete())
+				program->finishLink();
 		}
 	}
 
-	void setBool(const std::string& name, bool value) const
+	/// <summary>
+	/// Programs loaded from the cache and submitted for compilation since the start, the compiled ones still building,
+	/// and the time the calling thread spent building them (submitting, waiting and reading back).
+	/// Compile time hidden behind other work is not included.
+	/// </summary>
+	static unsigned int getCachedProgramCount() { return cachedProgramCount; }
+	static unsigned int getCompiledProgramCount() { return compiledProgramCount; }
+	static unsigned int getPendingProgramCount() { return (unsigned int)pendingPrograms.size(); }
+	static long long getBuildMicroseconds() { return buildMicroseconds; }
+
+	// The setters only upload values that differ from the last one set (the program has to be active).
+	// The handles are resolved once where they are declared, so a set is an array access.
+	void setBool(UniformHandle uniform, bool value) const
 	{
-		glUniform1i(getUniformLocation(name.c_str()), (int)value);
+		setInt(uniform, (int)value);
 	}
-	void setInt(const std::string& name, int value) const
+	void setInt(UniformHandle uniform, int value) const
 	{
-		glUniform1i(getUniformLocation(name.c_str()), value);
+		if (const Uniform* entry = updateUniform(uniform, &value, sizeof(value)))
+			glUniform1i(entry->location, value);
 	}
-	void setFloat(const std::string& name, float value) const
+	void setFloat(UniformHandle uniform, float value) const
 	{
-		glUniform1f(getUniformLocation(name.c_str()), value);
+		if (const Uniform* entry = updateUniform(uniform, &value, sizeof(value)))
+			glUniform1f(entry->location, value);
 	}
-	void setVec3(const std::string& name, glm::vec3 value) const
+	void setVec3(UniformHandle uniform, const glm::vec3& value) const
 	{
-		glUniform3fv(getUniformLocation(name.c_str()), 1, glm::value_ptr(value));
+		if (const Uniform* entry = updateUniform(uniform, glm::value_ptr(value), sizeof(value)))
+			glUniform3fv(entry->location, 1, glm::value_ptr(value));
 	}
-	void setVec4(const std::string& name, glm::vec4 value) const
+	void setVec4(UniformHandle uniform, const glm::vec4& value) const
 	{
-		glUniform3fv(getUniformLocation(name.c_str()), 1, glm::value_ptr(value));
+		if (const Uniform* entry = updateUniform(uniform, glm::value_ptr(value), sizeof(value)))
+			glUniform4fv(entry->location, 1, glm::value_ptr(value));
 	}
-	void setMat4(const std::string& name, glm::mat4 value) const
+	void setMat4(UniformHandle uniform, const glm::mat4& value) const
 	{
-		glUniformMatrix4fv(getUniformLocation(name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+		if (const Uniform* entry = updateUniform(uniform, glm::value_ptr(value), sizeof(value)))
+			glUniformMatrix4fv(entry->location, 1, GL_FALSE, glm::value_ptr(value));
 	}
 
 	static std::string readFile(const char* filePath)
@@ -136,13 +286,347 @@ public:
 		return fileStringStream.str();
 	}
 private:
-	GLint getUniformLocation(const std::string& name) const
+	struct Source
+	{
+		// Only kept for error messages
+		std::string path;
+		ShaderType type;
+		std::string code;
+	};
+
+	// Cache files, the version has to be increased whenever the layout of the file changes.
+	struct ProgramCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t programHash;
+		uint32_t binaryFormat;
+		uint32_t binaryLength;
+	};
+	static constexpr char CACHE_MAGIC[4] = { 'S', 'P', 'R', 'G' };
+	static constexpr uint32_t CACHE_VERSION = 1;
+
+	/// <summary>
+	/// Compiles all stages and links without querying any status, a status query would wait for the driver.
+	/// </summary>
+	void submitCompileAndLink()
 	{
-		GLint location = glGetUniformLocation(shaderProgramID, name.c_str());
-		if (location == -1)
+		// Sets the compiler threads before the first compilation
+		hasParallelCompile();
+
+		for (const Source& source : sources)
+		{
+			const char* shaderCode = source.code.c_str();
+
+			// Create shader Object
+			unsigned int shader = glCreateShader(source.type);
+			// Attach shader source to shader object
+			glShaderSource(shader, 1, &shaderCode, nullptr);
+			// Compile shader (at run-time)
+			glCompileShader(shader);
+			glAttachShader(shaderProgramID, shader);
+			// Kept until finishLink to report compilation errors
+			pendingShaders.push_back(shader);
+		}
+
+		if (!transformFeedbackVaryings.empty())
 		{
-			std::cout << "Invalid uniform location: " + name << std::endl;;
+			std::vector<const char*> varyings;
+			for (const std::string& varying : transformFeedbackVaryings)
+				varyings.push_back(varying.c_str());
+			glTransformFeedbackVaryings(shaderProgramID, (GLsizei)varyings.size(), varyings.data(), transformFeedbackBufferMode);
 		}
-		return location;
+
+		glProgramParameteri(shaderProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(shaderProgramID);
+		linkPending = true;
 	}
+
+	/// <summary>
+	/// Waits for a submitted program, reports errors, saves it to the cache and reads its uniforms.
+	/// Called on the first use, so const like the setters.
+	/// </summary>
+	void finishLink() const
+	{
+		if (!linkPending)
+			return;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		removePending();
+		linkPending = false;
+
+		int success;
+		char infoLog[512];
+
+		for (size_t i = 0; i < pendingShaders.size(); i++)
+		{
+			// Check compilation
+			glGetShaderiv(pendingShaders[i], GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(pendingShaders[i], 512, nullptr, infoLog);
+				std::cout << "ERROR::SHADER::COMPILATION_FAILED " << sources[i].path << "\n" << infoLog << std::endl;
+			}
+
+			// Not needed after linking
+			glDetachShader(shaderProgramID, pendingShaders[i]);
+			glDeleteShader(pendingShaders[i]);
+		}
+		pendingShaders.clear();
+
+		// Check linking
+		glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(shaderProgramID, 512, nullptr, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_ERROR\n" << infoLog << std::endl;
+		}
+		else
+		{
+			saveProgramBinary(programHash);
+		}
+
+		cacheUniformLocations();
+		bindUniformBlocks();
+
+		auto end = std::chrono::high_resolution_clock::now();
+		buildMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	}
+
+	/// <summary>
+	/// Replaces the program with an empty one. The new program may get the old name,
+	/// so the current program in GLState and the cached uniform values are dropped.
+	/// </summary>
+	void recreateProgram()
+	{
+		GLState::DeleteProgram(shaderProgramID);
+		uniforms.clear();
+		shaderProgramID = glCreateProgram();
+	}
+
+	void removePending() const
+	{
+		pendingPrograms.erase(std::remove(pendingPrograms.begin(), pendingPrograms.end(), this), pendingPrograms.end());
+	}
+
+	/// <summary>
+	/// Checks for KHR_parallel_shader_compile (or the ARB version) once and lets the driver use as many compiler threads as it likes.
+	/// </summary>
+	static bool hasParallelCompile()
+	{
+		static const bool supported = []() {
+			PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = nullptr;
+			if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+				maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+			else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+				maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+			if (maxShaderCompilerThreads == nullptr)
+				return false;
+
+			// Implementation-specific maximum
+			maxShaderCompilerThreads(0xFFFFFFFFu);
+			return true;
+		}();
+		return supported;
+	}
+
+	/// <summary>
+	/// FNV-1a over the driver (vendor, renderer, version), the sources and the transform feedback outputs.
+	/// Binaries are only valid for the driver that created them, a driver update changes the hash.
+	/// </summary>
+	uint64_t hashProgram() const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		auto hashBytes = [&hash](const void* data, size_t size) {
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (size_t i = 0; i < size; i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+		};
+		// Separates the strings, so moving text from one to the next changes the hash.
+		auto hashString = [&hashBytes](const char* string) {
+			hashBytes(string, std::strlen(string) + 1);
+		};
+
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+		{
+			const char* value = (const char*)glGetString(name);
+			hashString(value != nullptr ? value : "");
+		}
+		for (const Source& source : sources)
+		{
+			hashBytes(&source.type, sizeof(source.type));
+			hashString(source.code.c_str());
+		}
+		for (const std::string& varying : transformFeedbackVaryings)
+			hashString(varying.c_str());
+		hashBytes(&transformFeedbackBufferMode, sizeof(transformFeedbackBufferMode));
+		return hash;
+	}
+
+	static std::string getProgramCachePath(uint64_t programHash)
+	{
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)programHash);
+		return std::string(PROGRAM_CACHE_DIRECTORY) + "/" + name + ".bin";
+	}
+
+	/// <summary>
+	/// Loads the program from the cache, false if there is no file for the hash or the driver rejected the binary.
+	/// </summary>
+	bool loadProgramBinary(uint64_t programHash)
+	{
+		std::ifstream file(getProgramCachePath(programHash), std::ios::binary);
+		if (!file)
+			return false;
+
+		ProgramCacheHeader header;
+		if (!file.read((char*)&header, sizeof(header))
+			|| !std::equal(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic) || header.version != CACHE_VERSION || header.programHash != programHash)
+			return false;
+
+		std::vector<char> binary(header.binaryLength);
+		if (!file.read(binary.data(), binary.size()))
+			return false;
+
+		glProgramBinary(shaderProgramID, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+		int success;
+		glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			// Same driver string, but the driver changed anyway. The program is compiled and the file replaced.
+			std::cout << "Program binary rejected, recompiling: " << getProgramCachePath(programHash) << std::endl;
+			recreateProgram();
+			return false;
+		}
+		return true;
+	}
+
+	void saveProgramBinary(uint64_t programHash) const
+	{
+		GLint length = 0;
+		glGetProgramiv(shaderProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+		// No binary formats supported by the driver
+		if (length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		GLenum binaryFormat;
+		glGetProgramBinary(shaderProgramID, length, &length, &binaryFormat, binary.data());
+
+		ProgramCacheHeader header = {};
+		std::copy(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic);
+		header.version = CACHE_VERSION;
+		header.programHash = programHash;
+		header.binaryFormat = binaryFormat;
+		header.binaryLength = (uint32_t)length;
+
+		std::error_code error;
+		std::filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, error);
+		std::ofstream file(getProgramCachePath(programHash), std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write(binary.data(), length);
+		if (!file)
+			std::cout << "[!] Could not save program to " << getProgramCachePath(programHash) << std::endl;
+	}
+
+	struct Uniform
+	{
+		GLint location = -1;
+		// Last value set (up to a mat4), size 0 until the first one
+		unsigned int size = 0;
+		unsigned char value[sizeof(glm::mat4)];
+	};
+
+	/// <summary>
+	/// Reads the locations of all active uniforms once after linking (uniforms in blocks have none).
+	/// </summary>
+	void cacheUniformLocations() const
+	{
+		uniforms.clear();
+
+		GLint uniformCount = 0;
+		glGetProgramInterfaceiv(shaderProgramID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+		const GLenum properties[] = { GL_NAME_LENGTH, GL_LOCATION };
+		std::string name;
+		for (GLint uniform = 0; uniform < uniformCount; uniform++)
+		{
+			GLint values[2];
+			glGetProgramResourceiv(shaderProgramID, GL_UNIFORM, uniform, 2, properties, 2, nullptr, values);
+			if (values[1] == -1)
+				continue;
+
+			name.resize(values[0]);
+			glGetProgramResourceName(shaderProgramID, GL_UNIFORM, uniform, values[0], nullptr, &name[0]);
+			// GL_NAME_LENGTH includes the terminator
+			name.resize(std::strlen(name.c_str()));
+			// Arrays of basic types are reported as "name[0]" and set by their plain name.
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+				name.resize(name.size() - 3);
+
+			unsigned int index = UniformHandle::getIndex(UniformId::hashName(name.c_str()), name.c_str());
+			if (index == UniformHandle::INVALID)
+				continue;
+			if (index >= uniforms.size())
+				uniforms.resize(index + 1);
+			uniforms[index].location = values[1];
+		}
+	}
+
+	/// <summary>
+	/// Assigns the shared blocks to their binding points (GLSL 330 has no binding qualifier).
+	/// Programs without the block are skipped.
+	/// </summary>
+	void bindUniformBlocks() const
+	{
+		GLuint frameData = glGetUniformBlockIndex(shaderProgramID, "FrameData");
+		if (frameData != GL_INVALID_INDEX)
+			glUniformBlockBinding(shaderProgramID, frameData, FRAME_DATA_BINDING);
+
+		GLuint materialData = glGetUniformBlockIndex(shaderProgramID, "MaterialData");
+		if (materialData != GL_INVALID_INDEX)
+			glUniformBlockBinding(shaderProgramID, materialData, MATERIAL_DATA_BINDING);
+	}
+
+	/// <summary>
+	/// Stores the value and returns the uniform to upload it to, nullptr if the uniform is unknown or already has the value.
+	/// </summary>
+	const Uniform* updateUniform(UniformHandle uniform, const void* value, unsigned int size) const
+	{
+		finishLink();
+		if (uniform.index >= uniforms.size() || uniforms[uniform.index].location == -1)
+		{
+			std::cout << "Invalid uniform location: " << uniform.name << std::endl;
+			return nullptr;
+		}
+
+		Uniform& entry = uniforms[uniform.index];
+		bool changed = entry.size != size || std::memcmp(entry.value, value, size) != 0;
+		GLState::Count(changed);
+		if (!changed)
+			return nullptr;
+
+		entry.size = size;
+		std::memcpy(entry.value, value, size);
+		return &entry;
+	}
+
+	std::vector<Source> sources;
+	std::vector<std::string> transformFeedbackVaryings;
+	GLenum transformFeedbackBufferMode = GL_INTERLEAVED_ATTRIBS;
+
+	// Set while the driver builds the program, the shaders are kept until it is done.
+	mutable bool linkPending = false;
+	mutable std::vector<GLuint> pendingShaders;
+	// Cache file the program is saved to once it is linked
+	uint64_t programHash = 0;
+
+	// Uniforms by UniformHandle::index (location -1 if the program does not have it),
+	// the values are a cache of the program state.
+	mutable std::vector<Uniform> uniforms;
+
+	inline static unsigned int cachedProgramCount = 0;
+	inline static unsigned int compiledProgramCount = 0;
+	inline static long long buildMicroseconds = 0;
+	// Submitted programs that were not used yet
+	inline static std::vector<const Shader*> pendingPrograms;
 };
@@ -1,7 +1,26 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMat;
+// Per-frame data, shared by all programs (FrameData in UniformBlocks.h)
+layout (std140) uniform FrameData
+{
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 lightSpaceMat;
+    vec3 cameraPos;
+    float bumpiness;
+    vec3 lightPos;
+    float lightIntensity;
+    vec3 lightColor;
+    float ambientLightAmount;
+    float heightScale;
+    float minVariance;
+    int steps;
+    int refinementSteps;
+    float displacementFactor;
+    float tesselationAmount;
+};
+
 uniform mat4 modelMat;
 
 void main()
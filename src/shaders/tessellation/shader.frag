@@ -17,19 +17,35 @@ uniform sampler2D diffuseTexture;
 uniform sampler2D normalMap;
 uniform sampler2D displacementMap;
 
-uniform vec3 textureColor;
-
-uniform float ambientStrength;
-uniform float diffuseStrength;
-uniform float specularStrength;
-uniform float focus;
-
-
-uniform vec3 lightColor;
-uniform float lightIntensity;
-uniform float ambientLightAmount;
-
-uniform float bumpiness;
+// Per-frame data, shared by all programs (FrameData in UniformBlocks.h)
+layout (std140) uniform FrameData
+{
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 lightSpaceMat;
+    vec3 cameraPos;
+    float bumpiness;
+    vec3 lightPos;
+    float lightIntensity;
+    vec3 lightColor;
+    float ambientLightAmount;
+    float heightScale;
+    float minVariance;
+    int steps;
+    int refinementSteps;
+    float displacementFactor;
+    float tesselationAmount;
+};
+
+// Values of the object's material (MaterialData in UniformBlocks.h)
+layout (std140) uniform MaterialData
+{
+    vec3 textureColor;
+    float ambientStrength;
+    float diffuseStrength;
+    float specularStrength;
+    float focus;
+};
 
 float linearStep(float low, float high, float value)
 {
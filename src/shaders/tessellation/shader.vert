@@ -21,9 +21,25 @@ out VS_OUT{
     vec4 FragPosLightSpace;
 } vs_out;
 
-uniform vec3 lightPos;
-uniform vec3 cameraPos;
-uniform mat4 lightSpaceMat;
+// Per-frame data, shared by all programs (FrameData in UniformBlocks.h)
+layout (std140) uniform FrameData
+{
+    mat4 viewMat;
+    mat4 projectionMat;
+    mat4 lightSpaceMat;
+    vec3 cameraPos;
+    float bumpiness;
+    vec3 lightPos;
+    float lightIntensity;
+    vec3 lightColor;
+    float ambientLightAmount;
+    float heightScale;
+    float minVariance;
+    int steps;
+    int refinementSteps;
+    float displacementFactor;
+    float tesselationAmount;
+};
 
 void main()
 {
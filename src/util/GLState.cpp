@@ -0,0 +1,133 @@
+#include "GLState.h"
+
+GLuint GLState::m_program = UNKNOWN;
+GLuint GLState::m_vertexArray = UNKNOWN;
+GLenum GLState::m_polygonMode = UNKNOWN;
+unsigned int GLState::m_selectedUnit = 0;
+unsigned int GLState::m_activeUnit = UNKNOWN;
+std::array<GLuint, GLState::TEXTURE_UNITS> GLState::m_textures2D = GetUnknownBindings();
+std::array<GLuint, GLState::TEXTURE_UNITS> GLState::m_textures3D = GetUnknownBindings();
+std::array<GLuint, GLState::UNIFORM_BUFFER_BINDINGS> GLState::m_uniformBuffers = GetUnknownBindings();
+GLState::FrameStats GLState::m_frame;
+GLState::FrameStats GLState::m_lastFrame;
+
+void GLState::UseProgram(GLuint program)
+{
+	Count(program != m_program);
+	if (program == m_program)
+		return;
+
+	glUseProgram(program);
+	m_program = program;
+}
+
+void GLState::DeleteProgram(GLuint program)
+{
+	glDeleteProgram(program);
+	m_program = UNKNOWN;
+}
+
+void GLState::BindVertexArray(GLuint vertexArray)
+{
+	Count(vertexArray != m_vertexArray);
+	if (vertexArray == m_vertexArray)
+		return;
+
+	glBindVertexArray(vertexArray);
+	m_vertexArray = vertexArray;
+}
+
+void GLState::ActiveTexture(GLenum unit)
+{
+	m_selectedUnit = unit - GL_TEXTURE0;
+}
+
+void GLState::BindTexture(GLenum target, GLuint texture)
+{
+	GLuint& binding = GetTextureBinding(target, m_selectedUnit);
+	if (binding == texture)
+	{
+		// The unit switch is skipped as well.
+		Count(false);
+		if (m_selectedUnit != m_activeUnit)
+			Count(false);
+		return;
+	}
+
+	if (m_selectedUnit != m_activeUnit)
+	{
+		glActiveTexture(GL_TEXTURE0 + m_selectedUnit);
+		m_activeUnit = m_selectedUnit;
+		Count(true);
+	}
+	glBindTexture(target, texture);
+	binding = texture;
+	Count(true);
+}
+
+void GLState::BindUniformBuffer(GLuint index, GLuint buffer)
+{
+	if (index >= UNIFORM_BUFFER_BINDINGS)
+	{
+		glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+		Count(true);
+		return;
+	}
+
+	Count(buffer != m_uniformBuffers[index]);
+	if (buffer == m_uniformBuffers[index])
+		return;
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+	m_uniformBuffers[index] = buffer;
+}
+
+void GLState::PolygonMode(GLenum mode)
+{
+	Count(mode != m_polygonMode);
+	if (mode == m_polygonMode)
+		return;
+
+	glPolygonMode(GL_FRONT_AND_BACK, mode);
+	m_polygonMode = mode;
+}
+
+void GLState::Count(bool issued)
+{
+	if (issued)
+		m_frame.issued++;
+	else
+		m_frame.skipped++;
+}
+
+void GLState::BeginFrame()
+{
+	m_lastFrame = m_frame;
+	m_frame = FrameStats();
+}
+
+const GLState::FrameStats& GLState::GetLastFrame()
+{
+	return m_lastFrame;
+}
+
+std::array<GLuint, GLState::TEXTURE_UNITS> GLState::GetUnknownBindings()
+{
+	std::array<GLuint, TEXTURE_UNITS> bindings;
+	bindings.fill(UNKNOWN);
+	return bindings;
+}
+
+GLuint& GLState::GetTextureBinding(GLenum target, unsigned int unit)
+{
+	// Binding that is never equal to a texture, for targets and units without shadow.
+	static GLuint untracked;
+	untracked = UNKNOWN;
+	if (unit >= TEXTURE_UNITS)
+		return untracked;
+	if (target == GL_TEXTURE_2D)
+		return m_textures2D[unit];
+	if (target == GL_TEXTURE_3D)
+		return m_textures3D[unit];
+	return untracked;
+}
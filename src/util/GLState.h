@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad\glad.h>
+
+#include <array>
+
+
+/// <summary>
+/// Shadow of the GL state that changes per draw call (program, vertex array, textures, uniform buffers, polygon mode).
+/// Calls that would not change the state are skipped. The shadow is only right if all of these calls
+/// in the program go through this class, so never call the GL functions directly.
+/// Counts the calls issued and skipped per frame, including the uniforms set through Shader.
+/// </summary>
+class GLState
+{
+public:
+	struct FrameStats
+	{
+		unsigned int issued = 0;
+		unsigned int skipped = 0;
+	};
+
+	static void UseProgram(GLuint program);
+	/// <summary>
+	/// Deletes the program and forgets the current one, glCreateProgram may hand out the same name again.
+	/// </summary>
+	static void DeleteProgram(GLuint program);
+	static void BindVertexArray(GLuint vertexArray);
+	/// <summary>
+	/// Only selects the unit, glActiveTexture is issued with the next bind that changes something.
+	/// Texture edits (glTexParameter etc.) therefore need a texture that was just bound (new textures)
+	/// or the direct state access functions (glTextureParameter etc.).
+	/// </summary>
+	static void ActiveTexture(GLenum unit);
+	static void BindTexture(GLenum target, GLuint texture);
+	/// <summary>
+	/// Binds the whole buffer to the uniform block binding point (glBindBufferBase with GL_UNIFORM_BUFFER).
+	/// Also changes the generic GL_UNIFORM_BUFFER binding, which is not shadowed.
+	/// </summary>
+	static void BindUniformBuffer(GLuint index, GLuint buffer);
+	/// <summary>
+	/// Polygon mode for GL_FRONT_AND_BACK.
+	/// </summary>
+	static void PolygonMode(GLenum mode);
+
+	/// <summary>
+	/// Counts a call decided on elsewhere (uniform values are shadowed per program by Shader).
+	/// </summary>
+	static void Count(bool issued);
+
+	/// <summary>
+	/// Starts counting the next frame, the counts of the previous one are kept for GetLastFrame.
+	/// </summary>
+	static void BeginFrame();
+	static const FrameStats& GetLastFrame();
+
+private:
+	// Units with shadowed bindings, binds on higher units are always issued.
+	static constexpr unsigned int TEXTURE_UNITS = 16;
+	// Binding points with shadowed uniform buffers, the same count so GetUnknownBindings fits both.
+	static constexpr unsigned int UNIFORM_BUFFER_BINDINGS = TEXTURE_UNITS;
+	// Never a valid name or enum, so the first call always gets issued.
+	static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	static std::array<GLuint, TEXTURE_UNITS> GetUnknownBindings();
+	static GLuint& GetTextureBinding(GLenum target, unsigned int unit);
+
+	static GLuint m_program;
+	static GLuint m_vertexArray;
+	static GLenum m_polygonMode;
+	// Unit selected by ActiveTexture and the unit GL currently has active.
+	static unsigned int m_selectedUnit;
+	static unsigned int m_activeUnit;
+	static std::array<GLuint, TEXTURE_UNITS> m_textures2D;
+	static std::array<GLuint, TEXTURE_UNITS> m_textures3D;
+	static std::array<GLuint, UNIFORM_BUFFER_BINDINGS> m_uniformBuffers;
+
+	static FrameStats m_frame;
+	static FrameStats m_lastFrame;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+
+/// <summary>
+/// Read-only memory mapped file (CreateFileMapping on Windows, mmap everywhere else).
+/// The data stays valid until the file is closed or the object is destroyed.
+/// </summary>
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/// <summary>
+	/// Maps the whole file, returns false if it does not exist or can not be mapped (e.g. empty files).
+	/// </summary>
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+	const unsigned char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+
+private:
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+
+	const unsigned char* m_data = nullptr;
+	size_t m_size = 0;
+};
+
@@ -0,0 +1,134 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Pool and queue of the current worker thread (nullptr for non-worker threads).
+	thread_local const ThreadPool* currentPool = nullptr;
+	thread_local unsigned int currentQueueIndex = 0;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	threadCount = std::max(1u, threadCount);
+	for (unsigned int i = 0; i < threadCount; i++)
+		m_queues.push_back(std::make_unique<Queue>());
+
+	// The calling thread is the last participant.
+	for (unsigned int i = 0; i + 1 < threadCount; i++)
+		m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wakeUp.notify_all();
+
+	for (std::thread& thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::Run(TaskGroup& group, std::function<void()> task)
+{
+	group.m_pending++;
+
+	Queue& queue = *m_queues[getQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(Task{ std::move(task), &group });
+	}
+	m_queuedTasks++;
+
+	// Lock once, so a worker can not miss the notification between checking for work and sleeping.
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+	}
+	m_wakeUp.notify_one();
+}
+
+void ThreadPool::Wait(TaskGroup& group)
+{
+	unsigned int queueIndex = getQueueIndex();
+	while (!group.IsDone())
+	{
+		if (!tryRunTask(queueIndex))
+			std::this_thread::yield();
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body)
+{
+	grainSize = std::max<size_t>(1, grainSize);
+	TaskGroup group;
+	// Keep the first chunk for the calling thread.
+	for (size_t begin = grainSize; begin < count; begin += grainSize)
+	{
+		size_t end = std::min(count, begin + grainSize);
+		Run(group, [&body, begin, end]() { body(begin, end); });
+	}
+	body(0, std::min(count, grainSize));
+	Wait(group);
+}
+
+unsigned int ThreadPool::GetThreadCount() const
+{
+	return m_queues.size();
+}
+
+void ThreadPool::workerLoop(unsigned int queueIndex)
+{
+	currentPool = this;
+	currentQueueIndex = queueIndex;
+
+	while (!m_stop)
+	{
+		if (tryRunTask(queueIndex))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wakeUp.wait(lock, [this]() { return m_stop || m_queuedTasks > 0; });
+	}
+}
+
+unsigned int ThreadPool::getQueueIndex() const
+{
+	return currentPool == this ? currentQueueIndex : m_queues.size() - 1;
+}
+
+bool ThreadPool::tryRunTask(unsigned int queueIndex)
+{
+	Task task;
+	bool found = false;
+
+	// Own queue first (newest task, still hot in cache), then steal the oldest task of the others.
+	for (unsigned int i = 0; i < m_queues.size() && !found; i++)
+	{
+		Queue& queue = *m_queues[(queueIndex + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		if (i == 0) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		found = true;
+	}
+
+	if (!found)
+		return false;
+
+	m_queuedTasks--;
+	task.function();
+	task.group->m_pending--;
+	return true;
+}
+
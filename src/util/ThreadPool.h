@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// <summary>
+/// Small work-stealing thread pool.
+/// Every worker has its own task queue (LIFO for itself, FIFO for thieves),
+/// idle workers steal from the others. Threads waiting for a task group help
+/// executing tasks, so tasks can spawn and wait for sub-tasks (recursive builds).
+/// </summary>
+class ThreadPool
+{
+public:
+	/// <summary>
+	/// Tasks that can be waited for together.
+	/// </summary>
+	class TaskGroup
+	{
+	public:
+		bool IsDone() const { return m_pending == 0; }
+
+	private:
+		friend class ThreadPool;
+		std::atomic<int> m_pending = 0;
+	};
+
+	/// <summary>
+	/// threadCount includes the calling thread, which works while waiting.
+	/// A pool with a single thread executes everything in Wait().
+	/// </summary>
+	explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Run(TaskGroup& group, std::function<void()> task);
+
+	/// <summary>
+	/// Blocks until all tasks of the group are done, executing queued tasks in the meantime.
+	/// </summary>
+	void Wait(TaskGroup& group);
+
+	/// <summary>
+	/// Calls body(begin, end) for chunks of [0, count) with at most grainSize elements and waits for all of them.
+	/// </summary>
+	void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body);
+
+	unsigned int GetThreadCount() const;
+
+private:
+	struct Task
+	{
+		std::function<void()> function;
+		TaskGroup* group = nullptr;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(unsigned int queueIndex);
+	unsigned int getQueueIndex() const;
+	bool tryRunTask(unsigned int queueIndex);
+
+private:
+	std::vector<std::thread> m_threads;
+	// One queue per worker and a shared one (last) for all other threads.
+	std::vector<std::unique_ptr<Queue>> m_queues;
+
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeUp;
+	std::atomic<int> m_queuedTasks = 0;
+	std::atomic<bool> m_stop = false;
+};
+
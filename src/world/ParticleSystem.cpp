@@ -1,5 +1,26 @@
 #include "ParticleSystem.h"
 
+namespace
+{
+	const UniformHandle UNIFORM_G_POSITION("gPosition");
+	const UniformHandle UNIFORM_G_VELOCITY_MIN("gVelocityMin");
+	const UniformHandle UNIFORM_G_VELOCITY_RANGE("gVelocityRange");
+	const UniformHandle UNIFORM_G_GRAVITY("gGravity");
+	const UniformHandle UNIFORM_G_COLOR("gColor");
+	const UniformHandle UNIFORM_G_SIZE("gSize");
+	const UniformHandle UNIFORM_G_LIFETIME_MIN("gLifetimeMin");
+	const UniformHandle UNIFORM_G_LIFETIME_RANGE("gLifetimeRange");
+	const UniformHandle UNIFORM_S_TIME_PASSED("sTimePassed");
+	const UniformHandle UNIFORM_G_NUMBER_OF_PARTICLES_TO_SPAWN("gNumberOfParticlesToSpawn");
+	const UniformHandle UNIFORM_G_PARTICLE_TYPE("gParticleType");
+	const UniformHandle UNIFORM_COLOR_BLEND_START("colorBlendStart");
+	const UniformHandle UNIFORM_COLOR_BLEND_END("colorBlendEnd");
+	const UniformHandle UNIFORM_G_RANDOM_SEED("gRandomSeed");
+	const UniformHandle UNIFORM_QUAD1("quad1");
+	const UniformHandle UNIFORM_QUAD2("quad2");
+	const UniformHandle UNIFORM_MAX_LIFETIME("maxLifetime");
+}
+
 void printError2()
 {
 	GLenum error = glGetError();
@@ -9,7 +30,7 @@ void printError2()
 	}
 }
 
-ParticleSystem::ParticleSystem(const Camera& camera)
+ParticleSystem::ParticleSystem()
 {
 	m_material = Material(BRICK_WALL_2, GL_RGBA);
 
@@ -19,11 +40,7 @@ ParticleSystem::ParticleSystem(const Camera& camera)
 	// Define which attributes should be recorded by the transform feedback
 	const char* attributes[6] = { "pPositionOut", "pVelocityOut", "pColorOut", "pLifetimeOut", "pSizeOut", "pTypeOut",
 	};
-
-	for (int i = 0; i < 6; i++)
-	{
-		glTransformFeedbackVaryings(m_updateShader.shaderProgramID, 6, attributes, GL_INTERLEAVED_ATTRIBS);
-	}
+	m_updateShader.setTransformFeedbackVaryings(attributes, 6, GL_INTERLEAVED_ATTRIBS);
 
 	m_updateShader.linkProgram();
 
@@ -43,7 +60,7 @@ ParticleSystem::ParticleSystem(const Camera& camera)
 
 	for (int i = 0; i < 2; i++)
 	{
-		glBindVertexArray(m_VAOs[i]);
+		GLState::BindVertexArray(m_VAOs[i]);
 
 		glBindBuffer(GL_ARRAY_BUFFER, m_VBOs[i]);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(Particle) * MAX_PARTICLES, nullptr, GL_DYNAMIC_DRAW);
@@ -77,29 +94,25 @@ ParticleSystem::ParticleSystem(const Camera& camera)
 	m_currentReadBuffer = 0;
 	m_currentNumberOfParticles = 1;
 	m_currentNumberOfGenerators = 1;
-
-	// Set non-changing generation data
-	m_renderShader.activate();
-	m_renderShader.setMat4("projectionMat", camera.ProjectionMat);
 }
 
 void ParticleSystem::Update(const Camera& camera, float deltaTime)
 {
 	m_updateShader.activate();
-	m_updateShader.setVec3("gPosition", SpawnPosition);
-	m_updateShader.setVec3("gVelocityMin", VelocityMin);
-	m_updateShader.setVec3("gVelocityRange", VelocityRange);
-	m_updateShader.setVec3("gGravity", Gravity);
-	m_updateShader.setVec3("gColor", Color);
-	m_updateShader.setFloat("gSize", Size);
-	m_updateShader.setFloat("gLifetimeMin", LifetimeMin);
-	m_updateShader.setFloat("gLifetimeRange", LifetimeRange);
-	m_updateShader.setFloat("sTimePassed", deltaTime);
-	m_updateShader.setInt("gNumberOfParticlesToSpawn", 0);
-	m_updateShader.setFloat("gParticleType", ParticleTypeToSpawn);
-
-	m_updateShader.setVec3("colorBlendStart", ColorBlendStart);
-	m_updateShader.setVec3("colorBlendEnd", ColorBlendEnd);
+	m_updateShader.setVec3(UNIFORM_G_POSITION, SpawnPosition);
+	m_updateShader.setVec3(UNIFORM_G_VELOCITY_MIN, VelocityMin);
+	m_updateShader.setVec3(UNIFORM_G_VELOCITY_RANGE, VelocityRange);
+	m_updateShader.setVec3(UNIFORM_G_GRAVITY, Gravity);
+	m_updateShader.setVec3(UNIFORM_G_COLOR, Color);
+	m_updateShader.setFloat(UNIFORM_G_SIZE, Size);
+	m_updateShader.setFloat(UNIFORM_G_LIFETIME_MIN, LifetimeMin);
+	m_updateShader.setFloat(UNIFORM_G_LIFETIME_RANGE, LifetimeRange);
+	m_updateShader.setFloat(UNIFORM_S_TIME_PASSED, deltaTime);
+	m_updateShader.setInt(UNIFORM_G_NUMBER_OF_PARTICLES_TO_SPAWN, 0);
+	m_updateShader.setFloat(UNIFORM_G_PARTICLE_TYPE, ParticleTypeToSpawn);
+
+	m_updateShader.setVec3(UNIFORM_COLOR_BLEND_START, ColorBlendStart);
+	m_updateShader.setVec3(UNIFORM_COLOR_BLEND_END, ColorBlendEnd);
 
 	m_elapsedTime += deltaTime;
 
@@ -114,7 +127,7 @@ void ParticleSystem::Update(const Camera& camera, float deltaTime)
 
 			for (int i = 0; i < 2; i++)
 			{
-				glBindVertexArray(m_VAOs[i]);
+				GLState::BindVertexArray(m_VAOs[i]);
 				glBindBuffer(GL_ARRAY_BUFFER, m_VBOs[i]);
 				// Add generator particle to both buffers
 				glBufferSubData(GL_ARRAY_BUFFER, sizeof(Particle) * m_currentNumberOfGenerators, sizeof(Particle), &particle);
@@ -124,9 +137,9 @@ void ParticleSystem::Update(const Camera& camera, float deltaTime)
 		}
 
 		m_elapsedTime -= SpawnFrequence;
-		m_updateShader.setInt("gNumberOfParticlesToSpawn", NumberOfParticlesToSpawn / m_currentNumberOfGenerators);
+		m_updateShader.setInt(UNIFORM_G_NUMBER_OF_PARTICLES_TO_SPAWN, NumberOfParticlesToSpawn / m_currentNumberOfGenerators);
 		glm::vec3 randomSeed = glm::vec3(random.Xorshf96_01() * 30 - 10, random.Xorshf96_01() * 30 - 10, random.Xorshf96_01() * 30 - 10);
-		m_updateShader.setVec3("gRandomSeed", randomSeed);
+		m_updateShader.setVec3(UNIFORM_G_RANDOM_SEED, randomSeed);
 	}
 
 	// Disable graphical output. We only want to update the particles, not render them
@@ -135,7 +148,7 @@ void ParticleSystem::Update(const Camera& camera, float deltaTime)
 	glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, m_transformFeedbackBuffer);
 
 	// Bind current read-buffer
-	glBindVertexArray(m_VAOs[m_currentReadBuffer]);
+	GLState::BindVertexArray(m_VAOs[m_currentReadBuffer]);
 	// Enable velocity for calculation
 	glEnableVertexAttribArray(1);
 
@@ -174,7 +187,7 @@ void ParticleSystem::Render(const Camera& camera, bool wireframeMode)
 
 	// Set render mode to wireframe
 	if (wireframeMode)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		GLState::PolygonMode(GL_LINE);
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
@@ -186,18 +199,17 @@ void ParticleSystem::Render(const Camera& camera, bool wireframeMode)
 	glDepthMask(0);
 
 	// Add texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, m_material.texture);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, m_material.texture);
 
 	m_renderShader.activate();
-	m_renderShader.setMat4("viewMat", m_viewMat);
 	//m_renderShader.setVec3("cameraPos", camera.Position);
-	m_renderShader.setVec3("quad1", m_quad1);
-	m_renderShader.setVec3("quad2", m_quad2);
-	m_renderShader.setFloat("maxLifetime", LifetimeMin + LifetimeRange);
+	m_renderShader.setVec3(UNIFORM_QUAD1, m_quad1);
+	m_renderShader.setVec3(UNIFORM_QUAD2, m_quad2);
+	m_renderShader.setFloat(UNIFORM_MAX_LIFETIME, LifetimeMin + LifetimeRange);
 
 	// Render current read buffer (which we just wrote to)
-	glBindVertexArray(m_VAOs[m_currentReadBuffer]);
+	GLState::BindVertexArray(m_VAOs[m_currentReadBuffer]);
 	// Disable velocity, not needed for rendering
 	glDisableVertexAttribArray(1);
 
@@ -206,7 +218,7 @@ void ParticleSystem::Render(const Camera& camera, bool wireframeMode)
 	glDepthMask(1);
 	glDisable(GL_BLEND);
 
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	GLState::PolygonMode(GL_FILL);
 }
 
 void ParticleSystem::SetMatrices(const Camera& camera)
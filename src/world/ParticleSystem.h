@@ -33,7 +33,7 @@ public:
 
 
 public:
-	ParticleSystem(const Camera& camera);
+	ParticleSystem();
 
 	void Update(const Camera& camera, float deltaTime);
 	void Render(const Camera& camera, bool wireframeMode);
@@ -1,28 +1,28 @@
 #include "ProceduralSystem.h"
 
-ProceduralSystem::ProceduralSystem(float screenWidth, float screenHeight, const Camera& camera)
+namespace
 {
-	shader.addShader(VERTEX_SHADER_PATH, VERTEX_SHADER);
-	shader.addShader(FRAGMENT_SHADER_PATH, FRAGMENT_SHADER);
-	shader.addShader(GEOMETRY_SHADER_PATH, GEOMETRY_SHADER);
+	const UniformHandle UNIFORM_WIDTH("width");
+	const UniformHandle UNIFORM_HEIGHT("height");
+	const UniformHandle UNIFORM_DEPTH("depth");
+	const UniformHandle UNIFORM_SOLID_THRESHOLD("solidThreshold");
+}
 
-	shader.activate();
-	// Set values that will not change
-	shader.setMat4("projectionMat", camera.ProjectionMat);
-	shader.setInt("width", TEXTURE_WIDTH);
-	shader.setInt("height", TEXTURE_HEIGHT);
-	shader.setInt("depth", TEXTURE_DEPTH);
-	shader.setFloat("solidThreshold", SOLID_THRESHOLD);
+ProceduralSystem::ProceduralSystem(float screenWidth, float screenHeight)
+{
+	shader.addShader(VERTEX_SHADER_PATH, VERTEX_SHADER, false);
+	shader.addShader(FRAGMENT_SHADER_PATH, FRAGMENT_SHADER, false);
+	shader.addShader(GEOMETRY_SHADER_PATH, GEOMETRY_SHADER);
+	// Submitted together, the large marching cubes program keeps building while the chunks are generated with the noise program.
+	noiseShader.addShader(NOISE_VERTEX_SHADER_PATH, VERTEX_SHADER, false);
+	noiseShader.addShader(NOISE_FRAGMENT_SHADER_PATH, FRAGMENT_SHADER);
 
 	//----------------
 	// Vertex data
 	//----------------
-	noiseShader.addShader(NOISE_VERTEX_SHADER_PATH, VERTEX_SHADER);
-	noiseShader.addShader(NOISE_FRAGMENT_SHADER_PATH, FRAGMENT_SHADER);
-
 	glGenVertexArrays(1, &VAO);
 	// Bind Vertex-Array-Object to configure VBO(s)
-	glBindVertexArray(VAO);
+	GLState::BindVertexArray(VAO);
 	// Generate Vertex-Buffer-Cube to manage memory on GPU and store vertices
 	glGenBuffers(1, &VBO);
 	// Bind Vertex-Buffer-Cube to configure it
@@ -38,6 +38,13 @@ ProceduralSystem::ProceduralSystem(float screenWidth, float screenHeight, const
 	chunks.push_back(Chunk(chunkDimensions, -TEXTURE_HEIGHT, noiseShader, VAO, screenWidth, screenHeight));
 	chunks.push_back(Chunk(chunkDimensions, 0, noiseShader, VAO, screenWidth, screenHeight));
 	chunks.push_back(Chunk(chunkDimensions, TEXTURE_HEIGHT, noiseShader, VAO, screenWidth, screenHeight));
+
+	shader.activate();
+	// Set values that will not change
+	shader.setInt(UNIFORM_WIDTH, TEXTURE_WIDTH);
+	shader.setInt(UNIFORM_HEIGHT, TEXTURE_HEIGHT);
+	shader.setInt(UNIFORM_DEPTH, TEXTURE_DEPTH);
+	shader.setFloat(UNIFORM_SOLID_THRESHOLD, SOLID_THRESHOLD);
 }
 
 void ProceduralSystem::Update(const Camera& camera, bool wireframeMode)
@@ -63,7 +70,6 @@ void ProceduralSystem::Update(const Camera& camera, bool wireframeMode)
 	}
 
 	shader.activate();
-	shader.setMat4("viewMat", camera.GetViewMat());
 
 	// Render each chunk using marching cubes 
 	for (const Chunk& chunk : chunks)
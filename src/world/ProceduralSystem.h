@@ -7,7 +7,7 @@
 class ProceduralSystem
 {
 public:
-	ProceduralSystem(float screenWidth, float screenHeight, const Camera& camera);
+	ProceduralSystem(float screenWidth, float screenHeight);
 
 	void Update(const Camera& camera, bool wireframeMode);
 
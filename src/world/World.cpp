@@ -1,38 +1,49 @@
 #include "World.h"
 
+namespace
+{
+	const UniformHandle UNIFORM_DIFFUSE_TEXTURE("diffuseTexture");
+	const UniformHandle UNIFORM_NORMAL_MAP("normalMap");
+	const UniformHandle UNIFORM_DISPLACEMENT_MAP("displacementMap");
+	const UniformHandle UNIFORM_SHADOW_MAP("shadowMap");
+	const UniformHandle UNIFORM_FILTER_TEXTURE("filterTexture");
+	const UniformHandle UNIFORM_BLUR_SCALE("blurScale");
+}
+
 World::World(const Camera& camera, const Light& light, unsigned int screenWidth, unsigned int screenHeight) : m_camera(camera), m_light(light)
 {
 	m_screenWidth = screenWidth;
 	m_screenHeight = screenHeight;
 
-	/// DISPLACEMENT (normal rendering)
+	/// PROGRAMS
+	// Only submitted here, the driver builds them while the framebuffers and textures below are set up.
+	// The first use of a program waits for it, so the uniforms are set at the end.
 
-	m_displacementShader.addShader(VERTEX_SHADER_DISPLACEMENT, ShaderType::VERTEX_SHADER);
+	// Displacement (normal rendering)
+	m_displacementShader.addShader(VERTEX_SHADER_DISPLACEMENT, ShaderType::VERTEX_SHADER, false);
 	m_displacementShader.addShader(FRAGMENT_SHADER_DISPLACEMENT, ShaderType::FRAGMENT_SHADER);
 
-	m_displacementShader.activate();
-	m_displacementShader.setInt("diffuseTexture", 0);
-	m_displacementShader.setInt("normalMap", 1);
-	m_displacementShader.setInt("displacementMap", 2);
-	m_displacementShader.setInt("shadowMap", 3);
-	m_displacementShader.setMat4("projectionMat", camera.ProjectionMat);
-	m_displacementShader.setFloat("ambientLightAmount", AmbientLight);
+	// Shadows
+	m_depthShader.addShader(VERTEX_SHADER_SHADOW_GEN, ShaderType::VERTEX_SHADER, false);
+	m_depthShader.addShader(FRAGMENT_SHADER_SHADOW_GEN, ShaderType::FRAGMENT_SHADER);
 
-	m_displacementShader.setFloat("lightIntensity", m_light.intensity);
-	m_displacementShader.setVec3("lightColor", m_light.color);
-	m_displacementShader.setVec3("lightPos", m_light.position);
+	// Filtering
+	m_filterShader.addShader(VERTEX_SHADER_GAUSSIAN, ShaderType::VERTEX_SHADER, false);
+	m_filterShader.addShader(FRAGMENT_SHADER_GAUSSIAN, ShaderType::FRAGMENT_SHADER);
 
-	/// SHADOWS
+	// Tesselation
+	m_tesselationShader.addShader(TESSELLATION_VERTEX_SHADER, ShaderType::VERTEX_SHADER, false);
+	m_tesselationShader.addShader(TESSELLATION_CONTROL_SHADER, ShaderType::TESS_CONTROL_SHADER, false);
+	m_tesselationShader.addShader(TESSELLATION_EVAL_SHADER, ShaderType::TESS_EVAL_SHADER, false);
+	m_tesselationShader.addShader(TESSELLATION_FRAGMENT_SHADER, ShaderType::FRAGMENT_SHADER);
 
-	m_depthShader.addShader(VERTEX_SHADER_SHADOW_GEN, ShaderType::VERTEX_SHADER);
-	m_depthShader.addShader(FRAGMENT_SHADER_SHADOW_GEN, ShaderType::FRAGMENT_SHADER);
+	/// SHADOWS
 
-	m_depthShader.activate();
 	// Framebuffer for rendering the depthMap.
 	glGenFramebuffers(1, &m_depthMapFBO);
 	// Create depthMap texture.
 	glGenTextures(1, &m_depthMap);
-	glBindTexture(GL_TEXTURE_2D, m_depthMap);
+	GLState::BindTexture(GL_TEXTURE_2D, m_depthMap);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, m_shadowTextureWidth, m_shadowTextureHeight, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -50,16 +61,11 @@ World::World(const Camera& camera, const Light& light, unsigned int screenWidth,
 
 	/// FILTERING
 
-	m_filterShader.addShader(VERTEX_SHADER_GAUSSIAN, ShaderType::VERTEX_SHADER);
-	m_filterShader.addShader(FRAGMENT_SHADER_GAUSSIAN, ShaderType::FRAGMENT_SHADER);
-	m_filterShader.activate();
-	m_filterShader.setInt("filterTexture", 0);
-
 	// Framebuffer for rendering the depthMap.
 	glGenFramebuffers(1, &m_filterFBO);
 	// Create depthMap texture.
 	glGenTextures(1, &m_filterMap);
-	glBindTexture(GL_TEXTURE_2D, m_filterMap);
+	GLState::BindTexture(GL_TEXTURE_2D, m_filterMap);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, m_shadowTextureWidth, m_shadowTextureHeight, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -73,7 +79,7 @@ World::World(const Camera& camera, const Light& light, unsigned int screenWidth,
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	glGenVertexArrays(1, &m_filterVAO);
-	glBindVertexArray(m_filterVAO);
+	GLState::BindVertexArray(m_filterVAO);
 
 	// Position
 	glGenBuffers(1, &m_filterVBO_Vertices);
@@ -91,23 +97,6 @@ World::World(const Camera& camera, const Light& light, unsigned int screenWidth,
 
 
 	// TESSELATION
-	m_tesselationShader.addShader(TESSELLATION_VERTEX_SHADER, ShaderType::VERTEX_SHADER);
-	m_tesselationShader.addShader(TESSELLATION_CONTROL_SHADER, ShaderType::TESS_CONTROL_SHADER);
-	m_tesselationShader.addShader(TESSELLATION_EVAL_SHADER, ShaderType::TESS_EVAL_SHADER);
-	m_tesselationShader.addShader(TESSELLATION_FRAGMENT_SHADER, ShaderType::FRAGMENT_SHADER);
-
-	m_tesselationShader.activate();
-	m_tesselationShader.setInt("diffuseTexture", 0);
-	m_tesselationShader.setInt("normalMap", 1);
-	m_tesselationShader.setInt("displacementMap", 2);
-
-	m_tesselationShader.setMat4("projectionMat", camera.ProjectionMat);
-	m_tesselationShader.setFloat("ambientLightAmount", AmbientLight);
-
-	m_tesselationShader.setFloat("lightIntensity", m_light.intensity);
-	m_tesselationShader.setVec3("lightColor", m_light.color);
-	m_tesselationShader.setVec3("lightPos", m_light.position);
-
 
 	Material terrainMat = Material("art/bricks2.jpg", "art/bricks2_normal.jpg", "art/bricks2_disp.jpg", GL_RGB);
 	Material terrainMat2 = Material("art/terrain_displacement.jpg", "art/terrain_normal.jpg", "art/terrain_displacement.jpg", GL_RGB);
@@ -115,26 +104,60 @@ World::World(const Camera& camera, const Light& light, unsigned int screenWidth,
 	terrainMat2.ambientStrength = 0.5f;
 	m_terrain = new Terrain(terrainMat, glm::vec3(-25.0f, 0.0f, 5.0f), glm::vec3(-90.0f, 0.0f, 0.0f), glm::vec3(1.0f));
 	m_terrain2 = new Terrain(terrainMat2, glm::vec3(-20.0f, 0.0f, 5.0f), glm::vec3(-90.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+
+	/// UNIFORMS (texture units)
+
+	m_displacementShader.activate();
+	m_displacementShader.setInt(UNIFORM_DIFFUSE_TEXTURE, 0);
+	m_displacementShader.setInt(UNIFORM_NORMAL_MAP, 1);
+	m_displacementShader.setInt(UNIFORM_DISPLACEMENT_MAP, 2);
+	m_displacementShader.setInt(UNIFORM_SHADOW_MAP, 3);
+
+	m_filterShader.activate();
+	m_filterShader.setInt(UNIFORM_FILTER_TEXTURE, 0);
+
+	m_tesselationShader.activate();
+	m_tesselationShader.setInt(UNIFORM_DIFFUSE_TEXTURE, 0);
+	m_tesselationShader.setInt(UNIFORM_NORMAL_MAP, 1);
+	m_tesselationShader.setInt(UNIFORM_DISPLACEMENT_MAP, 2);
 }
 
 void World::Add(Object* object)
 {
 	m_objects.push_back(object);
+
+	std::vector<float> vertices = object->GetVerticesInObjectSpace();
+	m_scene.addObject(vertices.data(), vertices.size() / 3, object->transform);
+}
+
+void World::UpdateScene()
+{
+	for (unsigned int i = 0; i < m_objects.size(); i++)
+		m_scene.setTransform(i, m_objects[i]->transform);
+	m_scene.update();
+}
+
+const KdScene& World::GetScene() const
+{
+	return m_scene;
 }
 
 void World::Render(bool wireframeMode)
 {
+	// Camera, light and settings for every program drawn this frame (including particles and procedural).
+	UpdateFrameData();
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	// Render depth of scene to depthMap texture
 	m_depthShader.activate();
-	m_depthShader.setMat4("lightSpaceMat", m_light.lightSpaceMat);
 	glViewport(0, 0, m_shadowTextureWidth, m_shadowTextureHeight);
 	glBindFramebuffer(GL_FRAMEBUFFER, m_depthMapFBO);
 
-	// Render world's depth
-	for (Object* object : m_objects)
+	// Render world's depth, only objects inside the light frustum can cast shadows into the map.
+	m_scene.queryFrustum(KdStructs::Frustum::fromMatrix(&m_light.lightSpaceMat[0][0]), m_visibleObjects);
+	for (unsigned int object : m_visibleObjects)
 	{
-		object->RenderDepth(m_depthShader);
+		m_objects[object]->RenderDepth(m_depthShader);
 	}
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -145,28 +168,29 @@ void World::Render(bool wireframeMode)
 	/// GAUSSIAN BLUR - Two way pass
 
 	m_filterShader.activate();
-	m_filterShader.setVec3("blurScale", glm::vec3(1.0f / (m_shadowTextureWidth * m_blurAmount), 0.0f, 0.0f));
+	m_filterShader.setVec3(UNIFORM_BLUR_SCALE, glm::vec3(1.0f / (m_shadowTextureWidth * m_blurAmount), 0.0f, 0.0f));
 
 	// Blur x-axis
 	glBindFramebuffer(GL_FRAMEBUFFER, m_filterFBO);
 	// Bind texture to apply blur to
-	glBindTexture(GL_TEXTURE_2D, m_depthMap);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, m_depthMap);
 
-	glBindVertexArray(m_filterVAO);
+	GLState::BindVertexArray(m_filterVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); 
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 
 	// Blur y-axis (use blured texture)
 	glBindFramebuffer(GL_FRAMEBUFFER, m_depthMapFBO);
-	m_filterShader.setVec3("blurScale", glm::vec3(0.0f, 1.0f / (m_shadowTextureHeight * m_blurAmount), 0.0f));
+	m_filterShader.setVec3(UNIFORM_BLUR_SCALE, glm::vec3(0.0f, 1.0f / (m_shadowTextureHeight * m_blurAmount), 0.0f));
 	// Bind texture to apply blur to
-	glBindTexture(GL_TEXTURE_2D, m_filterMap);
+	GLState::BindTexture(GL_TEXTURE_2D, m_filterMap);
 
-	glBindVertexArray(m_filterVAO);
+	GLState::BindVertexArray(m_filterVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 	// Reset
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -174,50 +198,59 @@ void World::Render(bool wireframeMode)
 	glViewport(0, 0, m_screenWidth, m_screenHeight);
 
 	m_displacementShader.activate();
-	m_displacementShader.setMat4("viewMat", m_camera.GetViewMat());
-	m_displacementShader.setVec3("cameraPos", m_camera.Position);
-	m_displacementShader.setFloat("bumpiness", Input::Bumpiness);
-	m_displacementShader.setFloat("heightScale", HeightScale);
-	m_displacementShader.setInt("steps", Steps);
-	m_displacementShader.setInt("refinementSteps", RefinementSteps);
-	m_displacementShader.setMat4("lightSpaceMat", m_light.lightSpaceMat);
-
-	m_displacementShader.setFloat("minVariance", MinVariance);
 
 	// Bind depth texture
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, m_depthMap);
+	GLState::ActiveTexture(GL_TEXTURE3);
+	GLState::BindTexture(GL_TEXTURE_2D, m_depthMap);
 
-	for (Object* object : m_objects)
+	// Skip objects outside the camera's view.
+	glm::mat4 viewProjectionMat = m_camera.ProjectionMat * m_camera.GetViewMat();
+	m_scene.queryFrustum(KdStructs::Frustum::fromMatrix(&viewProjectionMat[0][0]), m_visibleObjects);
+	for (unsigned int object : m_visibleObjects)
 	{
-		object->Render(m_displacementShader, wireframeMode);
+		m_objects[object]->Render(m_displacementShader, wireframeMode);
 	}
 
 	m_tesselationShader.activate();
-	m_tesselationShader.setMat4("viewMat", m_camera.GetViewMat());
-	m_tesselationShader.setVec3("cameraPos", m_camera.Position);
-	m_tesselationShader.setFloat("bumpiness", Input::Bumpiness);
-	m_tesselationShader.setMat4("lightSpaceMat", m_light.lightSpaceMat);
-
-	m_tesselationShader.setFloat("displacementFactor", TesselationDisplacementFactor);
-	m_tesselationShader.setFloat("tesselationAmount", TesselationAmount);
-
 	m_terrain->Render(m_tesselationShader, wireframeMode);
 	m_terrain2->Render(m_tesselationShader, wireframeMode);
 }
 
+void World::UpdateFrameData()
+{
+	FrameData frameData;
+	frameData.viewMat = m_camera.GetViewMat();
+	frameData.projectionMat = m_camera.ProjectionMat;
+	frameData.lightSpaceMat = m_light.lightSpaceMat;
+	frameData.cameraPos = m_camera.Position;
+	frameData.bumpiness = Input::Bumpiness;
+	frameData.lightPos = m_light.position;
+	frameData.lightIntensity = m_light.intensity;
+	frameData.lightColor = m_light.color;
+	frameData.ambientLightAmount = AmbientLight;
+	frameData.heightScale = HeightScale;
+	frameData.minVariance = MinVariance;
+	frameData.steps = Steps;
+	frameData.refinementSteps = RefinementSteps;
+	frameData.displacementFactor = TesselationDisplacementFactor;
+	frameData.tesselationAmount = TesselationAmount;
+
+	m_frameData.Update(frameData);
+	m_frameData.Bind();
+}
+
 void World::ShowLightFrustum(bool show)
 {
-	glBindTexture(GL_TEXTURE_2D, m_depthMap);
+	// Direct state access, the texture may be bound to another unit than the active one (see GLState::ActiveTexture).
 	if (show)
 	{
 		float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glTextureParameterfv(m_depthMap, GL_TEXTURE_BORDER_COLOR, borderColor);
 	}
 	else
 	{
 		float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glTextureParameterfv(m_depthMap, GL_TEXTURE_BORDER_COLOR, borderColor);
 	}
 }
 
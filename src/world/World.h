@@ -7,6 +7,8 @@
 #include "Input.h"
 #include "../objects/Terrain.h"
 #include "../objects/Plane.h"
+#include "../intersection/KdScene.h"
+#include "../shaders/UniformBlocks.h"
 
 
 class World
@@ -15,11 +17,17 @@ public:
 	World(const Camera& camera, const Light& light, unsigned int screenWidth, unsigned int screenHeight);
 
 	void Add(Object* object);
+	// Only draws the objects in the camera (and light) frustum, found with the scene's bounds.
 	void Render(bool wireframeMode);
 	void ShowLightFrustum(bool show);
 
 	std::vector<float> GetWorldVertices();
 
+	// Raycast structure of all objects, object ids are the order in which they were added.
+	// Moved objects (changed transform) are applied by UpdateScene.
+	void UpdateScene();
+	const KdScene& GetScene() const;
+
 public:
 	float HeightScale = 0.1f;
 	float HeightScaleSteps = 0.05f;
@@ -35,7 +43,15 @@ public:
 	float TesselationAmount = 1.0f;
 
 private:
+	/// <summary>
+	/// Uploads the FrameData block shared by all programs, unchanged values are not uploaded again.
+	/// </summary>
+	void UpdateFrameData();
+
 	std::vector<Object*> m_objects = std::vector<Object*>();
+	KdScene m_scene;
+	// Result of the last culling query, kept to reuse its memory every frame.
+	std::vector<unsigned int> m_visibleObjects = std::vector<unsigned int>();
 
 	const char* VERTEX_SHADER_DISPLACEMENT = "src/shaders/displacement/shader.vert";
 	const char* FRAGMENT_SHADER_DISPLACEMENT = "src/shaders/displacement/shader.frag";
@@ -61,6 +77,8 @@ private:
 	Plane filterPlane = Plane(Material(), glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f));
 
 	Shader m_tesselationShader = Shader();
+
+	UniformBuffer<FrameData> m_frameData = UniformBuffer<FrameData>(FRAME_DATA_BINDING);
 	Terrain* m_terrain;
 	Terrain* m_terrain2;
 
@@ -2,6 +2,12 @@
 #include <glm/gtx/transform.hpp>
 #include "input.h"
 
+namespace
+{
+	const UniformHandle UNIFORM_CHUNK_HEIGHT("chunkHeight");
+	const UniformHandle UNIFORM_LAYER("layer");
+}
+
 Chunk::Chunk(ChunkDimensions dimension, float chunkHeight, Shader& shader, unsigned int& VAO, float screenWidth, float screenHeight)
 {
 	m_dimensions = dimension;
@@ -11,7 +17,7 @@ Chunk::Chunk(ChunkDimensions dimension, float chunkHeight, Shader& shader, unsig
 	m_screenHeight = screenHeight;
 	// Create 3D texture
 	glGenTextures(1, &m_texture3D);
-	glBindTexture(GL_TEXTURE_3D, m_texture3D);
+	GLState::BindTexture(GL_TEXTURE_3D, m_texture3D);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -27,8 +33,8 @@ Chunk::Chunk(ChunkDimensions dimension, float chunkHeight, Shader& shader, unsig
 	glFramebufferTexture3D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_3D, m_texture3D, 0, 0);
 	glDrawBuffers(1, &attachment);
 	// Add texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, m_texture3D);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_3D, m_texture3D);
 	// Unbind framebuffer
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	RenderTexture3D(shader);
@@ -44,22 +50,22 @@ void Chunk::UpdateTexture3D(Shader& shader, float newChunkHeight)
 void Chunk::RenderPoints(Shader& shader, bool wireframeMode) const
 {
 	shader.activate();
-	shader.setFloat("chunkHeight", ChunkHeight);
+	shader.setFloat(UNIFORM_CHUNK_HEIGHT, ChunkHeight);
 
 	// Add texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, m_texture3D);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_3D, m_texture3D);
 
 	// Set render mode to wireframe
 	if (wireframeMode)
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		GLState::PolygonMode(GL_LINE);
 
-	glBindVertexArray(m_VAO);
+	GLState::BindVertexArray(m_VAO);
 	glDrawArrays(GL_POINTS, 0, m_dimensions.Width * m_dimensions.Height * m_dimensions.Depth);
 	// Unbind
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 	// Reset render mode
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	GLState::PolygonMode(GL_FILL);
 }
 
 void Chunk::RenderTexture3D(Shader& shader) const
@@ -69,22 +75,22 @@ void Chunk::RenderTexture3D(Shader& shader) const
 	glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
 	shader.activate();
 	float stepSize = 8.0f / 62.0f;
-	shader.setFloat("chunkHeight", ChunkHeight * stepSize);
+	shader.setFloat(UNIFORM_CHUNK_HEIGHT, ChunkHeight * stepSize);
 
 	// Draw rectangles on each layer
 	for (int i = 0; i < m_dimensions.Depth; i++)
 	{
-		shader.setFloat("layer", (float)i / (m_dimensions.Depth - 1));
+		shader.setFloat(UNIFORM_LAYER, (float)i / (m_dimensions.Depth - 1));
 		
 		// Bind current layer
 		glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
 		glFramebufferTexture3D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_3D, m_texture3D, 0, i);
 		// Draw points on each layer
-		glBindVertexArray(m_VAO);
+		GLState::BindVertexArray(m_VAO);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
 	}
 	// Unbind
-	glBindVertexArray(0);
+	GLState::BindVertexArray(0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	// Reset Viewport
 	glViewport(0, 0, m_screenWidth, m_screenHeight);